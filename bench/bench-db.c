@@ -0,0 +1,225 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Benchmark result store, see bench-db.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "bench-db.h"
+
+/* copy src as one field: blanks become '_', empty becomes '-' */
+void db_word(char *dst, size_t size, const char *src)
+{
+	size_t i;
+
+	for (i = 0; i < size - 1 && src[i]; i++)
+		dst[i] = isspace((unsigned char)src[i]) ? '_' : src[i];
+	if (!i)
+		dst[i++] = '-';
+	dst[i] = 0;
+}
+
+static int parse_run(struct db *db, char *line)
+{
+	struct db_run *r;
+	char label[64], host[64], kernel[96];
+	long long t;
+
+	if (sscanf(line, "run %lld %63s %63s %95s", &t, label, host,
+		   kernel) != 4)
+		return -EINVAL;
+
+	r = realloc(db->runs, (db->nruns + 1) * sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	db->runs = r;
+	r += db->nruns;
+	memset(r, 0, sizeof(*r));
+	r->idx = ++db->nruns;
+	r->time = t;
+	strcpy(r->label, label);
+	strcpy(r->host, host);
+	strcpy(r->kernel, kernel);
+	return 0;
+}
+
+static int parse_res(struct db *db, char *line)
+{
+	struct db_run *r;
+	struct db_series *s;
+	char *p, *end;
+	unsigned int i;
+	int len;
+
+	if (!db->nruns)
+		return -EINVAL;
+	r = &db->runs[db->nruns - 1];
+
+	s = realloc(r->series, (r->nseries + 1) * sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	r->series = s;
+	s += r->nseries;
+	memset(s, 0, sizeof(*s));
+
+	if (sscanf(line, "res %63s %15s %23s %u%n", s->scenario, s->type,
+		   s->metric, &s->n, &len) != 4)
+		return -EINVAL;
+	s->v = calloc(s->n ? s->n : 1, sizeof(double));
+	if (!s->v)
+		return -ENOMEM;
+	r->nseries++;
+
+	p = line + len;
+	for (i = 0; i < s->n; i++) {
+		s->v[i] = strtod(p, &end);
+		if (end == p)
+			return -EINVAL;
+		p = end;
+	}
+	return 0;
+}
+
+int db_load(const char *path, struct db *db)
+{
+	char *line = NULL;
+	size_t size = 0;
+	int lineno = 0, ret = 0;
+	FILE *f;
+
+	memset(db, 0, sizeof(*db));
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	while (getline(&line, &size, f) > 0) {
+		lineno++;
+		if (lineno == 1) {
+			if (strncmp(line, DB_MAGIC, strlen(DB_MAGIC))) {
+				ret = -EINVAL;
+				break;
+			}
+			continue;
+		}
+		if (!strncmp(line, "run ", 4))
+			ret = parse_run(db, line);
+		else if (!strncmp(line, "res ", 4))
+			ret = parse_res(db, line);
+		/* other records are left to later versions */
+		if (ret)
+			break;
+	}
+
+	if (ret) {
+		fprintf(stderr, "%s:%d: %s\n", path, lineno, strerror(-ret));
+		db_free(db);
+	}
+	free(line);
+	fclose(f);
+	return ret;
+}
+
+void db_free(struct db *db)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < db->nruns; i++) {
+		for (j = 0; j < db->runs[i].nseries; j++)
+			free(db->runs[i].series[j].v);
+		free(db->runs[i].series);
+	}
+	free(db->runs);
+	memset(db, 0, sizeof(*db));
+}
+
+/* append one run, rec holds its run and res lines */
+int db_append(const char *path, const char *rec, size_t len)
+{
+	struct stat st;
+	char *buf;
+	size_t off = 0;
+	ssize_t n;
+	int fd, ret = 0;
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0)
+		return -errno;
+	if (flock(fd, LOCK_EX) || fstat(fd, &st)) {
+		ret = -errno;
+		goto out;
+	}
+
+	buf = malloc(len + sizeof(DB_MAGIC) + 1);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (!st.st_size)
+		off = sprintf(buf, "%s\n", DB_MAGIC);
+	memcpy(buf + off, rec, len);
+	len += off;
+
+	for (off = 0; off < len; off += n) {
+		n = write(fd, buf + off, len - off);
+		if (n < 0) {
+			ret = -errno;
+			break;
+		}
+	}
+	if (!ret && fsync(fd))
+		ret = -errno;
+	free(buf);
+
+out:
+	close(fd);
+	return ret;
+}
+
+/*
+ * A run by number, "last", "last~N" (N runs before the last one), or
+ * label (the latest run with it).
+ */
+struct db_run *db_find(struct db *db, const char *ref)
+{
+	unsigned long n;
+	char *end;
+	int i;
+
+	if (!db->nruns)
+		return NULL;
+
+	if (!strncmp(ref, "last", 4)) {
+		n = ref[4] == '~' ? strtoul(ref + 5, &end, 10) : 0;
+		if ((ref[4] && (ref[4] != '~' || *end)) || n >= db->nruns)
+			return NULL;
+		return &db->runs[db->nruns - 1 - n];
+	}
+
+	n = strtoul(ref, &end, 10);
+	if (!*end && n >= 1 && n <= db->nruns)
+		return &db->runs[n - 1];
+
+	for (i = db->nruns - 1; i >= 0; i--)
+		if (!strcmp(db->runs[i].label, ref))
+			return &db->runs[i];
+	return NULL;
+}
+
+struct db_series *db_series(struct db_run *r, const char *scenario,
+			    const char *metric)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->nseries; i++)
+		if (!strcmp(r->series[i].scenario, scenario) &&
+		    !strcmp(r->series[i].metric, metric))
+			return &r->series[i];
+	return NULL;
+}
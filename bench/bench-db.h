@@ -0,0 +1,51 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Benchmark result store
+ *
+ * An append-only text file, one record per line, fields separated by
+ * blanks (blanks in names are stored as '_'):
+ *
+ *   DMECDB 1
+ *   run <unix time> <label> <host> <kernel>
+ *   res <scenario> <type> <metric> <n> <v1> ... <vn>
+ *
+ * res lines belong to the run line before them. A run is appended with
+ * one write() under flock(), runs are numbered from 1 in file order.
+ */
+#ifndef _BENCH_DB_H_
+#define _BENCH_DB_H_
+
+#include <stddef.h>
+
+#define DB_MAGIC	"DMECDB 1"
+
+struct db_series {
+	char scenario[64];
+	char type[16];
+	char metric[24];
+	unsigned int n;
+	double *v;
+};
+
+struct db_run {
+	unsigned int idx;
+	long long time;
+	char label[64], host[64], kernel[96];
+	unsigned int nseries;
+	struct db_series *series;
+};
+
+struct db {
+	unsigned int nruns;
+	struct db_run *runs;
+};
+
+int db_load(const char *path, struct db *db);
+void db_free(struct db *db);
+int db_append(const char *path, const char *rec, size_t len);
+void db_word(char *dst, size_t size, const char *src);
+struct db_run *db_find(struct db *db, const char *ref);
+struct db_series *db_series(struct db_run *r, const char *scenario,
+			    const char *metric);
+
+#endif
@@ -0,0 +1,249 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench GPIO workload
+ *
+ *   chip = gpiochip0      chip name or device path
+ *   lines = 0,1           line offsets
+ *   mode = toggle         toggle: set the lines to alternating values
+ *                         read: read the line values
+ *                         toggle-read: set, then read back and compare
+ *                         events: wait for an edge on one of the lines
+ *   edge = both           events: rising, falling or both
+ *   timeout = 1000        events: ms to wait for an edge
+ *
+ * The latency of an event is from its kernel timestamp to the read, the
+ * wakeup delay of an event monitor. The timestamp is CLOCK_MONOTONIC
+ * since kernel 5.7 and CLOCK_REALTIME before; the first event tells
+ * which, a realtime stamp lies far ahead of the monotonic clock. Paired
+ * with a toggle scenario on lines wired to these, it is hammer plus
+ * event-mon.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "dmec-bench.h"
+
+enum { GPIO_TOGGLE, GPIO_READ, GPIO_TOGGLE_READ, GPIO_EVENTS };
+
+struct gpio_priv {
+	int fd, mode, timeout;
+	unsigned int nlines;
+	struct gpiohandle_data data;
+	struct pollfd events[GPIOHANDLES_MAX];
+	clockid_t clock;	/* of the event timestamps, -1: not known yet */
+	uint64_t lat;
+};
+
+static uint64_t gpio_clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* one event handle per line */
+static int gpio_events(int fd, struct gpio_priv *g,
+		       struct gpiohandle_request *req, const char *edge)
+{
+	struct gpioevent_request ev;
+	unsigned int i;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	if (!strcmp(edge, "rising"))
+		ev.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+	else if (!strcmp(edge, "falling"))
+		ev.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	else if (!strcmp(edge, "both"))
+		ev.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	else
+		return -EINVAL;
+	strcpy(ev.consumer_label, "dmec-bench");
+
+	for (i = 0; i < req->lines; i++) {
+		ev.lineoffset = req->lineoffsets[i];
+		if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &ev)) {
+			int ret = -errno;
+
+			while (i--)
+				close(g->events[i].fd);
+			return ret;
+		}
+		g->events[i].fd = ev.fd;
+		g->events[i].events = POLLIN;
+	}
+	return 0;
+}
+
+static int gpio_setup(struct scenario *sc, void **priv)
+{
+	const char *chip = scn_param(sc, "chip", "gpiochip0");
+	const char *mode = scn_param(sc, "mode", "toggle");
+	char *lines = strdup(scn_param(sc, "lines", "0")), *s, *tok;
+	struct gpiohandle_request req;
+	struct gpio_priv *g;
+	char path[128];
+	int fd, ret = 0;
+
+	g = calloc(1, sizeof(*g));
+	if (!g || !lines) {
+		free(g);
+		free(lines);
+		return -ENOMEM;
+	}
+
+	if (!strcmp(mode, "toggle")) {
+		g->mode = GPIO_TOGGLE;
+	} else if (!strcmp(mode, "read")) {
+		g->mode = GPIO_READ;
+	} else if (!strcmp(mode, "toggle-read")) {
+		g->mode = GPIO_TOGGLE_READ;
+	} else if (!strcmp(mode, "events")) {
+		g->mode = GPIO_EVENTS;
+	} else {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	memset(&req, 0, sizeof(req));
+	for (s = lines; (tok = strsep(&s, ",")); ) {
+		if (req.lines == GPIOHANDLES_MAX) {
+			ret = -E2BIG;
+			goto err;
+		}
+		req.lineoffsets[req.lines++] = strtoul(tok, NULL, 0);
+	}
+	req.flags = g->mode == GPIO_READ ? GPIOHANDLE_REQUEST_INPUT :
+		    GPIOHANDLE_REQUEST_OUTPUT;
+	strcpy(req.consumer_label, "dmec-bench");
+
+	snprintf(path, sizeof(path), "%s%s", chip[0] == '/' ? "" : "/dev/",
+		 chip);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+	if (g->mode == GPIO_EVENTS) {
+		g->timeout = scn_param_int(sc, "timeout", 1000);
+		g->clock = -1;
+		ret = gpio_events(fd, g, &req, scn_param(sc, "edge", "both"));
+	} else if (ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req)) {
+		ret = -errno;
+	}
+	close(fd);
+	if (ret)
+		goto err;
+
+	g->fd = req.fd;
+	g->nlines = req.lines;
+	free(lines);
+	*priv = g;
+	return 0;
+
+err:
+	free(lines);
+	free(g);
+	return ret;
+}
+
+static long gpio_event_op(struct gpio_priv *g)
+{
+	struct gpioevent_data ev;
+	unsigned int i;
+	uint64_t now;
+	int ret;
+
+	ret = poll(g->events, g->nlines, g->timeout);
+	if (ret < 0)
+		return -errno;
+	if (!ret)
+		return -ETIMEDOUT;
+
+	for (i = 0; i < g->nlines; i++) {
+		if (!(g->events[i].revents & POLLIN))
+			continue;
+		if (read(g->events[i].fd, &ev, sizeof(ev)) != sizeof(ev))
+			return -EIO;
+		now = bench_now();
+		if (g->clock == -1)
+			g->clock = ev.timestamp > now ? CLOCK_REALTIME :
+				   CLOCK_MONOTONIC;
+		if (g->clock == CLOCK_REALTIME)
+			now = gpio_clock_ns(CLOCK_REALTIME);
+		g->lat = now - ev.timestamp;
+		return 0;
+	}
+	return -EIO;
+}
+
+static long gpio_op(void *priv)
+{
+	struct gpio_priv *g = priv;
+	struct gpiohandle_data rd;
+	unsigned int i;
+
+	if (g->mode == GPIO_EVENTS)
+		return gpio_event_op(g);
+
+	if (g->mode == GPIO_READ) {
+		if (ioctl(g->fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &g->data))
+			return -errno;
+		return 0;
+	}
+
+	for (i = 0; i < g->nlines; i++)
+		g->data.values[i] = !g->data.values[i];
+	if (ioctl(g->fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &g->data))
+		return -errno;
+	if (g->mode == GPIO_TOGGLE)
+		return 0;
+
+	if (ioctl(g->fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &rd))
+		return -errno;
+	if (memcmp(rd.values, g->data.values, g->nlines))
+		return -EIO;
+	return 0;
+}
+
+/* events: edge to wakeup instead of the time spent waiting */
+static int gpio_latency(void *priv, uint64_t *ns)
+{
+	struct gpio_priv *g = priv;
+
+	if (g->mode != GPIO_EVENTS)
+		return 0;
+	*ns = g->lat;
+	return 1;
+}
+
+static void gpio_teardown(void *priv)
+{
+	struct gpio_priv *g = priv;
+	unsigned int i;
+
+	if (g->mode == GPIO_EVENTS)
+		for (i = 0; i < g->nlines; i++)
+			close(g->events[i].fd);
+	else
+		close(g->fd);
+	free(g);
+}
+
+const struct workload wl_gpio = {
+	.type = "gpio",
+	.help = "chip, lines, mode (toggle, read, toggle-read, events),\n"
+		"                    edge, timeout",
+	.setup = gpio_setup,
+	.op = gpio_op,
+	.latency = gpio_latency,
+	.teardown = gpio_teardown,
+};
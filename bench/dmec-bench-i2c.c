@@ -0,0 +1,156 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench I2C workload
+ *
+ *   bus = 11
+ *   addr = 0x50
+ *   mode = read           read: I2C_RDWR offset write + read of len
+ *                         bytes (EEPROM random read)
+ *                         quick: SMBus quick write
+ *                         byte: SMBus receive byte
+ *   len = 32
+ *   offset_bytes = 2      address bytes of the read offset (0..2)
+ *   span = 4096           reads walk offsets 0..span-len, at most
+ *                         what the offset bytes address (default 256
+ *                         with one offset byte)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "dmec-bench.h"
+
+enum { I2C_READ, I2C_QUICK, I2C_BYTE };
+
+struct i2c_priv {
+	int fd, mode, addr, offset_bytes;
+	unsigned int len, span, off;
+	uint8_t *buf;
+};
+
+static int i2c_setup(struct scenario *sc, void **priv)
+{
+	int bus = scn_param_int(sc, "bus", 11);
+	const char *mode = scn_param(sc, "mode", "read");
+	struct i2c_priv *p;
+	char path[32];
+	int ret;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+	p->addr = scn_param_int(sc, "addr", 0x50);
+	p->len = scn_param_int(sc, "len", 32);
+	p->offset_bytes = scn_param_int(sc, "offset_bytes", 2);
+	p->span = scn_param_int(sc, "span", p->offset_bytes == 1 ? 256 : 4096);
+
+	if (!strcmp(mode, "read")) {
+		p->mode = I2C_READ;
+	} else if (!strcmp(mode, "quick")) {
+		p->mode = I2C_QUICK;
+	} else if (!strcmp(mode, "byte")) {
+		p->mode = I2C_BYTE;
+	} else {
+		free(p);
+		return -EINVAL;
+	}
+	if (!p->len || p->len > 8192 || p->len > p->span ||
+	    p->offset_bytes < 0 || p->offset_bytes > 2 ||
+	    (p->offset_bytes && p->span > 1u << (8 * p->offset_bytes))) {
+		free(p);
+		return -EINVAL;
+	}
+
+	p->buf = malloc(p->len);
+	if (!p->buf) {
+		free(p);
+		return -ENOMEM;
+	}
+
+	snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+	p->fd = open(path, O_RDWR);
+	if (p->fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+	/* SMBus transfers go to the slave address, a bound driver is fine */
+	if (ioctl(p->fd, I2C_SLAVE, p->addr) &&
+	    (errno != EBUSY || ioctl(p->fd, I2C_SLAVE_FORCE, p->addr))) {
+		ret = -errno;
+		close(p->fd);
+		goto err;
+	}
+
+	*priv = p;
+	return 0;
+
+err:
+	free(p->buf);
+	free(p);
+	return ret;
+}
+
+static long i2c_op(void *priv)
+{
+	struct i2c_priv *p = priv;
+	union i2c_smbus_data data;
+	struct i2c_smbus_ioctl_data args = { .data = &data };
+	uint8_t ob[2];
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data rdwr = { .msgs = msgs };
+
+	switch (p->mode) {
+	case I2C_QUICK:
+		args.read_write = I2C_SMBUS_WRITE;
+		args.size = I2C_SMBUS_QUICK;
+		args.data = NULL;
+		if (ioctl(p->fd, I2C_SMBUS, &args))
+			return -errno;
+		return 0;
+	case I2C_BYTE:
+		args.read_write = I2C_SMBUS_READ;
+		args.size = I2C_SMBUS_BYTE;
+		if (ioctl(p->fd, I2C_SMBUS, &args))
+			return -errno;
+		return 1;
+	}
+
+	if (p->off + p->len > p->span)
+		p->off = 0;
+	ob[0] = p->offset_bytes == 2 ? p->off >> 8 : p->off;
+	ob[1] = p->off;
+	msgs[0] = (struct i2c_msg){ .addr = p->addr, .len = p->offset_bytes,
+				    .buf = ob };
+	msgs[1] = (struct i2c_msg){ .addr = p->addr, .flags = I2C_M_RD,
+				    .len = p->len, .buf = p->buf };
+	/* without offset bytes it is a plain current address read */
+	rdwr.msgs = p->offset_bytes ? msgs : msgs + 1;
+	rdwr.nmsgs = p->offset_bytes ? 2 : 1;
+	if (ioctl(p->fd, I2C_RDWR, &rdwr) < 0)
+		return -errno;
+	p->off += p->len;
+	return p->len;
+}
+
+static void i2c_teardown(void *priv)
+{
+	struct i2c_priv *p = priv;
+
+	close(p->fd);
+	free(p->buf);
+	free(p);
+}
+
+const struct workload wl_i2c = {
+	.type = "i2c",
+	.help = "bus, addr, mode (read, quick, byte), len, offset_bytes, span",
+	.setup = i2c_setup,
+	.op = i2c_op,
+	.teardown = i2c_teardown,
+};
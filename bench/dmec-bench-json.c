@@ -0,0 +1,130 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench JSON output, shared with dmec-soak
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "dmec-bench.h"
+
+void json_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void json_array(FILE *f, const char *key, const double *v,
+		       unsigned int n, int last)
+{
+	unsigned int i;
+
+	fprintf(f, "        \"%s\": [", key);
+	for (i = 0; i < n; i++)
+		fprintf(f, "%s%.1f", i ? ", " : "", v[i]);
+	fprintf(f, "]%s\n", last ? "" : ",");
+}
+
+void json_result(FILE *f, struct scenario *sc)
+{
+	struct result *r = &sc->res;
+	double secs = r->secs ? r->secs : 1;
+	int i;
+
+	fprintf(f, "    {\n      \"name\": ");
+	json_str(f, sc->name);
+	fprintf(f, ",\n      \"type\": \"%s\",\n      \"params\": {",
+		sc->wl->type);
+	for (i = 0; i < sc->nparams; i++) {
+		fprintf(f, "%s", i ? ", " : "");
+		json_str(f, sc->params[i].key);
+		fprintf(f, ": ");
+		json_str(f, sc->params[i].val);
+	}
+	fprintf(f, "},\n      \"status\": ");
+	json_str(f, r->status);
+	fprintf(f, ",\n      \"warmup_s\": %g,\n      \"duration_s\": %.6f,\n",
+		sc->warmup, r->secs);
+	fprintf(f, "      \"interval_us\": %llu,\n",
+		(unsigned long long)(sc->interval / NSEC_PER_USEC));
+	fprintf(f, "      \"ops\": %llu,\n      \"bytes\": %llu,\n",
+		(unsigned long long)r->ops, (unsigned long long)r->bytes);
+	fprintf(f, "      \"errors\": %llu,\n      \"first_error\": ",
+		(unsigned long long)r->errors);
+	json_str(f, r->errors ? strerror(r->first_error) : "");
+	fprintf(f, ",\n      \"late\": %llu,\n", (unsigned long long)r->late);
+	fprintf(f, "      \"ops_per_s\": %.3f,\n      \"bytes_per_s\": %.3f,\n",
+		r->ops / secs, r->bytes / secs);
+	if (r->ops)
+		fprintf(f, "      \"latency_ns\": {\"min\": %llu, \"mean\": %llu, "
+			"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+			"\"p999\": %llu, \"max\": %llu},\n",
+			(unsigned long long)r->lat_min,
+			(unsigned long long)(r->lat_sum / r->ops),
+			(unsigned long long)hist_pct(r, 0.5),
+			(unsigned long long)hist_pct(r, 0.9),
+			(unsigned long long)hist_pct(r, 0.99),
+			(unsigned long long)hist_pct(r, 0.999),
+			(unsigned long long)r->lat_max);
+	else
+		fprintf(f, "      \"latency_ns\": null,\n");
+	fprintf(f, "      \"cpu\": {\"user_s\": %.6f, \"sys_s\": %.6f, "
+		"\"util\": %.4f, \"vol_cs\": %ld, \"invol_cs\": %ld},\n",
+		r->user, r->sys, r->secs ? (r->user + r->sys) / r->secs : 0,
+		r->vol_cs, r->invol_cs);
+	fprintf(f, "      \"samples\": {\"slice_s\": %g,\n", sc->slice);
+	json_array(f, "ops_per_s", r->s_ops, r->nslices, 0);
+	json_array(f, "bytes_per_s", r->s_bytes, r->nslices, 0);
+	json_array(f, "p50_ns", r->s_p50, r->nlat, 0);
+	json_array(f, "p99_ns", r->s_p99, r->nlat, 1);
+	fprintf(f, "      }\n    }");
+}
+
+/* the document up to the scenario file, the caller adds its lists */
+void json_head(FILE *f, const char *schema, const char *label,
+	       const char *file, time_t started)
+{
+	struct utsname un;
+	char host[256] = "", stamp[32];
+
+	uname(&un);
+	gethostname(host, sizeof(host) - 1);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&started));
+
+	fprintf(f, "{\n  \"schema\": \"%s\",\n  \"label\": ", schema);
+	json_str(f, label);
+	fprintf(f, ",\n  \"host\": ");
+	json_str(f, host);
+	fprintf(f, ",\n  \"kernel\": ");
+	json_str(f, un.release);
+	fprintf(f, ",\n  \"machine\": ");
+	json_str(f, un.machine);
+	fprintf(f, ",\n  \"started\": \"%s\",\n  \"scenario_file\": ", stamp);
+	json_str(f, file);
+}
+
+/* a list of the scenarios that ran */
+void json_results(FILE *f, const char *key, struct scenario *scn, int n)
+{
+	int i, first = 1;
+
+	fprintf(f, ",\n  \"%s\": [", key);
+	for (i = 0; i < n; i++) {
+		if (!scn[i].res.status[0])
+			continue;
+		fprintf(f, "%s\n", first ? "" : ",");
+		json_result(f, &scn[i]);
+		first = 0;
+	}
+	fprintf(f, "\n  ]");
+}
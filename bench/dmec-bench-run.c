@@ -0,0 +1,195 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench runner: warmup, measurement and slicing of one scenario
+ *
+ * Runs in the calling thread, several scenarios can run at the same time
+ * in their own threads (dmec-soak). CPU time is that of the thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "dmec-bench.h"
+
+static double tv_secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* close the current slice: its throughput and latency become samples */
+static void slice_close(struct result *r, struct result *sl, double secs)
+{
+	r->s_ops[r->nslices] = sl->ops / secs;
+	r->s_bytes[r->nslices] = sl->bytes / secs;
+	r->nslices++;
+	if (sl->ops) {
+		r->s_p50[r->nlat] = hist_pct(sl, 0.5);
+		r->s_p99[r->nlat] = hist_pct(sl, 0.99);
+		r->nlat++;
+	}
+	memset(sl, 0, sizeof(*sl));
+}
+
+/*
+ * One phase of a scenario, recorded into r and its slices into sl if r
+ * is not NULL.
+ */
+static void phase(struct scenario *sc, void *priv, double secs,
+		  struct result *r, struct result *sl)
+{
+	uint64_t t0, t1, end, next, lat, slice_ns, slice_t0;
+	long ret;
+
+	t0 = bench_now();
+	end = t0 + secs * NSEC_PER_SEC;
+	next = slice_t0 = t0;
+	slice_ns = sc->slice * NSEC_PER_SEC;
+
+	while (!done && t0 < end) {
+		if (sc->interval) {
+			struct timespec ts = {
+				.tv_sec = next / NSEC_PER_SEC,
+				.tv_nsec = next % NSEC_PER_SEC,
+			};
+
+			if (next >= end)
+				break;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+		t0 = bench_now();
+		ret = sc->wl->op(priv);
+		t1 = bench_now();
+		lat = t1 - t0;
+		if (ret >= 0 && sc->wl->latency)
+			sc->wl->latency(priv, &lat);
+
+		if (sc->interval) {
+			next += sc->interval;
+			/* missed its slot, start over from now */
+			if (t0 >= next) {
+				if (r)
+					r->late++;
+				next = t0 + sc->interval;
+			}
+		}
+		t0 = t1;
+		if (!r)
+			continue;
+
+		if (ret < 0) {
+			if (!r->errors++)
+				r->first_error = -ret;
+			if (sc->max_errors && r->errors >= sc->max_errors) {
+				snprintf(r->status, sizeof(r->status),
+					 "aborted: %lu errors", sc->max_errors);
+				break;
+			}
+		} else {
+			hist_add(r, lat);
+			hist_add(sl, lat);
+			r->ops++;
+			r->bytes += ret;
+			sl->ops++;
+			sl->bytes += ret;
+		}
+
+		if (t1 - slice_t0 >= slice_ns) {
+			slice_close(r, sl, (t1 - slice_t0) / 1e9);
+			slice_t0 = t1;
+		}
+	}
+
+	/* a short last slice would skew the throughput samples */
+	t1 = bench_now();
+	if (r && t1 - slice_t0 >= slice_ns / 2)
+		slice_close(r, sl, (t1 - slice_t0) / 1e9);
+}
+
+/*
+ * Set up, warm up and measure one scenario into sc->res. With start the
+ * warmup waits for the other runs on the barrier.
+ */
+void bench_run(struct scenario *sc, pthread_barrier_t *start)
+{
+	struct result *r = &sc->res, *sl;
+	struct rusage ru0, ru1;
+	cpu_set_t cpus;
+	unsigned int max;
+	uint64_t t0;
+	void *priv = NULL;
+	int ret, i;
+
+	memset(r, 0, sizeof(*r));
+	pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	max = sc->duration / sc->slice + 2;
+	sl = calloc(1, sizeof(*sl));
+	r->s_ops = calloc(max, sizeof(double));
+	r->s_bytes = calloc(max, sizeof(double));
+	r->s_p50 = calloc(max, sizeof(double));
+	r->s_p99 = calloc(max, sizeof(double));
+	if (!sl || !r->s_ops || !r->s_bytes || !r->s_p50 || !r->s_p99) {
+		snprintf(r->status, sizeof(r->status), "setup: %s",
+			 strerror(ENOMEM));
+		goto out_sync;
+	}
+
+	if (sc->pinned) {
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(sc->cpus),
+					     &sc->cpus);
+		if (ret) {
+			snprintf(r->status, sizeof(r->status), "cpu: %s",
+				 strerror(ret));
+			goto out_sync;
+		}
+	}
+
+	ret = sc->wl->setup(sc, &priv);
+	if (ret) {
+		snprintf(r->status, sizeof(r->status), "setup: %s",
+			 strerror(-ret));
+		goto out_sync;
+	}
+	for (i = 0; i < sc->nparams; i++)
+		if (!sc->params[i].used)
+			fprintf(stderr, "[%s] %s: unknown to %s, ignored\n",
+				sc->name, sc->params[i].key, sc->wl->type);
+
+	/* concurrent runs start their warmup together */
+	if (start)
+		pthread_barrier_wait(start);
+	if (sc->warmup)
+		phase(sc, priv, sc->warmup, NULL, NULL);
+
+	getrusage(RUSAGE_THREAD, &ru0);
+	t0 = bench_now();
+	phase(sc, priv, sc->duration, r, sl);
+	r->secs = (bench_now() - t0) / 1e9;
+	getrusage(RUSAGE_THREAD, &ru1);
+
+	sc->wl->teardown(priv);
+	free(sl);
+	if (sc->pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	r->user = tv_secs(&ru1.ru_utime) - tv_secs(&ru0.ru_utime);
+	r->sys = tv_secs(&ru1.ru_stime) - tv_secs(&ru0.ru_stime);
+	r->vol_cs = ru1.ru_nvcsw - ru0.ru_nvcsw;
+	r->invol_cs = ru1.ru_nivcsw - ru0.ru_nivcsw;
+	if (!r->status[0])
+		snprintf(r->status, sizeof(r->status), "%s",
+			 done ? "interrupted" : "ok");
+	return;
+
+out_sync:
+	/* the others wait for everyone, failed or not */
+	if (start)
+		pthread_barrier_wait(start);
+	if (sc->pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	free(sl);
+}
@@ -0,0 +1,224 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench scenario files
+ *
+ * INI style: one section per scenario, named by the section. The keys
+ * type, duration, warmup, slice (s), interval (us), max_errors and cpu
+ * (list like 0,2-3 to pin to) are the runner's, everything else is
+ * passed to the workload. A [defaults]
+ * section sets keys for the sections that follow it.
+ *
+ *   [defaults]
+ *   duration = 10
+ *   warmup = 2
+ *
+ *   [gpio-toggle]
+ *   type = gpio
+ *   chip = gpiochip0
+ *   lines = 0,1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "dmec-bench.h"
+
+#define DEFAULT_DURATION	10
+#define DEFAULT_WARMUP		2
+#define DEFAULT_MAX_ERRORS	1000
+#define DEFAULT_SLICE		1
+
+const struct workload *workloads[] = {
+	&wl_gpio, &wl_serial, &wl_wdt, &wl_i2c, NULL
+};
+
+const struct workload *scn_workload(const char *type)
+{
+	int i;
+
+	for (i = 0; workloads[i]; i++)
+		if (!strcmp(workloads[i]->type, type))
+			return workloads[i];
+	return NULL;
+}
+
+static char *trim(char *s)
+{
+	char *e;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	e = s + strlen(s);
+	while (e > s && isspace((unsigned char)e[-1]))
+		*--e = 0;
+	return s;
+}
+
+static int parse_cpus(cpu_set_t *set, const char *val)
+{
+	unsigned long lo, hi;
+	char *end;
+
+	CPU_ZERO(set);
+	do {
+		lo = hi = strtoul(val, &end, 0);
+		if (end == val)
+			return -EINVAL;
+		if (*end == '-')
+			hi = strtoul(end + 1, &end, 0);
+		if (lo > hi || hi >= CPU_SETSIZE)
+			return -EINVAL;
+		while (lo <= hi)
+			CPU_SET(lo++, set);
+		val = end + 1;
+	} while (*end == ',');
+
+	return *end ? -EINVAL : 0;
+}
+
+static int set_key(struct scenario *sc, const char *key, const char *val)
+{
+	struct param *p;
+	int i;
+
+	if (!strcmp(key, "type")) {
+		sc->wl = scn_workload(val);
+		return sc->wl ? 0 : -EINVAL;
+	}
+	if (!strcmp(key, "duration")) {
+		sc->duration = atof(val);
+		return sc->duration > 0 ? 0 : -EINVAL;
+	}
+	if (!strcmp(key, "warmup")) {
+		sc->warmup = atof(val);
+		return sc->warmup >= 0 ? 0 : -EINVAL;
+	}
+	if (!strcmp(key, "slice")) {
+		sc->slice = atof(val);
+		return sc->slice > 0 ? 0 : -EINVAL;
+	}
+	if (!strcmp(key, "interval")) {
+		sc->interval = strtoull(val, NULL, 0) * NSEC_PER_USEC;
+		return 0;
+	}
+	if (!strcmp(key, "cpu")) {
+		sc->pinned = 1;
+		return parse_cpus(&sc->cpus, val);
+	}
+	if (!strcmp(key, "max_errors")) {
+		sc->max_errors = strtoul(val, NULL, 0);
+		return 0;
+	}
+
+	/* a later value overrides the defaults */
+	for (i = 0; i < sc->nparams; i++)
+		if (!strcmp(sc->params[i].key, key))
+			break;
+	if (i == MAX_PARAMS)
+		return -ENOSPC;
+	p = &sc->params[i];
+	if (strlen(key) >= sizeof(p->key) || strlen(val) >= sizeof(p->val))
+		return -ENAMETOOLONG;
+	strcpy(p->key, key);
+	strcpy(p->val, val);
+	if (i == sc->nparams)
+		sc->nparams++;
+	return 0;
+}
+
+/* returns the number of scenarios, or -errno */
+int scn_load(const char *path, struct scenario *scn, int max)
+{
+	struct scenario def = {
+		.duration = DEFAULT_DURATION,
+		.warmup = DEFAULT_WARMUP,
+		.max_errors = DEFAULT_MAX_ERRORS,
+		.slice = DEFAULT_SLICE,
+	}, *sc = NULL;
+	char line[256], *s, *eq;
+	int n = 0, lineno = 0, ret;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		s = strchr(line, '#');
+		if (s)
+			*s = 0;
+		s = trim(line);
+		if (!*s)
+			continue;
+
+		if (*s == '[') {
+			eq = strchr(s, ']');
+			if (!eq || eq == s + 1) {
+				ret = -EINVAL;
+				goto err;
+			}
+			*eq = 0;
+			s = trim(s + 1);
+			if (!strcmp(s, "defaults")) {
+				sc = &def;
+				continue;
+			}
+			if (n == max) {
+				ret = -ENOSPC;
+				goto err;
+			}
+			sc = &scn[n++];
+			*sc = def;
+			snprintf(sc->name, sizeof(sc->name), "%s", s);
+			continue;
+		}
+
+		eq = strchr(s, '=');
+		if (!sc || !eq) {
+			ret = -EINVAL;
+			goto err;
+		}
+		*eq = 0;
+		ret = set_key(sc, trim(s), trim(eq + 1));
+		if (ret)
+			goto err;
+	}
+	fclose(f);
+
+	for (ret = 0; ret < n; ret++) {
+		if (!scn[ret].wl) {
+			fprintf(stderr, "%s: [%s] has no type\n", path,
+				scn[ret].name);
+			return -EINVAL;
+		}
+	}
+	return n;
+
+err:
+	fprintf(stderr, "%s:%d: %s\n", path, lineno, strerror(-ret));
+	fclose(f);
+	return ret;
+}
+
+const char *scn_param(struct scenario *sc, const char *key, const char *def)
+{
+	int i;
+
+	for (i = 0; i < sc->nparams; i++) {
+		if (!strcmp(sc->params[i].key, key)) {
+			sc->params[i].used = 1;
+			return sc->params[i].val;
+		}
+	}
+	return def;
+}
+
+long scn_param_int(struct scenario *sc, const char *key, long def)
+{
+	const char *v = scn_param(sc, key, NULL);
+
+	return v ? strtol(v, NULL, 0) : def;
+}
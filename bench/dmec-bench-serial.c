@@ -0,0 +1,275 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench serial workload, raw 8N1 without flow control
+ *
+ *   device = /dev/ttyS0
+ *   baud = 115200
+ *   size = 64             bytes per operation
+ *   mode = loop           loop: write, read the same bytes back
+ *                         (loopback plug) and compare
+ *                         tx: write and wait until they are sent
+ *                         duplex: keep sending a counting stream while
+ *                         checking the echo, both directions busy
+ *   window = 4096         duplex: bytes in flight at most
+ *   timeout = 1000        ms to wait for the echo
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+
+#include "dmec-bench.h"
+
+#define DUPLEX_QUIET_MS	50
+
+enum { SER_LOOP, SER_TX, SER_DUPLEX };
+
+struct serial_priv {
+	int fd, mode, timeout;
+	unsigned int size, window;
+	uint8_t seq;
+	uint8_t *tx, *rx;
+	uint64_t sent, received;	/* duplex stream positions */
+};
+
+static const struct {
+	unsigned int baud;
+	speed_t speed;
+} bauds[] = {
+	{ 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+	{ 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+	{ 460800, B460800 }, { 921600, B921600 }, { 1000000, B1000000 },
+	{ 1500000, B1500000 }, { 2000000, B2000000 }, { 3000000, B3000000 },
+	{ 4000000, B4000000 },
+};
+
+static int serial_setup(struct scenario *sc, void **priv)
+{
+	const char *dev = scn_param(sc, "device", "/dev/ttyS0");
+	const char *mode = scn_param(sc, "mode", "loop");
+	unsigned int baud = scn_param_int(sc, "baud", 115200), i;
+	struct serial_priv *s;
+	struct termios tio;
+	int ret;
+
+	for (i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++)
+		if (bauds[i].baud == baud)
+			break;
+	if (i == sizeof(bauds) / sizeof(bauds[0]))
+		return -EINVAL;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	s->size = scn_param_int(sc, "size", 64);
+	s->timeout = scn_param_int(sc, "timeout", 1000);
+	s->window = scn_param_int(sc, "window", 4096);
+	if (!strcmp(mode, "loop")) {
+		s->mode = SER_LOOP;
+	} else if (!strcmp(mode, "tx")) {
+		s->mode = SER_TX;
+	} else if (!strcmp(mode, "duplex")) {
+		s->mode = SER_DUPLEX;
+	} else {
+		free(s);
+		return -EINVAL;
+	}
+	if (!s->size || s->window < s->size) {
+		free(s);
+		return -EINVAL;
+	}
+
+	s->tx = malloc(s->size);
+	s->rx = malloc(s->size);
+	if (!s->tx || !s->rx) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	s->fd = open(dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (s->fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+	if (tcgetattr(s->fd, &tio)) {
+		ret = -errno;
+		goto err_close;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~CRTSCTS;
+	cfsetspeed(&tio, bauds[i].speed);
+	if (tcsetattr(s->fd, TCSANOW, &tio)) {
+		ret = -errno;
+		goto err_close;
+	}
+	tcflush(s->fd, TCIOFLUSH);
+
+	*priv = s;
+	return 0;
+
+err_close:
+	close(s->fd);
+err:
+	free(s->tx);
+	free(s->rx);
+	free(s);
+	return ret;
+}
+
+static int serial_wait(struct serial_priv *s, short events)
+{
+	struct pollfd pfd = { .fd = s->fd, .events = events };
+	int ret;
+
+	ret = poll(&pfd, 1, s->timeout);
+	if (ret < 0)
+		return -errno;
+	return ret ? 0 : -ETIMEDOUT;
+}
+
+/* byte n of the duplex stream */
+static inline uint8_t stream_byte(uint64_t n)
+{
+	return n ^ (n >> 8) ^ (n >> 16);
+}
+
+/*
+ * One round of the duplex stream: send what the window allows, then take
+ * what has come back. Returns the bytes received and checked, a wakeup
+ * that only made room to send is not a round of its own.
+ */
+static long serial_duplex(struct serial_priv *s)
+{
+	unsigned int i, room;
+	short events;
+	ssize_t n;
+	int ret;
+
+	for (;;) {
+		room = s->window - (s->sent - s->received);
+		events = POLLIN;
+		if (room > s->size)
+			room = s->size;
+		if (room) {
+			for (i = 0; i < room; i++)
+				s->tx[i] = stream_byte(s->sent + i);
+			n = write(s->fd, s->tx, room);
+			if (n < 0 && errno != EAGAIN)
+				return -errno;
+			if (n > 0)
+				s->sent += n;
+			if (n < (ssize_t)room)
+				events |= POLLOUT;
+		}
+
+		ret = serial_wait(s, events);
+		if (ret)
+			goto restart;
+		n = read(s->fd, s->rx, s->size);
+		if (n > 0)
+			break;
+		if (n < 0 && errno != EAGAIN)
+			return -errno;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (s->rx[i] != stream_byte(s->received + i)) {
+			ret = -EIO;
+			goto restart;
+		}
+	}
+	s->received += n;
+	return n;
+
+restart:
+	/*
+	 * Lost or corrupted: wait until what is still on its way has come
+	 * back, then start the stream over.
+	 */
+	tcflush(s->fd, TCOFLUSH);
+	do {
+		struct pollfd pfd = { .fd = s->fd, .events = POLLIN };
+
+		if (poll(&pfd, 1, DUPLEX_QUIET_MS) <= 0)
+			break;
+	} while (read(s->fd, s->rx, s->size) > 0);
+	s->sent = s->received = 0;
+	return ret;
+}
+
+static long serial_op(void *priv)
+{
+	struct serial_priv *s = priv;
+	unsigned int i, done_tx = 0, done_rx = 0;
+	ssize_t n;
+	int ret;
+
+	if (s->mode == SER_DUPLEX)
+		return serial_duplex(s);
+
+	/* a different pattern every time, stale echoes don't compare */
+	for (i = 0; i < s->size; i++)
+		s->tx[i] = s->seq + i;
+	s->seq++;
+
+	while (done_tx < s->size) {
+		n = write(s->fd, s->tx + done_tx, s->size - done_tx);
+		if (n < 0 && errno != EAGAIN)
+			return -errno;
+		if (n > 0) {
+			done_tx += n;
+			continue;
+		}
+		ret = serial_wait(s, POLLOUT);
+		if (ret)
+			return ret;
+	}
+
+	if (s->mode == SER_TX) {
+		if (tcdrain(s->fd))
+			return -errno;
+		return s->size;
+	}
+
+	while (done_rx < s->size) {
+		ret = serial_wait(s, POLLIN);
+		if (ret) {
+			tcflush(s->fd, TCIOFLUSH);
+			return ret;
+		}
+		n = read(s->fd, s->rx + done_rx, s->size - done_rx);
+		if (n < 0 && errno != EAGAIN)
+			return -errno;
+		if (n > 0)
+			done_rx += n;
+	}
+	if (memcmp(s->tx, s->rx, s->size)) {
+		tcflush(s->fd, TCIOFLUSH);
+		return -EIO;
+	}
+	return s->size;
+}
+
+static void serial_teardown(void *priv)
+{
+	struct serial_priv *s = priv;
+
+	close(s->fd);
+	free(s->tx);
+	free(s->rx);
+	free(s);
+}
+
+const struct workload wl_serial = {
+	.type = "serial",
+	.help = "device, baud, size, mode (loop, tx, duplex), window,\n"
+		"                    timeout",
+	.setup = serial_setup,
+	.op = serial_op,
+	.teardown = serial_teardown,
+};
@@ -0,0 +1,68 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench latency histogram
+ */
+#include "dmec-bench.h"
+
+static unsigned int bucket(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < 2 * HIST_SUB)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - HIST_BITS) * HIST_SUB + (ns >> (msb - HIST_BITS));
+}
+
+/* smallest and largest value falling into bucket i */
+static uint64_t bucket_lo(unsigned int i)
+{
+	if (i < 2 * HIST_SUB)
+		return i;
+	return (uint64_t)(i % HIST_SUB + HIST_SUB) << (i / HIST_SUB - 1);
+}
+
+static uint64_t bucket_hi(unsigned int i)
+{
+	if (i < 2 * HIST_SUB)
+		return i;
+	return bucket_lo(i) + (1ull << (i / HIST_SUB - 1)) - 1;
+}
+
+void hist_add(struct result *r, uint64_t ns)
+{
+	if (!r->ops || ns < r->lat_min)
+		r->lat_min = ns;
+	if (ns > r->lat_max)
+		r->lat_max = ns;
+	r->lat_sum += ns;
+	r->hist[bucket(ns)]++;
+}
+
+/* p-th percentile (0..1), middle of its bucket, clamped to min/max */
+uint64_t hist_pct(const struct result *r, double p)
+{
+	uint64_t rank, seen = 0, v;
+	unsigned int i;
+
+	if (!r->ops)
+		return 0;
+	rank = p * r->ops + 0.999999;
+	if (!rank)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += r->hist[i];
+		if (seen >= rank)
+			break;
+	}
+	if (i == HIST_BUCKETS)
+		return r->lat_max;
+
+	v = (bucket_lo(i) + bucket_hi(i)) / 2;
+	if (v < r->lat_min)
+		v = r->lat_min;
+	if (v > r->lat_max)
+		v = r->lat_max;
+	return v;
+}
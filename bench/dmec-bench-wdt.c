@@ -0,0 +1,109 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench watchdog workload
+ *
+ *   device = /dev/watchdog0
+ *   timeout = 0           s, set before the run if not 0
+ *   mode = keepalive      keepalive: WDIOC_KEEPALIVE
+ *                         write: write() of one byte
+ *                         timeleft: WDIOC_GETTIMELEFT
+ *
+ * The device is closed with the magic character, a run with interval
+ * left at 0 pings as fast as the driver allows.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/watchdog.h>
+
+#include "dmec-bench.h"
+
+enum { WDT_KEEPALIVE, WDT_WRITE, WDT_TIMELEFT };
+
+struct wdt_priv {
+	int fd, mode;
+};
+
+static int wdt_setup(struct scenario *sc, void **priv)
+{
+	const char *dev = scn_param(sc, "device", "/dev/watchdog0");
+	const char *mode = scn_param(sc, "mode", "keepalive");
+	int timeout = scn_param_int(sc, "timeout", 0);
+	struct wdt_priv *w;
+	int ret;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+
+	if (!strcmp(mode, "keepalive")) {
+		w->mode = WDT_KEEPALIVE;
+	} else if (!strcmp(mode, "write")) {
+		w->mode = WDT_WRITE;
+	} else if (!strcmp(mode, "timeleft")) {
+		w->mode = WDT_TIMELEFT;
+	} else {
+		free(w);
+		return -EINVAL;
+	}
+
+	w->fd = open(dev, O_WRONLY);
+	if (w->fd < 0) {
+		ret = -errno;
+		free(w);
+		return ret;
+	}
+	if (timeout && ioctl(w->fd, WDIOC_SETTIMEOUT, &timeout)) {
+		ret = -errno;
+		write(w->fd, "V", 1);
+		close(w->fd);
+		free(w);
+		return ret;
+	}
+
+	*priv = w;
+	return 0;
+}
+
+static long wdt_op(void *priv)
+{
+	struct wdt_priv *w = priv;
+	int left;
+
+	switch (w->mode) {
+	case WDT_WRITE:
+		if (write(w->fd, "\0", 1) != 1)
+			return -errno;
+		return 1;
+	case WDT_TIMELEFT:
+		if (ioctl(w->fd, WDIOC_GETTIMELEFT, &left))
+			return -errno;
+		return 0;
+	default:
+		if (ioctl(w->fd, WDIOC_KEEPALIVE, 0))
+			return -errno;
+		return 0;
+	}
+}
+
+static void wdt_teardown(void *priv)
+{
+	struct wdt_priv *w = priv;
+
+	if (write(w->fd, "V", 1) != 1)
+		perror("watchdog magic close");
+	close(w->fd);
+	free(w);
+}
+
+const struct workload wl_wdt = {
+	.type = "watchdog",
+	.help = "device, timeout, mode (keepalive, write, timeleft)",
+	.setup = wdt_setup,
+	.op = wdt_op,
+	.teardown = wdt_teardown,
+};
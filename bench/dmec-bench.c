@@ -0,0 +1,283 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench - run GPIO, serial, watchdog and I2C workloads from a
+ * scenario file and report them in one JSON schema
+ *
+ * Every scenario runs its workload for warmup seconds without recording,
+ * then for duration seconds with: operations and payload bytes per
+ * second, latency percentiles of the successful operations, errors, and
+ * the CPU time and context switches the runner used meanwhile. With an
+ * interval the operations start on absolute deadlines, operations that
+ * miss their slot are counted as late.
+ *
+ * The JSON document ("schema": "dmec-bench/1") goes to -o, a summary
+ * table to stderr. The run is also cut into slices (1 s by default)
+ * whose throughput and latency are the samples -R appends to a result
+ * store for dmec-results.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "dmec-bench.h"
+#include "bench-db.h"
+
+volatile sig_atomic_t done;
+
+static void term(int sig)
+{
+	done = 1;
+}
+
+static int json_write(const char *path, const char *file, const char *label,
+		      time_t started, struct scenario *scn, int n)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	int ret;
+
+	if (!f)
+		return -errno;
+
+	json_head(f, BENCH_SCHEMA, label, file, started);
+	json_results(f, "results", scn, n);
+	fprintf(f, "\n}\n");
+
+	ret = fflush(f) ? -errno : 0;
+	if (f != stdout && fclose(f) && !ret)
+		ret = -errno;
+	return ret;
+}
+
+static void db_series_put(FILE *f, struct scenario *sc, const char *metric,
+			  const double *v, unsigned int n)
+{
+	char name[64];
+	unsigned int i;
+
+	db_word(name, sizeof(name), sc->name);
+	fprintf(f, "res %s %s %s %u", name, sc->wl->type, metric, n);
+	for (i = 0; i < n; i++)
+		fprintf(f, " %.1f", v[i]);
+	fprintf(f, "\n");
+}
+
+/* the samples of a run as one record of the result store */
+static int db_write(const char *path, const char *label, time_t started,
+		    struct scenario *scn, int n)
+{
+	struct utsname un;
+	char host[256] = "", w_label[64], w_host[64], w_kernel[96], *rec;
+	size_t len;
+	double err;
+	FILE *f;
+	int i, ret;
+
+	f = open_memstream(&rec, &len);
+	if (!f)
+		return -errno;
+
+	uname(&un);
+	gethostname(host, sizeof(host) - 1);
+	db_word(w_label, sizeof(w_label), label);
+	db_word(w_host, sizeof(w_host), host);
+	db_word(w_kernel, sizeof(w_kernel), un.release);
+	fprintf(f, "run %lld %s %s %s\n", (long long)started, w_label, w_host,
+		w_kernel);
+
+	for (i = 0; i < n; i++) {
+		struct result *r = &scn[i].res;
+
+		/* failed scenarios would only compare as regressions */
+		if (strcmp(r->status, "ok"))
+			continue;
+		db_series_put(f, &scn[i], "ops_per_s", r->s_ops, r->nslices);
+		if (r->bytes)
+			db_series_put(f, &scn[i], "bytes_per_s", r->s_bytes,
+				      r->nslices);
+		db_series_put(f, &scn[i], "p50_ns", r->s_p50, r->nlat);
+		db_series_put(f, &scn[i], "p99_ns", r->s_p99, r->nlat);
+		err = r->errors;
+		db_series_put(f, &scn[i], "errors", &err, 1);
+	}
+	fclose(f);
+
+	ret = db_append(path, rec, len);
+	free(rec);
+	return ret;
+}
+
+static void summary(struct scenario *scn, int n)
+{
+	struct result *r;
+	int i;
+
+	fprintf(stderr, "\n%-20s %-8s %12s %12s %10s %10s %10s %8s %6s  %s\n",
+		"scenario", "type", "ops/s", "bytes/s", "p50[us]", "p99[us]",
+		"max[us]", "errors", "cpu%", "status");
+	for (i = 0; i < n; i++) {
+		r = &scn[i].res;
+		if (!r->status[0])
+			continue;
+		fprintf(stderr, "%-20s %-8s %12.1f %12.1f %10.1f %10.1f %10.1f "
+			"%8llu %6.1f  %s\n", scn[i].name, scn[i].wl->type,
+			r->secs ? r->ops / r->secs : 0,
+			r->secs ? r->bytes / r->secs : 0,
+			hist_pct(r, 0.5) / 1e3, hist_pct(r, 0.99) / 1e3,
+			r->lat_max / 1e3, (unsigned long long)r->errors,
+			r->secs ? 100 * (r->user + r->sys) / r->secs : 0,
+			r->status);
+	}
+}
+
+static void usage(void)
+{
+	int i;
+
+	printf("\nUsage: dmec-bench [OPTION]... scenario-file\n\n");
+	printf("   -o file          JSON results (default -, stdout)\n");
+	printf("   -L label         label of the run, e.g. the release\n");
+	printf("   -R file          append the samples to a result store\n");
+	printf("   -s pattern       only scenarios whose name matches\n");
+	printf("   -d secs          override every duration\n");
+	printf("   -w secs          override every warmup\n");
+	printf("   -l               list the scenarios and exit\n");
+	printf("Workloads and their keys:\n");
+	for (i = 0; workloads[i]; i++)
+		printf("   %-16s %s\n", workloads[i]->type, workloads[i]->help);
+	printf("   all              duration, warmup, slice (s), interval (us),\n");
+	printf("                    max_errors, cpu (list to pin to)\n");
+	printf("Example:\n");
+	printf("\tdmec-bench -L v1.2 -o v1.2.json -R results.db dmec-bench.scn\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct scenario scn[MAX_SCENARIOS];
+	const char *out = "-", *label = "", *only = NULL, *file, *db = NULL;
+	double duration = 0, warmup = -1;
+	int list = 0, n, i, ran = 0, failed = 0, ret;
+	time_t started;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"o", required_argument, 0, 0},
+			{"L", required_argument, 0, 1},
+			{"s", required_argument, 0, 2},
+			{"d", required_argument, 0, 3},
+			{"w", required_argument, 0, 4},
+			{"l", no_argument, 0, 5},
+			{"R", required_argument, 0, 6},
+			{"help", no_argument, 0, 7},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "o:L:s:d:w:lR:h",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'o':
+			out = optarg;
+			break;
+		case 1:
+		case 'L':
+			label = optarg;
+			break;
+		case 2:
+		case 's':
+			only = optarg;
+			break;
+		case 3:
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 4:
+		case 'w':
+			warmup = atof(optarg);
+			break;
+		case 5:
+		case 'l':
+			list = 1;
+			break;
+		case 6:
+		case 'R':
+			db = optarg;
+			break;
+		case 7:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		return 1;
+	}
+	file = argv[optind];
+
+	n = scn_load(file, scn, MAX_SCENARIOS);
+	if (n < 0) {
+		if (n != -EINVAL)
+			fprintf(stderr, "%s: %s\n", file, strerror(-n));
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (duration > 0)
+			scn[i].duration = duration;
+		if (warmup >= 0)
+			scn[i].warmup = warmup;
+		if (list)
+			printf("%-20s %-8s %6gs + %gs warmup\n", scn[i].name,
+			       scn[i].wl->type, scn[i].duration, scn[i].warmup);
+	}
+	if (list)
+		return 0;
+
+	signal(SIGINT, term);
+	signal(SIGTERM, term);
+
+	started = time(NULL);
+	for (i = 0; i < n && !done; i++) {
+		if (only && fnmatch(only, scn[i].name, 0))
+			continue;
+		fprintf(stderr, "%s: %s, %gs + %gs warmup\n", scn[i].name,
+			scn[i].wl->type, scn[i].duration, scn[i].warmup);
+		bench_run(&scn[i], NULL);
+		ran++;
+		if (strcmp(scn[i].res.status, "ok"))
+			failed++;
+	}
+	if (!ran) {
+		fprintf(stderr, "no scenario matches\n");
+		return 1;
+	}
+
+	summary(scn, n);
+	ret = json_write(out, file, label, started, scn, n);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", out, strerror(-ret));
+		return 1;
+	}
+	if (db) {
+		ret = db_write(db, label, started, scn, n);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", db, strerror(-ret));
+			return 1;
+		}
+	}
+	return failed ? 2 : 0;
+}
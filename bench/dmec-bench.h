@@ -0,0 +1,119 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-bench, shared definitions
+ */
+#ifndef _DMEC_BENCH_H_
+#define _DMEC_BENCH_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define NSEC_PER_SEC	1000000000ull
+#define NSEC_PER_USEC	1000ull
+
+#define BENCH_SCHEMA	"dmec-bench/1"
+
+#define MAX_PARAMS		16
+#define MAX_SCENARIOS	64
+
+/*
+ * Latency histogram: exact below 128 ns, then 64 buckets per power of
+ * two, which keeps every bucket within ~1.6 % of its value.
+ */
+#define HIST_BITS		6
+#define HIST_SUB		(1 << HIST_BITS)
+#define HIST_BUCKETS	((65 - HIST_BITS) * HIST_SUB)
+
+extern volatile sig_atomic_t done;
+
+static inline uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+struct scenario;
+
+/*
+ * A workload issues one operation per op() call. op() returns the
+ * number of payload bytes it moved, or -errno. setup() may keep its
+ * state in *priv. The latency of an operation is the time op() took,
+ * unless the optional latency() returns 1 with a better one.
+ */
+struct workload {
+	const char *type;
+	const char *help;
+	int (*setup)(struct scenario *sc, void **priv);
+	long (*op)(void *priv);
+	int (*latency)(void *priv, uint64_t *ns);
+	void (*teardown)(void *priv);
+};
+
+struct param {
+	char key[32];
+	char val[128];
+	int used;
+};
+
+struct result {
+	char status[128];
+	uint64_t ops, bytes, errors, late;
+	int first_error;
+	double secs;
+	uint64_t lat_min, lat_max, lat_sum;
+	uint64_t hist[HIST_BUCKETS];
+	double user, sys;
+	long vol_cs, invol_cs;
+	/* per slice samples, for the statistics of dmec-results */
+	unsigned int nslices, nlat;
+	double *s_ops, *s_bytes, *s_p50, *s_p99;
+};
+
+struct scenario {
+	char name[64];
+	const struct workload *wl;
+	double duration, warmup;	/* s */
+	uint64_t interval;			/* ns between op starts, 0: back to back */
+	double slice;				/* s per sample */
+	int pinned;
+	cpu_set_t cpus;				/* if pinned */
+	unsigned long max_errors;
+	int nparams;
+	struct param params[MAX_PARAMS];
+	struct result res;
+};
+
+/* dmec-bench-scn.c */
+int scn_load(const char *path, struct scenario *scn, int max);
+const char *scn_param(struct scenario *sc, const char *key, const char *def);
+long scn_param_int(struct scenario *sc, const char *key, long def);
+const struct workload *scn_workload(const char *type);
+extern const struct workload *workloads[];
+
+/* dmec-bench-run.c */
+void bench_run(struct scenario *sc, pthread_barrier_t *start);
+
+/* dmec-bench-json.c */
+void json_str(FILE *f, const char *s);
+void json_result(FILE *f, struct scenario *sc);
+void json_head(FILE *f, const char *schema, const char *label,
+	       const char *file, time_t started);
+void json_results(FILE *f, const char *key, struct scenario *scn, int n);
+
+/* dmec-bench-stat.c */
+void hist_add(struct result *r, uint64_t ns);
+uint64_t hist_pct(const struct result *r, double p);
+
+/* workloads */
+extern const struct workload wl_gpio;
+extern const struct workload wl_serial;
+extern const struct workload wl_wdt;
+extern const struct workload wl_i2c;
+
+#endif
@@ -0,0 +1,136 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-results statistics: Mann-Whitney U test and bootstrap confidence
+ * interval of the change of the median
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dmec-results.h"
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* median of v, which gets sorted */
+double median(double *v, unsigned int n)
+{
+	qsort(v, n, sizeof(*v), cmp_double);
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+struct ranked {
+	double v;
+	int group;
+};
+
+static int cmp_ranked(const void *a, const void *b)
+{
+	return cmp_double(&((const struct ranked *)a)->v,
+			  &((const struct ranked *)b)->v);
+}
+
+/*
+ * Two sided p-value of the Mann-Whitney U test, normal approximation
+ * with tie and continuity correction. 1 if the samples can't differ.
+ */
+double mann_whitney(const double *x, unsigned int nx, const double *y,
+		    unsigned int ny)
+{
+	unsigned int n = nx + ny, i, j;
+	double r1 = 0, ties = 0, u, mu, sigma, z;
+	struct ranked *all;
+
+	all = malloc(n * sizeof(*all));
+	if (!all)
+		return 1;
+	for (i = 0; i < nx; i++)
+		all[i] = (struct ranked){ x[i], 0 };
+	for (i = 0; i < ny; i++)
+		all[nx + i] = (struct ranked){ y[i], 1 };
+	qsort(all, n, sizeof(*all), cmp_ranked);
+
+	/* ties share the mean of their ranks */
+	for (i = 0; i < n; i = j) {
+		double t, rank;
+
+		for (j = i + 1; j < n && all[j].v == all[i].v; j++)
+			;
+		t = j - i;
+		rank = (i + 1 + j) / 2.0;
+		ties += t * t * t - t;
+		while (i < j)
+			if (!all[i++].group)
+				r1 += rank;
+	}
+	free(all);
+
+	u = r1 - nx * (nx + 1) / 2.0;
+	mu = nx * (double)ny / 2;
+	sigma = sqrt(nx * (double)ny / 12 * ((n + 1) - ties / (n * (n - 1.0))));
+	if (sigma == 0)
+		return 1;
+	z = (fabs(u - mu) - 0.5) / sigma;
+	if (z < 0)
+		return 1;
+	return erfc(z / M_SQRT2);
+}
+
+/* xorshift64*, fixed seed: the same data gives the same report */
+static uint64_t rnd(uint64_t *s)
+{
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ull;
+}
+
+/*
+ * Percentile bootstrap interval, at the given level, of the relative
+ * change median(y) / median(x) - 1.
+ */
+int bootstrap_ci(const double *x, unsigned int nx, const double *y,
+		 unsigned int ny, unsigned int rounds, double level,
+		 double *lo, double *hi)
+{
+	double *bx, *by, *ch;
+	unsigned int i, k, valid = 0;
+	uint64_t seed = 0x9e3779b97f4a7c15ull;
+	int ret = -1;
+
+	bx = malloc(nx * sizeof(*bx));
+	by = malloc(ny * sizeof(*by));
+	ch = malloc(rounds * sizeof(*ch));
+	if (!bx || !by || !ch)
+		goto out;
+
+	for (k = 0; k < rounds; k++) {
+		double mx, my;
+
+		for (i = 0; i < nx; i++)
+			bx[i] = x[rnd(&seed) % nx];
+		for (i = 0; i < ny; i++)
+			by[i] = y[rnd(&seed) % ny];
+		mx = median(bx, nx);
+		my = median(by, ny);
+		if (mx != 0)
+			ch[valid++] = my / mx - 1;
+	}
+	if (valid < rounds / 2)
+		goto out;
+
+	qsort(ch, valid, sizeof(*ch), cmp_double);
+	*lo = ch[(unsigned int)((1 - level) / 2 * (valid - 1))];
+	*hi = ch[(unsigned int)((1 + level) / 2 * (valid - 1))];
+	ret = 0;
+
+out:
+	free(bx);
+	free(by);
+	free(ch);
+	return ret;
+}
@@ -0,0 +1,367 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-results - result store of dmec-bench and the other tools, and
+ * comparison of runs
+ *
+ * compare aligns two runs by scenario and metric and decides per metric
+ * from the samples, not from a single number: a change is flagged when
+ * the Mann-Whitney U test rejects equal distributions at alpha, the
+ * bootstrap interval of the change of the median excludes 0, and the
+ * change is at least the threshold. It is a regression if throughput
+ * went down or latency, lateness or errors went up.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "bench-db.h"
+#include "dmec-results.h"
+
+#define DEFAULT_ALPHA		0.01
+#define DEFAULT_THRESHOLD	2.0		/* % */
+#define DEFAULT_ROUNDS		2000
+#define MIN_SAMPLES			5
+
+static double alpha = DEFAULT_ALPHA, threshold = DEFAULT_THRESHOLD;
+static unsigned int rounds = DEFAULT_ROUNDS;
+static const char *label = "";
+
+static void usage(void)
+{
+	printf("\nUsage: dmec-results [OPTION]... store command [args]\n\n");
+	printf("   -a alpha         significance level (default %g)\n",
+	       DEFAULT_ALPHA);
+	printf("   -t percent       smallest change to flag (default %g)\n",
+	       DEFAULT_THRESHOLD);
+	printf("   -B rounds        bootstrap resamples (default %d)\n",
+	       DEFAULT_ROUNDS);
+	printf("   -L label         label of a recorded run\n");
+	printf("Commands:\n");
+	printf("   list             the runs in the store\n");
+	printf("   show run         the series of a run\n");
+	printf("   compare [base [new]]\n");
+	printf("                    compare two runs (default last~1 and last),\n");
+	printf("                    exit status 3 on regressions\n");
+	printf("   record           append a run read from stdin, one series\n");
+	printf("                    per line: scenario type metric v1 v2 ...\n");
+	printf("A run is a number, last, last~N or a label.\n");
+	printf("Example:\n");
+	printf("\tdmec-bench -L v1.2 -R results.db -o v1.2.json dmec-bench.scn\n");
+	printf("\tdmec-results results.db compare v1.1 v1.2\n");
+	printf("\techo \"cobs-4k ser mb_per_s 61.2 60.8 61.5 61.0 61.3\" | \\\n");
+	printf("\t\tdmec-results -L v1.2 results.db record\n\n");
+}
+
+static void run_line(struct db_run *r)
+{
+	char stamp[32];
+	time_t t = r->time;
+
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", localtime(&t));
+	printf("#%-4u %s  %-16s %-16s %-24s %u series\n", r->idx, stamp,
+	       r->label, r->host, r->kernel, r->nseries);
+}
+
+static int cmd_list(struct db *db)
+{
+	unsigned int i;
+
+	for (i = 0; i < db->nruns; i++)
+		run_line(&db->runs[i]);
+	return 0;
+}
+
+static int cmd_show(struct db_run *r)
+{
+	struct db_series *s;
+	double *v, med;
+	unsigned int i;
+
+	run_line(r);
+	printf("%-24s %-8s %-14s %5s %14s %14s %14s\n", "scenario", "type",
+	       "metric", "n", "median", "min", "max");
+	for (i = 0; i < r->nseries; i++) {
+		s = &r->series[i];
+		if (!s->n)
+			continue;
+		v = malloc(s->n * sizeof(*v));
+		if (!v)
+			return -ENOMEM;
+		memcpy(v, s->v, s->n * sizeof(*v));
+		/* sorts v */
+		med = median(v, s->n);
+		printf("%-24s %-8s %-14s %5u %14.1f %14.1f %14.1f\n",
+		       s->scenario, s->type, s->metric, s->n, med, v[0],
+		       v[s->n - 1]);
+		free(v);
+	}
+	return 0;
+}
+
+/* throughput is better higher, times, lateness and errors lower */
+static int lower_is_better(const char *metric)
+{
+	size_t len = strlen(metric);
+
+	if (strstr(metric, "err") || strstr(metric, "lat"))
+		return 1;
+	if (len > 6 && !strcmp(metric + len - 6, "_per_s"))
+		return 0;
+	return len > 3 && (!strcmp(metric + len - 3, "_ns") ||
+			   !strcmp(metric + len - 3, "_us") ||
+			   !strcmp(metric + len - 3, "_ms") ||
+			   !strcmp(metric + len - 2, "_s"));
+}
+
+/* returns 1 for a regression */
+static int compare_series(struct db_series *b, struct db_series *n)
+{
+	double *x, *y, mb, mn, change, lo = 0, hi = 0, p;
+	int lower = lower_is_better(n->metric), worse, ret = 0;
+	const char *verdict = "";
+
+	printf("%-24s %-14s ", n->scenario, n->metric);
+	if (!b->n || !n->n) {
+		printf("no samples\n");
+		return 0;
+	}
+
+	x = malloc(b->n * sizeof(*x));
+	y = malloc(n->n * sizeof(*y));
+	if (!x || !y) {
+		free(x);
+		free(y);
+		printf("out of memory\n");
+		return 0;
+	}
+	memcpy(x, b->v, b->n * sizeof(*x));
+	memcpy(y, n->v, n->n * sizeof(*y));
+	mb = median(x, b->n);
+	mn = median(y, n->n);
+	change = mb ? mn / mb - 1 : mn ? INFINITY : 0;
+	worse = lower ? mn > mb : mn < mb;
+
+	printf("%14.1f %14.1f %+8.2f%% ", mb, mn, 100 * change);
+
+	if (b->n < MIN_SAMPLES || n->n < MIN_SAMPLES) {
+		/* single counts, e.g. errors: any increase counts */
+		if (lower && !strcmp(n->metric, "errors") && mn > mb) {
+			verdict = "REGRESSION";
+			ret = 1;
+		} else {
+			verdict = "few samples";
+		}
+		printf("%20s %8s  %s\n", "", "", verdict);
+		goto out;
+	}
+
+	p = mann_whitney(b->v, b->n, n->v, n->n);
+	if (bootstrap_ci(b->v, b->n, n->v, n->n, rounds, 1 - alpha, &lo, &hi)) {
+		/* medians at 0, only the test decides */
+		lo = hi = change;
+	}
+	printf("[%+7.2f,%+7.2f]%% %8.2g  ", 100 * lo, 100 * hi, p);
+
+	if (p < alpha && (lo > 0 || hi < 0) &&
+	    fabs(change) * 100 >= threshold) {
+		verdict = worse ? "REGRESSION" : "improved";
+		ret = worse;
+	}
+	printf("%s\n", verdict);
+
+out:
+	free(x);
+	free(y);
+	return ret;
+}
+
+static int cmd_compare(struct db_run *b, struct db_run *n)
+{
+	struct db_series *s, *o;
+	unsigned int i, regressions = 0;
+
+	printf("base ");
+	run_line(b);
+	printf("new  ");
+	run_line(n);
+	printf("\n%-24s %-14s %14s %14s %9s %20s %8s  %s\n", "scenario",
+	       "metric", "base", "new", "change", "ci", "p", "verdict");
+
+	for (i = 0; i < n->nseries; i++) {
+		s = &n->series[i];
+		o = db_series(b, s->scenario, s->metric);
+		if (!o) {
+			printf("%-24s %-14s not in base\n", s->scenario, s->metric);
+			continue;
+		}
+		regressions += compare_series(o, s);
+	}
+	for (i = 0; i < b->nseries; i++) {
+		s = &b->series[i];
+		if (!db_series(n, s->scenario, s->metric)) {
+			/* a scenario that stopped working is a regression too */
+			printf("%-24s %-14s MISSING in new\n", s->scenario,
+			       s->metric);
+			regressions++;
+		}
+	}
+
+	printf("\n%u regression%s (alpha %g, threshold %g%%)\n", regressions,
+	       regressions == 1 ? "" : "s", alpha, threshold);
+	return regressions ? 3 : 0;
+}
+
+static int cmd_record(const char *path)
+{
+	char *line = NULL, *rec, w_label[64], scn[64], type[16], metric[24];
+	char *p, *end, host[256] = "", w_host[64], w_kernel[96];
+	struct utsname un;
+	size_t size = 0, len;
+	unsigned int series = 0, nv;
+	double v;
+	FILE *f;
+	int ret = 0, off;
+
+	f = open_memstream(&rec, &len);
+	if (!f)
+		return -errno;
+
+	gethostname(host, sizeof(host) - 1);
+	db_word(w_label, sizeof(w_label), label);
+	uname(&un);
+	db_word(w_host, sizeof(w_host), host);
+	db_word(w_kernel, sizeof(w_kernel), un.release);
+	fprintf(f, "run %lld %s %s %s\n", (long long)time(NULL), w_label,
+		w_host, w_kernel);
+
+	while (getline(&line, &size, stdin) > 0) {
+		p = strchr(line, '#');
+		if (p)
+			*p = 0;
+		if (sscanf(line, "%63s %15s %23s%n", scn, type, metric, &off) != 3)
+			continue;
+
+		/* count the values first, the count leads the record */
+		for (nv = 0, p = line + off; strtod(p, &end), end != p; p = end)
+			nv++;
+		if (!nv) {
+			fprintf(stderr, "%s %s: no values\n", scn, metric);
+			ret = -EINVAL;
+			break;
+		}
+		fprintf(f, "res %s %s %s %u", scn, type, metric, nv);
+		for (p = line + off; v = strtod(p, &end), end != p; p = end)
+			fprintf(f, " %g", v);
+		fprintf(f, "\n");
+		series++;
+	}
+	fclose(f);
+	free(line);
+
+	if (!ret && !series)
+		ret = -ENODATA;
+	if (!ret)
+		ret = db_append(path, rec, len);
+	free(rec);
+	if (!ret)
+		printf("%u series recorded\n", series);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct db_run *b, *n;
+	const char *path, *cmd;
+	struct db db;
+	int ret;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"a", required_argument, 0, 0},
+			{"t", required_argument, 0, 1},
+			{"B", required_argument, 0, 2},
+			{"L", required_argument, 0, 3},
+			{"help", no_argument, 0, 4},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "+a:t:B:L:h", long_options,
+				    &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'a':
+			alpha = atof(optarg);
+			break;
+		case 1:
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 2:
+		case 'B':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 3:
+		case 'L':
+			label = optarg;
+			break;
+		case 4:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 2 || alpha <= 0 || alpha >= 1 || rounds < 100) {
+		usage();
+		return 1;
+	}
+	path = argv[optind];
+	cmd = argv[optind + 1];
+	argc -= optind + 2;
+	argv += optind + 2;
+
+	if (!strcmp(cmd, "record") && !argc) {
+		ret = cmd_record(path);
+		if (ret)
+			fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return ret ? 1 : 0;
+	}
+
+	ret = db_load(path, &db);
+	if (ret) {
+		if (ret != -EINVAL)
+			fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return 1;
+	}
+
+	if (!strcmp(cmd, "list") && !argc) {
+		ret = cmd_list(&db);
+	} else if (!strcmp(cmd, "show") && argc == 1) {
+		b = db_find(&db, argv[0]);
+		ret = b ? cmd_show(b) : -ENOENT;
+	} else if (!strcmp(cmd, "compare") && argc <= 2) {
+		b = db_find(&db, argc > 0 ? argv[0] : "last~1");
+		n = db_find(&db, argc > 1 ? argv[1] : "last");
+		ret = b && n ? cmd_compare(b, n) : -ENOENT;
+	} else {
+		usage();
+		ret = -EINVAL;
+	}
+
+	if (ret < 0)
+		fprintf(stderr, "%s: %s\n", cmd, strerror(-ret));
+	db_free(&db);
+	return ret < 0 ? 1 : ret;
+}
@@ -0,0 +1,18 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-results, shared definitions
+ */
+#ifndef _DMEC_RESULTS_H_
+#define _DMEC_RESULTS_H_
+
+#include <stdint.h>
+
+/* dmec-results-stat.c */
+double median(double *v, unsigned int n);
+double mann_whitney(const double *x, unsigned int nx, const double *y,
+		    unsigned int ny);
+int bootstrap_ci(const double *x, unsigned int nx, const double *y,
+		 unsigned int ny, unsigned int rounds, double level,
+		 double *lo, double *hi);
+
+#endif
@@ -0,0 +1,539 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-soak - run dmec-bench scenarios at the same time and show what
+ * they do to each other
+ *
+ * Every scenario of the file first runs alone as its baseline, then all
+ * of them run concurrently for the soak duration, each in its own thread
+ * pinned to its cpu list. A scenario that has nothing to do on its own,
+ * like GPIO events without the toggles that make them, names its source
+ * with "with = scenario": its baseline runs alongside the source, which
+ * is not measured there, and the source outlasts it in both phases so
+ * the last wait still sees edges. Per scenario the mix is compared to the solo
+ * run: throughput, p99 latency, errors and late operations. A change
+ * beyond the threshold that the Mann-Whitney test on the slice samples
+ * finds significant marks the scenario as degraded.
+ *
+ * The interrupts matching a pattern (the DMEC ones by default) are
+ * counted in both phases: an interrupt rate in the mix below the sum of
+ * the solo rates points at a shared interrupt or bus as the bottleneck.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include "dmec-bench.h"
+#include "dmec-results.h"
+
+#define SOAK_SCHEMA			"dmec-soak/1"
+#define DEFAULT_THRESHOLD	10.0	/* % */
+#define DEFAULT_IRQS		"dmec"
+#define ALPHA				0.01
+#define MAX_IRQS			32
+#define PAIR_SLACK			1.0		/* s a source outlasts its pair */
+
+volatile sig_atomic_t done;
+
+struct irq {
+	char id[16];
+	char desc[64];
+	unsigned long long count;
+	double solo, mix;	/* per second */
+};
+
+static void term(int sig)
+{
+	done = 1;
+}
+
+/* the /proc/interrupts lines containing pattern, counts summed over cpus */
+static int irq_read(const char *pattern, struct irq *irqs, int max)
+{
+	char *line = NULL, *p, *end;
+	size_t size = 0;
+	int ncpu = 0, n = 0, i;
+	FILE *f;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f)
+		return -errno;
+
+	if (getline(&line, &size, f) > 0)
+		for (p = line; (p = strstr(p, "CPU")); p += 3)
+			ncpu++;
+
+	while (n < max && getline(&line, &size, f) > 0) {
+		struct irq *q = &irqs[n];
+
+		if (!strstr(line, pattern))
+			continue;
+		p = strchr(line, ':');
+		if (!p)
+			continue;
+		*p++ = 0;
+		snprintf(q->id, sizeof(q->id), "%s", line + strspn(line, " "));
+		q->count = 0;
+		for (i = 0; i < ncpu; i++) {
+			q->count += strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			p = end;
+		}
+		/* chip, hwirq, type and name, single spaced */
+		for (i = 0; *p && *p != '\n' && i < sizeof(q->desc) - 1; p++) {
+			if (*p == ' ' || *p == '\t') {
+				if (i && q->desc[i - 1] == ' ')
+					continue;
+				if (!i)
+					continue;
+				q->desc[i++] = ' ';
+			} else {
+				q->desc[i++] = *p;
+			}
+		}
+		q->desc[i] = 0;
+		n++;
+	}
+
+	free(line);
+	fclose(f);
+	return n;
+}
+
+static struct irq *irq_find(struct irq *irqs, int n, const char *id)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!strcmp(irqs[i].id, id))
+			return &irqs[i];
+	return NULL;
+}
+
+/* add the rate since the snapshot before to each irq's solo or mix rate */
+static void irq_rate(const char *pattern, struct irq *irqs, int n,
+		     struct irq *before, int nbefore, double secs, int mix)
+{
+	struct irq now[MAX_IRQS], *a, *b;
+	int m, i;
+	double rate;
+
+	m = irq_read(pattern, now, MAX_IRQS);
+	for (i = 0; i < n && secs > 0; i++) {
+		a = irq_find(before, nbefore, irqs[i].id);
+		b = irq_find(now, m, irqs[i].id);
+		if (!a || !b)
+			continue;
+		rate = (b->count - a->count) / secs;
+		if (mix)
+			irqs[i].mix += rate;
+		else
+			irqs[i].solo += rate;
+	}
+}
+
+static void cpu_list(char *buf, size_t size, struct scenario *sc)
+{
+	int cpu, first = -1, len = 0;
+
+	if (!sc->pinned) {
+		snprintf(buf, size, "-");
+		return;
+	}
+	buf[0] = 0;
+	for (cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+		int in = cpu < CPU_SETSIZE && CPU_ISSET(cpu, &sc->cpus);
+
+		if (in && first < 0)
+			first = cpu;
+		if (in || first < 0)
+			continue;
+		len += snprintf(buf + len, size - len,
+				first == cpu - 1 ? "%s%d" : "%s%d-%d",
+				len ? "," : "", first, cpu - 1);
+		first = -1;
+		/* truncated, the rest would write past the buffer */
+		if (len >= (int)size)
+			break;
+	}
+}
+
+static double pct(double from, double to)
+{
+	return from ? 100 * (to / from - 1) : 0;
+}
+
+/*
+ * 1 if the mix is worse than the solo run: throughput down or p99 up by
+ * more than the threshold and significant, or more errors or late ops.
+ * -1 when the solo run did nothing to compare with.
+ */
+static int degraded(struct result *s, struct result *m, double threshold,
+		    double *p_ops, double *p_p99)
+{
+	double r_s = s->secs ? s->errors / s->secs : 0;
+	double r_m = m->secs ? m->errors / m->secs : 0;
+	int worse = 0;
+
+	if (!s->ops || !s->secs)
+		return -1;
+
+	*p_ops = *p_p99 = 1;
+	if (s->nslices >= 5 && m->nslices >= 5)
+		*p_ops = mann_whitney(s->s_ops, s->nslices, m->s_ops, m->nslices);
+	if (s->nlat >= 5 && m->nlat >= 5)
+		*p_p99 = mann_whitney(s->s_p99, s->nlat, m->s_p99, m->nlat);
+
+	if (-pct(s->ops / s->secs, m->ops / m->secs) >= threshold &&
+	    *p_ops < ALPHA)
+		worse = 1;
+	if (pct(hist_pct(s, 0.99), hist_pct(m, 0.99)) >= threshold &&
+	    *p_p99 < ALPHA)
+		worse = 1;
+	if (r_m > r_s || m->late * s->secs > s->late * m->secs)
+		worse = 1;
+	return worse;
+}
+
+static void *mix_thread(void *arg)
+{
+	void **a = arg;
+
+	bench_run(a[0], a[1]);
+	return NULL;
+}
+
+static struct scenario *scn_find(struct scenario *scn, int n,
+				 const char *name)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!strcmp(scn[i].name, name))
+			return &scn[i];
+	return NULL;
+}
+
+/* the baseline of sc with its source src running alongside */
+static int solo_paired(struct scenario *sc, struct scenario *src)
+{
+	pthread_barrier_t start;
+	pthread_t threads[2];
+	void *args[2][2] = { { sc, &start }, { src, &start } };
+	int i;
+
+	src->duration = sc->duration + PAIR_SLACK;
+	src->warmup = sc->warmup;
+	pthread_barrier_init(&start, NULL, 3);
+	for (i = 0; i < 2; i++) {
+		if (pthread_create(&threads[i], NULL, mix_thread, args[i])) {
+			perror("pthread_create");
+			return -1;
+		}
+	}
+	pthread_barrier_wait(&start);
+	for (i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+	pthread_barrier_destroy(&start);
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("\nUsage: dmec-soak [OPTION]... scenario-file\n\n");
+	printf("   -m secs          soak duration (default the longest scenario)\n");
+	printf("   -d secs          override every solo duration\n");
+	printf("   -w secs          override every warmup\n");
+	printf("   -x               no solo baselines, only the mix\n");
+	printf("   -t percent       degradation to flag (default %g)\n",
+	       DEFAULT_THRESHOLD);
+	printf("   -I pattern       interrupts to count (default %s)\n",
+	       DEFAULT_IRQS);
+	printf("   -s pattern       only scenarios whose name matches\n");
+	printf("   -o file          JSON results\n");
+	printf("   -L label         label of the run\n");
+	printf("Scenarios are those of dmec-bench, pinned with cpu = list.\n");
+	printf("with = scenario runs the baseline alongside that source.\n");
+	printf("Example:\n");
+	printf("\tdmec-soak -m 600 -o soak.json dmec-soak.scn\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct scenario all[MAX_SCENARIOS], solo[MAX_SCENARIOS];
+	static struct scenario mix[MAX_SCENARIOS], src;
+	const char *out = NULL, *label = "", *only = NULL, *file;
+	const char *irq_pat = DEFAULT_IRQS, *with;
+	double duration = 0, warmup = -1, soak = 0, threshold = DEFAULT_THRESHOLD;
+	double p_ops, p_p99, max_warmup = 0, max_duration = 0;
+	struct irq irqs[MAX_IRQS], before[MAX_IRQS];
+	pthread_t threads[MAX_SCENARIOS];
+	void *args[MAX_SCENARIOS][2];
+	pthread_barrier_t start;
+	int no_solo = 0, n, nirqs, nbefore, i, k, sel = 0, bad = 0;
+	const char *verdict[MAX_SCENARIOS];
+	time_t started;
+	uint64_t t0;
+	char cpus[64];
+	FILE *f;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"m", required_argument, 0, 0},
+			{"d", required_argument, 0, 1},
+			{"w", required_argument, 0, 2},
+			{"x", no_argument, 0, 3},
+			{"t", required_argument, 0, 4},
+			{"I", required_argument, 0, 5},
+			{"s", required_argument, 0, 6},
+			{"o", required_argument, 0, 7},
+			{"L", required_argument, 0, 8},
+			{"help", no_argument, 0, 9},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "m:d:w:xt:I:s:o:L:h",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'm':
+			soak = atof(optarg);
+			break;
+		case 1:
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 2:
+		case 'w':
+			warmup = atof(optarg);
+			break;
+		case 3:
+		case 'x':
+			no_solo = 1;
+			break;
+		case 4:
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 5:
+		case 'I':
+			irq_pat = optarg;
+			break;
+		case 6:
+		case 's':
+			only = optarg;
+			break;
+		case 7:
+		case 'o':
+			out = optarg;
+			break;
+		case 8:
+		case 'L':
+			label = optarg;
+			break;
+		case 9:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		return 1;
+	}
+	file = argv[optind];
+
+	n = scn_load(file, all, MAX_SCENARIOS);
+	if (n < 0) {
+		if (n != -EINVAL)
+			fprintf(stderr, "%s: %s\n", file, strerror(-n));
+		return 1;
+	}
+
+	/* keep the selected ones, the mix gets the same setup */
+	for (i = k = 0; i < n; i++) {
+		if (only && fnmatch(only, all[i].name, 0))
+			continue;
+		solo[k] = all[i];
+		if (duration > 0)
+			solo[k].duration = duration;
+		if (warmup >= 0)
+			solo[k].warmup = warmup;
+		if (solo[k].warmup > max_warmup)
+			max_warmup = solo[k].warmup;
+		if (solo[k].duration > max_duration)
+			max_duration = solo[k].duration;
+		k++;
+	}
+	sel = k;
+	if (!sel) {
+		fprintf(stderr, "no scenario matches\n");
+		return 1;
+	}
+	for (i = 0; i < sel; i++) {
+		with = scn_param(&solo[i], "with", NULL);
+		if (with && (!scn_find(all, n, with) ||
+			     !strcmp(with, solo[i].name))) {
+			fprintf(stderr, "%s: [%s] with = %s: no such scenario\n",
+				file, solo[i].name, with);
+			return 1;
+		}
+	}
+	if (soak <= 0)
+		soak = max_duration;
+	for (i = 0; i < sel; i++) {
+		mix[i] = solo[i];
+		mix[i].duration = soak;
+		mix[i].warmup = max_warmup;
+	}
+	for (i = 0; i < sel; i++) {
+		struct scenario *sc;
+
+		with = scn_param(&solo[i], "with", NULL);
+		sc = with ? scn_find(mix, sel, with) : NULL;
+		if (sc)
+			sc->duration = soak + PAIR_SLACK;
+	}
+
+	nirqs = irq_read(irq_pat, irqs, MAX_IRQS);
+	if (nirqs < 0)
+		nirqs = 0;
+	for (i = 0; i < nirqs; i++)
+		irqs[i].solo = irqs[i].mix = 0;
+
+	signal(SIGINT, term);
+	signal(SIGTERM, term);
+	started = time(NULL);
+
+	for (i = 0; i < sel && !no_solo && !done; i++) {
+		with = scn_param(&solo[i], "with", NULL);
+		fprintf(stderr, "solo %s: %s, %gs + %gs warmup%s%s\n",
+			solo[i].name, solo[i].wl->type, solo[i].duration,
+			solo[i].warmup, with ? ", with " : "", with ? with : "");
+		nbefore = irq_read(irq_pat, before, MAX_IRQS);
+		if (with) {
+			src = *scn_find(all, n, with);
+			if (solo_paired(&solo[i], &src))
+				return 1;
+		} else {
+			bench_run(&solo[i], NULL);
+		}
+		irq_rate(irq_pat, irqs, nirqs, before, nbefore, solo[i].res.secs,
+			 0);
+	}
+
+	if (!done) {
+		fprintf(stderr, "mix of %d: %gs + %gs warmup\n", sel, soak,
+			max_warmup);
+		pthread_barrier_init(&start, NULL, sel + 1);
+		for (i = 0; i < sel; i++) {
+			args[i][0] = &mix[i];
+			args[i][1] = &start;
+			if (pthread_create(&threads[i], NULL, mix_thread, args[i])) {
+				perror("pthread_create");
+				return 1;
+			}
+		}
+		/* all set up, measure from the common start */
+		pthread_barrier_wait(&start);
+		nbefore = irq_read(irq_pat, before, MAX_IRQS);
+		t0 = bench_now();
+		for (i = 0; i < sel; i++)
+			pthread_join(threads[i], NULL);
+		/* the warmup is part of the interval, rates still compare */
+		irq_rate(irq_pat, irqs, nirqs, before, nbefore,
+			 (bench_now() - t0) / 1e9, 1);
+		pthread_barrier_destroy(&start);
+	}
+
+	printf("\n%-20s %-8s %-6s %11s %11s %7s %10s %10s %7s %9s %6s  %s\n",
+	       "scenario", "type", "cpu", "solo ops/s", "mix ops/s", "d[%]",
+	       "solo p99", "mix p99", "d[%]", "errors", "late", "");
+	for (i = 0; i < sel; i++) {
+		struct result *s = &solo[i].res, *m = &mix[i].res;
+		int worse = 0;
+
+		verdict[i] = "";
+		cpu_list(cpus, sizeof(cpus), &mix[i]);
+		if (strcmp(m->status, "ok")) {
+			verdict[i] = m->status;
+		} else if (no_solo || strcmp(s->status, "ok")) {
+			verdict[i] = no_solo ? "" : "no baseline";
+		} else {
+			worse = degraded(s, m, threshold, &p_ops, &p_p99);
+			if (worse < 0) {
+				verdict[i] = "no baseline";
+			} else if (worse) {
+				verdict[i] = "DEGRADED";
+				bad++;
+			}
+		}
+		printf("%-20s %-8s %-6s %11.1f %11.1f %+7.1f %10.1f %10.1f "
+		       "%+7.1f %4llu/%-4llu %6llu  %s\n", mix[i].name,
+		       mix[i].wl->type, cpus, s->secs ? s->ops / s->secs : 0,
+		       m->secs ? m->ops / m->secs : 0,
+		       s->secs && m->secs ? pct(s->ops / s->secs, m->ops / m->secs) : 0,
+		       hist_pct(s, 0.99) / 1e3, hist_pct(m, 0.99) / 1e3,
+		       pct(hist_pct(s, 0.99), hist_pct(m, 0.99)),
+		       (unsigned long long)s->errors, (unsigned long long)m->errors,
+		       (unsigned long long)m->late, verdict[i]);
+	}
+	printf("(p99 in us, errors solo/mix)\n");
+
+	if (nirqs) {
+		printf("\n%-6s %-40s %12s %12s\n", "irq", "", "solo sum/s",
+		       "mix/s");
+		for (i = 0; i < nirqs; i++)
+			printf("%-6s %-40s %12.1f %12.1f\n", irqs[i].id,
+			       irqs[i].desc, irqs[i].solo, irqs[i].mix);
+	}
+
+	if (out) {
+		f = strcmp(out, "-") ? fopen(out, "w") : stdout;
+		if (!f) {
+			perror(out);
+			return 1;
+		}
+		json_head(f, SOAK_SCHEMA, label, file, started);
+		fprintf(f, ",\n  \"soak_s\": %g,\n  \"threshold_pct\": %g", soak,
+			threshold);
+		json_results(f, "solo", solo, sel);
+		json_results(f, "mix", mix, sel);
+		fprintf(f, ",\n  \"verdicts\": {");
+		for (i = 0; i < sel; i++) {
+			fprintf(f, "%s", i ? ", " : "");
+			json_str(f, mix[i].name);
+			fprintf(f, ": ");
+			json_str(f, verdict[i]);
+		}
+		fprintf(f, "}");
+		fprintf(f, ",\n  \"irqs\": [");
+		for (i = 0; i < nirqs; i++) {
+			fprintf(f, "%s\n    {\"irq\": ", i ? "," : "");
+			json_str(f, irqs[i].id);
+			fprintf(f, ", \"desc\": ");
+			json_str(f, irqs[i].desc);
+			fprintf(f, ", \"solo_per_s\": %.1f, \"mix_per_s\": %.1f}",
+				irqs[i].solo, irqs[i].mix);
+		}
+		fprintf(f, "\n  ]\n}\n");
+		if (f != stdout)
+			fclose(f);
+	}
+
+	return bad ? 3 : 0;
+}
@@ -29,6 +29,8 @@
 #include <sys/syscall.h>
 #include <sys/epoll.h>
 
+#include "dmec-trace.h"
+
 #define NGPIO	8
 
 static int thread_stop;
@@ -41,7 +43,8 @@ struct gpio_params {
 	u_int32_t eventflags[NGPIO];
 };
 
-static inline long gettid()
+/* glibc 2.30 has its own gettid() */
+static inline long sys_gettid()
 {
 	return syscall(SYS_gettid);
 }
@@ -101,9 +104,25 @@ static int gpio_setup_in_line(int fd,
 	return req.fd;
 }
 
-static int gpio_read_sta(int efd, unsigned long *cnt)
+/*
+ * Kernels before 5.7 stamp line events with CLOCK_REALTIME, move those
+ * onto the monotonic timeline of the trace.
+ */
+static uint64_t gpio_event_mono(uint64_t ts, uint64_t now)
+{
+	struct timespec rt;
+
+	if (ts <= now)
+		return ts;
+	clock_gettime(CLOCK_REALTIME, &rt);
+	return ts - (rt.tv_sec * 1000000000ull + rt.tv_nsec - now);
+}
+
+static int gpio_read_sta(int efd, unsigned int line, unsigned long *cnt)
 {
 	struct gpioevent_data event;
+	const char *edge;
+	uint64_t now;
 	int ret = -1;
 
 	while(ret < 0) {
@@ -121,25 +140,37 @@ static int gpio_read_sta(int efd, unsigned long *cnt)
 		}
 	}
 
+	now = dmec_trace_begin();
+
 	if (ret != sizeof(event)) {
 		fprintf(stderr, "Reading event failed\n");
 		return -EIO;
 	}
 
-	unsigned int tid = gettid();
+	unsigned int tid = sys_gettid();
 	fprintf(stdout, "[%u]: GPIO EVENT %l" PRIu64 ": ",
 		tid, event.timestamp);
 	switch (event.id) {
 	case GPIOEVENT_EVENT_RISING_EDGE:
-		fprintf(stdout, "rising edge");
+		edge = "rising edge";
 		break;
 	case GPIOEVENT_EVENT_FALLING_EDGE:
-		fprintf(stdout, "falling edge");
+		edge = "falling edge";
 		break;
 	default:
-		fprintf(stdout, "unknown event");
+		edge = "unknown event";
+	}
+	fprintf(stdout, "%s -> cnt=%lu\n", edge, (*cnt)++);
+
+	/* the edge where the kernel saw it, then how long it took to us */
+	if (now) {
+		uint64_t ts = gpio_event_mono(event.timestamp, now);
+
+		dmec_trace_instant("gpio", edge, ts, line);
+		/* queued edges overlap */
+		dmec_trace_async("gpio", "wakeup", ts, now,
+				 (uint64_t)line << 32 | *cnt);
 	}
-	fprintf(stdout, " -> cnt=%lu\n", (*cnt)++);
 
 	return ret;
 }
@@ -153,11 +184,14 @@ static int monitor_device(int fd,
 	int ret = 0, efd;
 	int i = 0;
 	unsigned long cnt = 0;
+	char name[16];
 
+	snprintf(name, sizeof(name), "line %u", line);
+	dmec_trace_thread_name(name);
 	efd = gpio_setup_in_line(fd, line, handleflags, eventflags);
 
 	while (fd > 0 && !thread_stop) {
-		ret = gpio_read_sta(efd, &cnt);
+		ret = gpio_read_sta(efd, line, &cnt);
 		if (ret < 0)
 			break;
 
@@ -181,6 +215,8 @@ void print_usage(void)
 		"  -f         Listen for falling edges\n"
 		" [-c <n>]    Do <n> loops (optional, infinite loop if not stated)\n"
 		"  -?         This helptext\n"
+		"With " DMEC_TRACE_ENV "=dir set, a timeline is recorded for\n"
+		"dmec-trace-merge.\n"
 		"\n"
 		"Example:\n"
 		"gpio-event-mon -n gpiochip0 -o 4 -r -f\n"
@@ -194,13 +230,18 @@ static void *gpio_thread(void *arg)
 	struct epoll_event ev, events[NGPIO];
 	int ret = 0, efd[NGPIO];
 	unsigned long cnt[NGPIO];
-	int i = 0;
+	char name[16];
+	int i = 0, j;
 
 	int epollfd = epoll_create1(0);
 
 	if (!p->ngpio)
 		return NULL;
 
+	snprintf(name, sizeof(name), "line %u%s", p->gpios[0],
+		 p->ngpio > 1 ? "+" : "");
+	dmec_trace_thread_name(name);
+
 	printf("gpios: %d\n", p->ngpio);
 	for (i = 0; i < p->ngpio; i++) {
 		efd[i] = gpio_setup_in_line(p->fd,
@@ -231,13 +272,16 @@ static void *gpio_thread(void *arg)
 		}
 
 		for (i = 0; i < nfds; i++) {
-			ret = gpio_read_sta(events[i].data.fd, &cnt[i]);
+			for (j = 0; j < p->ngpio - 1; j++)
+				if (efd[j] == events[i].data.fd)
+					break;
+			ret = gpio_read_sta(events[i].data.fd, p->gpios[j], &cnt[j]);
 			if (ret < 0)
 				break;
 		}
 	}
 
-	printf("thread %lu stop\n", gettid());
+	printf("thread %lu stop\n", sys_gettid());
 	pthread_exit(NULL);
 
 }
@@ -323,6 +367,7 @@ int main(int argc, char **argv)
 		printf("additional line: %d\n", params.gpios[params.ngpio-1]);
 	}
 	signal(SIGINT, term);
+	dmec_trace_open("gpio-event-mon");
 
 	int fd = gpio_dev_open(device_name);
 	if (fd < 0) {
@@ -21,9 +21,19 @@
 #include <poll.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <linux/gpio.h>
 
+#include "dmec-trace.h"
+
+static volatile sig_atomic_t stop;
+
+static void term(int sig)
+{
+	stop = 1;
+}
+
 int hammer_device(const char *device_name, unsigned int *lines, int nlines,
 		  unsigned int loops)
 {
@@ -35,6 +45,7 @@ int hammer_device(const char *device_name, unsigned int *lines, int nlines,
 	int ret;
 	int i, j;
 	unsigned long iteration = 0;
+	uint64_t t0;
 
 	ret = asprintf(&chrdev_name, "/dev/%s", device_name);
 	if (ret < 0)
@@ -87,12 +98,14 @@ int hammer_device(const char *device_name, unsigned int *lines, int nlines,
 
 	/* Hammertime! */
 	j = 0;
-	while (1) {
+	while (!stop) {
 		/* Invert all lines so we blink */
 		for (i = 0; i < nlines; i++)
 			data.values[i] = !data.values[i];
 
+		t0 = dmec_trace_begin();
 		ret = ioctl(req.fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+		dmec_trace_end("gpio", "set", t0, data.values[0]);
 		if (ret == -1) {
 			ret = -errno;
 			fprintf(stderr, "Failed to issue GPIOHANDLE SET LINE "
@@ -101,7 +114,9 @@ int hammer_device(const char *device_name, unsigned int *lines, int nlines,
 			goto exit_close_error;
 		}
 		/* Re-read values to get status */
+		t0 = dmec_trace_begin();
 		ret = ioctl(req.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data);
+		dmec_trace_end("gpio", "get", t0, data.values[0]);
 		if (ret == -1) {
 			ret = -errno;
 			fprintf(stderr, "Failed to issue GPIOHANDLE GET LINE "
@@ -145,6 +160,8 @@ void print_usage(void)
 		"  -o <n>     Offset[s] to hammer, at least one, several can be stated\n"
 		" [-c <n>]    Do <n> loops (optional, infinite loop if not stated)\n"
 		"  -?         This helptext\n"
+		"With " DMEC_TRACE_ENV "=dir set, a timeline is recorded for\n"
+		"dmec-trace-merge.\n"
 		"\n"
 		"Example:\n"
 		"gpio-hammer -n gpiochip0 -o 4\n"
@@ -184,5 +201,10 @@ int main(int argc, char **argv)
 		print_usage();
 		return -1;
 	}
+
+	/* stop cleanly, so a trace gets written */
+	signal(SIGINT, term);
+	signal(SIGTERM, term);
+	dmec_trace_open("gpio-hammer");
 	return hammer_device(device_name, lines, nlines, loops);
 }
@@ -0,0 +1,526 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * DMEC driver loader
+ *
+ * Native replacement for the load script: loads dmec.ko, then
+ * i2c-dmec.ko, wdt-dmec.ko and gpio-dmec.ko in parallel (they only
+ * depend on the core), all with finit_module(). Instead of assuming
+ * device numbers it listens to kernel uevents, opened before the first
+ * module goes in, and waits for the gpiochip, the watchdog and the i2c
+ * adapter whose sysfs path runs through the DMEC device. The EEPROM is
+ * then instantiated on the adapter that was actually found, and the
+ * time of every stage is reported, both since the loader started and
+ * since boot.
+ *
+ * -r undoes it all in reverse order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/netlink.h>
+
+#define DEFAULT_DIR		"."
+#define DEFAULT_MATCH	"dmec"
+#define DEFAULT_EEPROM	"24c32 0x50"
+#define DEFAULT_TIMEOUT	10
+#define UEVENT_BUF		8192
+
+enum { N_GPIO, N_WDT, N_I2C, N_COUNT };
+
+struct node {
+	const char *what;
+	const char *subsystem;
+	const char *devtype;	/* NULL: any */
+	const char *prefix;	/* of the name */
+	const char *scan;	/* where existing devices are listed */
+	char name[NAME_MAX + 1];
+	double t;
+	int ready;
+};
+
+static struct node nodes[N_COUNT] = {
+	[N_GPIO] = { "gpiochip", "gpio", NULL, "gpiochip",
+		     "/sys/bus/gpio/devices" },
+	[N_WDT] = { "watchdog", "watchdog", NULL, "watchdog",
+		    "/sys/class/watchdog" },
+	/* the adapter itself, its /dev node would wait for i2c-dev */
+	[N_I2C] = { "i2c adapter", "i2c", "i2c_adapter", "i2c-",
+		    "/sys/bus/i2c/devices" },
+};
+
+struct module {
+	const char *name;
+	char params[128];
+	double t0, t1;
+	int err;
+};
+
+static struct module core = { "dmec" };
+static struct module children[] = {
+	{ "i2c-dmec" }, { "wdt-dmec" }, { "gpio-dmec" },
+};
+#define N_CHILDREN	(sizeof(children) / sizeof(children[0]))
+
+static const char *mod_dir = DEFAULT_DIR, *match = DEFAULT_MATCH;
+static struct timespec start;
+
+/* seconds since the loader started */
+static double elapsed(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - start.tv_sec) + (ts.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double since_boot(double t)
+{
+	struct timespec mono, boot;
+
+	/* BOOTTIME also counts suspend, close enough to MONOTONIC here */
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_BOOTTIME, &boot);
+	return t + (start.tv_sec - mono.tv_sec + boot.tv_sec) +
+	       (start.tv_nsec - mono.tv_nsec + boot.tv_nsec) / 1e9;
+}
+
+static int load_module(struct module *m)
+{
+	char path[PATH_MAX];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s.ko", mod_dir, m->name);
+	m->t0 = elapsed();
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ret = -errno;
+	} else {
+		if (syscall(SYS_finit_module, fd, m->params, 0) && errno != EEXIST)
+			ret = -errno;
+		close(fd);
+	}
+	m->t1 = elapsed();
+	m->err = ret;
+
+	if (ret)
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+	return ret;
+}
+
+static void *load_thread(void *arg)
+{
+	load_module(arg);
+	return NULL;
+}
+
+static int unload_module(const char *name)
+{
+	if (syscall(SYS_delete_module, name, O_NONBLOCK) && errno != ENOENT) {
+		fprintf(stderr, "rmmod %s: %s\n", name, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+static int uevent_open(void)
+{
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,		/* kernel events, not udev's */
+	};
+	int fd, size = 4 << 20;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -errno;
+	/* a burst of module uevents must not be dropped */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)))
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+static void node_ready(struct node *n, const char *name)
+{
+	if (n->ready)
+		return;
+	snprintf(n->name, sizeof(n->name), "%s", name);
+	n->t = elapsed();
+	n->ready = 1;
+}
+
+/* the nodes that already exist, e.g. when the modules were loaded */
+static void scan_nodes(void)
+{
+	char path[PATH_MAX], real[PATH_MAX];
+	struct dirent *de;
+	int i;
+
+	for (i = 0; i < N_COUNT; i++) {
+		struct node *n = &nodes[i];
+		DIR *d;
+
+		if (n->ready || !(d = opendir(n->scan)))
+			continue;
+		while ((de = readdir(d))) {
+			if (strncmp(de->d_name, n->prefix, strlen(n->prefix)))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", n->scan, de->d_name);
+			if (realpath(path, real) && strstr(real, match)) {
+				node_ready(n, de->d_name);
+				break;
+			}
+		}
+		closedir(d);
+	}
+}
+
+static void uevent_handle(const char *buf, size_t len)
+{
+	const char *action = NULL, *devpath = NULL, *subsys = NULL;
+	const char *devname = NULL, *devtype = NULL, *p;
+	int i;
+
+	/* "action@devpath" followed by KEY=value strings */
+	if (!memchr(buf, '@', len))
+		return;
+	for (p = buf + strlen(buf) + 1; p < buf + len; p += strlen(p) + 1) {
+		if (!strncmp(p, "ACTION=", 7))
+			action = p + 7;
+		else if (!strncmp(p, "DEVPATH=", 8))
+			devpath = p + 8;
+		else if (!strncmp(p, "SUBSYSTEM=", 10))
+			subsys = p + 10;
+		else if (!strncmp(p, "DEVNAME=", 8))
+			devname = p + 8;
+		else if (!strncmp(p, "DEVTYPE=", 8))
+			devtype = p + 8;
+	}
+	if (!action || strcmp(action, "add") || !devpath || !subsys ||
+	    !strstr(devpath, match))
+		return;
+	/* devices without a /dev node (i2c adapters) go by their sysfs name */
+	if (!devname) {
+		p = strrchr(devpath, '/');
+		devname = p ? p + 1 : devpath;
+	}
+
+	for (i = 0; i < N_COUNT; i++) {
+		struct node *n = &nodes[i];
+
+		if (!strcmp(subsys, n->subsystem) &&
+		    (!n->devtype || (devtype && !strcmp(devtype, n->devtype))) &&
+		    !strncmp(devname, n->prefix, strlen(n->prefix)))
+			node_ready(n, devname);
+	}
+}
+
+static int nodes_ready(void)
+{
+	int i;
+
+	for (i = 0; i < N_COUNT; i++)
+		if (!nodes[i].ready)
+			return 0;
+	return 1;
+}
+
+/* until cond() holds, handling uevents, checking at least every 10 ms */
+static int uevent_wait(int fd, int (*cond)(void), double deadline)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char buf[UEVENT_BUF];
+	ssize_t n;
+
+	while (!cond()) {
+		if (elapsed() > deadline)
+			return -ETIMEDOUT;
+		if (poll(&pfd, 1, 10) < 0 && errno != EINTR)
+			return -errno;
+		while ((n = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+			buf[n] = 0;
+			uevent_handle(buf, n);
+		}
+	}
+	return 0;
+}
+
+static char eeprom_path[PATH_MAX];
+
+static int eeprom_ready(void)
+{
+	return !access(eeprom_path, F_OK);
+}
+
+static int sysfs_write(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY | O_CLOEXEC), ret = 0;
+
+	if (fd < 0)
+		return -errno;
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+/* "24c32 0x50" on the adapter that was found */
+static int eeprom_add(int fd, const char *dev, double deadline, double *t)
+{
+	char path[PATH_MAX];
+	int addr, bus, ret;
+
+	if (sscanf(dev, "%*s %i", &addr) != 1 ||
+	    sscanf(nodes[N_I2C].name, "i2c-%d", &bus) != 1)
+		return -EINVAL;
+
+	snprintf(eeprom_path, sizeof(eeprom_path),
+		 "/sys/bus/i2c/devices/%d-%04x/eeprom", bus, addr);
+	if (!eeprom_ready()) {
+		snprintf(path, sizeof(path), "/sys/bus/i2c/devices/i2c-%d/new_device",
+			 bus);
+		ret = sysfs_write(path, dev);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+			return ret;
+		}
+	}
+
+	ret = uevent_wait(fd, eeprom_ready, deadline);
+	*t = elapsed();
+	return ret;
+}
+
+static int eeprom_remove(const char *dev)
+{
+	char path[PATH_MAX], addr[16];
+	int bus;
+
+	if (sscanf(dev, "%*s %15s", addr) != 1 ||
+	    sscanf(nodes[N_I2C].name, "i2c-%d", &bus) != 1)
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), "/sys/bus/i2c/devices/i2c-%d/delete_device",
+		 bus);
+	return sysfs_write(path, addr);
+}
+
+static void report_line(const char *what, double t0, double t1)
+{
+	printf("%-22s %9.1f %9.1f %10.3f\n", what, t0 * 1e3, (t1 - t0) * 1e3,
+	       since_boot(t1));
+}
+
+static void usage(void)
+{
+	printf("\nUsage: dmec-load [OPTION]...\n\n");
+	printf("   -d dir           module directory (default %s)\n",
+	       DEFAULT_DIR);
+	printf("   -A n             dmec no_acpi parameter (default: unset)\n");
+	printf("   -w n             wdt-dmec win_mode parameter (default 0)\n");
+	printf("   -e \"type addr\"   i2c device to instantiate, \"none\" for\n");
+	printf("                    none (default \"%s\")\n", DEFAULT_EEPROM);
+	printf("   -m string        part of the sysfs path of the DMEC nodes\n");
+	printf("                    (default %s)\n", DEFAULT_MATCH);
+	printf("   -t secs          readiness timeout (default %d)\n",
+	       DEFAULT_TIMEOUT);
+	printf("   -k               keep iTCO_wdt loaded\n");
+	printf("   -s               print the nodes as shell variables\n");
+	printf("   -r               remove the device and the modules\n");
+	printf("Example:\n");
+	printf("\tdmec-load -d /lib/modules/dmec -w 1\n");
+	printf("\teval $(dmec-load -s) && i2cdetect -y $DMEC_I2C\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *eeprom = DEFAULT_EEPROM, *no_acpi = NULL;
+	int win_mode = -1, keep_itco = 0, shell = 0, remove = 0;
+	unsigned int timeout = DEFAULT_TIMEOUT, i;
+	pthread_t threads[N_CHILDREN];
+	int started[N_CHILDREN], wait;
+	double deadline, t_eeprom = 0, t_ready;
+	int fd, ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"d", required_argument, 0, 0},
+			{"A", required_argument, 0, 1},
+			{"w", required_argument, 0, 2},
+			{"e", required_argument, 0, 3},
+			{"m", required_argument, 0, 4},
+			{"t", required_argument, 0, 5},
+			{"k", no_argument, 0, 6},
+			{"s", no_argument, 0, 7},
+			{"r", no_argument, 0, 8},
+			{"help", no_argument, 0, 9},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "d:A:w:e:m:t:ksrh",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'd':
+			mod_dir = optarg;
+			break;
+		case 1:
+		case 'A':
+			no_acpi = optarg;
+			break;
+		case 2:
+		case 'w':
+			win_mode = atoi(optarg);
+			break;
+		case 3:
+		case 'e':
+			eeprom = strcmp(optarg, "none") ? optarg : NULL;
+			break;
+		case 4:
+		case 'm':
+			match = optarg;
+			break;
+		case 5:
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 6:
+		case 'k':
+			keep_itco = 1;
+			break;
+		case 7:
+		case 's':
+			shell = 1;
+			break;
+		case 8:
+		case 'r':
+			remove = 1;
+			break;
+		case 9:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	/* the load script's environment still works */
+	if (!no_acpi)
+		no_acpi = getenv("NO_ACPI");
+	if (win_mode < 0)
+		win_mode = getenv("WD_MODE") ? atoi(getenv("WD_MODE")) : 0;
+
+	if (remove) {
+		scan_nodes();
+		if (eeprom && nodes[N_I2C].ready)
+			eeprom_remove(eeprom);
+		for (i = 0; i < N_CHILDREN; i++)
+			if (unload_module(children[N_CHILDREN - 1 - i].name))
+				ret = 1;
+		if (unload_module(core.name))
+			ret = 1;
+		return ret;
+	}
+
+	if (no_acpi)
+		snprintf(core.params, sizeof(core.params), "no_acpi=%s", no_acpi);
+	for (i = 0; i < N_CHILDREN; i++)
+		if (!strcmp(children[i].name, "wdt-dmec"))
+			snprintf(children[i].params, sizeof(children[i].params),
+				 "win_mode=%d", win_mode);
+
+	/* listen before anything can appear */
+	fd = uevent_open();
+	if (fd < 0) {
+		fprintf(stderr, "uevent socket: %s\n", strerror(-fd));
+		return 1;
+	}
+
+	if (!keep_itco)
+		unload_module("iTCO_wdt");
+
+	if (load_module(&core)) {
+		close(fd);
+		return 1;
+	}
+	/* the children only need the core */
+	for (i = 0; i < N_CHILDREN; i++) {
+		started[i] = !pthread_create(&threads[i], NULL, load_thread,
+					     &children[i]);
+		if (!started[i])
+			load_module(&children[i]);
+	}
+
+	deadline = elapsed() + timeout;
+	scan_nodes();
+	wait = uevent_wait(fd, nodes_ready, deadline);
+
+	for (i = 0; i < N_CHILDREN; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		if (children[i].err)
+			ret = 1;
+	}
+	if (wait) {
+		for (i = 0; i < N_COUNT; i++)
+			if (!nodes[i].ready)
+				fprintf(stderr, "no %s below \"%s\" after %u s\n",
+					nodes[i].what, match, timeout);
+		close(fd);
+		return 1;
+	}
+
+	if (eeprom && eeprom_add(fd, eeprom, deadline, &t_eeprom)) {
+		fprintf(stderr, "%s: not ready after %u s\n", eeprom_path,
+			timeout);
+		ret = 1;
+	}
+	close(fd);
+	t_ready = elapsed();
+
+	if (shell) {
+		printf("DMEC_GPIOCHIP=%s\n", nodes[N_GPIO].name);
+		printf("DMEC_WATCHDOG=%s\n", nodes[N_WDT].name);
+		printf("DMEC_I2C=%s\n", nodes[N_I2C].name + strlen("i2c-"));
+		return ret;
+	}
+
+	printf("%-22s %9s %9s %10s\n", "stage", "at[ms]", "took[ms]",
+	       "boot[s]");
+	report_line(core.name, core.t0, core.t1);
+	for (i = 0; i < N_CHILDREN; i++)
+		report_line(children[i].name, children[i].t0, children[i].t1);
+	for (i = 0; i < N_COUNT; i++) {
+		char what[NAME_MAX + 32];
+
+		snprintf(what, sizeof(what), "%s %s", nodes[i].what, nodes[i].name);
+		report_line(what, core.t1, nodes[i].t);
+	}
+	if (eeprom && t_eeprom)
+		report_line("eeprom", nodes[N_I2C].t, t_eeprom);
+	report_line("ready", 0, t_ready);
+
+	return ret;
+}
@@ -0,0 +1,443 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * EEPROM read throughput across the access paths of an I2C adapter
+ *
+ * Reads the whole EEPROM a few times through every path and reports the
+ * data rate and the latency of the single transfers:
+ *
+ *   sysfs   pread() on the at24 eeprom file, chunk bytes per call
+ *   byte    set the address pointer, then SMBus receive byte per byte
+ *   word    SMBus read word data, two bytes per transfer
+ *   block   SMBus I2C block read, 32 bytes per transfer
+ *   rdwr    I2C_RDWR, address write and chunk byte read with one STOP
+ *
+ * A 24c32 takes a two byte address, which the SMBus word and block reads
+ * can't send; they only run with -8 (one address byte, e.g. a 24c02 or
+ * i2c-stub). Every path is checked against the data of the first one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c-util.h"
+
+#define DEFAULT_ADDR	0x50
+#define DEFAULT_SIZE	4096
+#define DEFAULT_CHUNK	4096
+#define DEFAULT_PASSES	3
+#define RDWR_MAX		8192	/* kernel limit of one I2C_RDWR message */
+
+struct bench {
+	int fd, bus, addr, addr8;
+	const char *eeprom;
+	unsigned int size, chunk;
+	/* per transfer latency in ns */
+	uint32_t *lat;
+	size_t nlat, cap;
+};
+
+struct path {
+	const char *name;
+	unsigned long funcs;	/* adapter functionality needed */
+	int addr8;		/* only with one address byte */
+	int (*read)(struct bench *b, unsigned int off, uint8_t *buf,
+		    unsigned int len);
+};
+
+static void lat_add(struct bench *b, uint64_t t0)
+{
+	uint64_t d = i2c_now() - t0;
+
+	if (b->nlat == b->cap) {
+		size_t cap = b->cap ? b->cap * 2 : 4096;
+		uint32_t *p = realloc(b->lat, cap * sizeof(*p));
+
+		if (!p)
+			return;
+		b->lat = p;
+		b->cap = cap;
+	}
+	b->lat[b->nlat++] = d > UINT32_MAX ? UINT32_MAX : d;
+}
+
+/* one timed transfer */
+static int smbus(struct bench *b, char rw, uint8_t cmd, int size,
+		 union i2c_smbus_data *data)
+{
+	uint64_t t0 = i2c_now();
+	int ret;
+
+	ret = i2c_smbus(b->fd, rw, cmd, size, data);
+	lat_add(b, t0);
+
+	return ret;
+}
+
+/* the next read starts at off */
+static int set_pointer(struct bench *b, unsigned int off)
+{
+	union i2c_smbus_data data;
+
+	if (b->addr8)
+		return smbus(b, I2C_SMBUS_WRITE, off, I2C_SMBUS_BYTE, NULL);
+
+	data.byte = off & 0xff;
+	return smbus(b, I2C_SMBUS_WRITE, off >> 8, I2C_SMBUS_BYTE_DATA, &data);
+}
+
+static int read_sysfs(struct bench *b, unsigned int off, uint8_t *buf,
+		      unsigned int len)
+{
+	uint64_t t0;
+	ssize_t n;
+	int fd, ret;
+
+	/* the open is not part of the transfer */
+	fd = open(b->eeprom, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	t0 = i2c_now();
+	n = pread(fd, buf, len, off);
+	lat_add(b, t0);
+	ret = n < 0 ? -errno : n == len ? 0 : -EIO;
+	close(fd);
+
+	return ret;
+}
+
+static int read_byte(struct bench *b, unsigned int off, uint8_t *buf,
+		     unsigned int len)
+{
+	union i2c_smbus_data data;
+	unsigned int i;
+	int ret;
+
+	ret = set_pointer(b, off);
+	for (i = 0; i < len && !ret; i++) {
+		ret = smbus(b, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data);
+		buf[i] = data.byte;
+	}
+
+	return ret;
+}
+
+static int read_word(struct bench *b, unsigned int off, uint8_t *buf,
+		     unsigned int len)
+{
+	union i2c_smbus_data data;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i + 1 < len && !ret; i += 2) {
+		ret = smbus(b, I2C_SMBUS_READ, off + i, I2C_SMBUS_WORD_DATA,
+			    &data);
+		buf[i] = data.word & 0xff;
+		buf[i + 1] = data.word >> 8;
+	}
+	if (i < len && !ret) {
+		ret = smbus(b, I2C_SMBUS_READ, off + i, I2C_SMBUS_BYTE_DATA,
+			    &data);
+		buf[i] = data.byte;
+	}
+
+	return ret;
+}
+
+static int read_block(struct bench *b, unsigned int off, uint8_t *buf,
+		      unsigned int len)
+{
+	union i2c_smbus_data data;
+	unsigned int i, n;
+	int ret = 0;
+
+	for (i = 0; i < len && !ret; i += n) {
+		n = len - i < I2C_SMBUS_BLOCK_MAX ? len - i : I2C_SMBUS_BLOCK_MAX;
+		data.block[0] = n;
+		ret = smbus(b, I2C_SMBUS_READ, off + i, I2C_SMBUS_I2C_BLOCK_DATA,
+			    &data);
+		if (!ret && data.block[0] != n)
+			ret = -EIO;
+		memcpy(buf + i, data.block + 1, n);
+	}
+
+	return ret;
+}
+
+static int read_rdwr(struct bench *b, unsigned int off, uint8_t *buf,
+		     unsigned int len)
+{
+	uint8_t a[2] = { off >> 8, off & 0xff };
+	struct i2c_msg msgs[2] = {
+		{ .addr = b->addr, .flags = 0, .len = b->addr8 ? 1 : 2,
+		  .buf = b->addr8 ? a + 1 : a },
+		{ .addr = b->addr, .flags = I2C_M_RD, .len = len, .buf = buf },
+	};
+	struct i2c_rdwr_ioctl_data args = { .msgs = msgs, .nmsgs = 2 };
+	uint64_t t0 = i2c_now();
+	int ret;
+
+	ret = ioctl(b->fd, I2C_RDWR, &args);
+	lat_add(b, t0);
+
+	return ret == 2 ? 0 : ret < 0 ? -errno : -EIO;
+}
+
+static const struct path paths[] = {
+	{ "sysfs", 0, 0, read_sysfs },
+	{ "byte", I2C_FUNC_SMBUS_READ_BYTE, 0, read_byte },
+	{ "word", I2C_FUNC_SMBUS_READ_WORD_DATA, 1, read_word },
+	{ "block", I2C_FUNC_SMBUS_READ_I2C_BLOCK, 1, read_block },
+	{ "rdwr", I2C_FUNC_I2C, 0, read_rdwr },
+	{ NULL }
+};
+
+static void report(const char *name, struct bench *b, unsigned int passes,
+		   uint64_t ns, const char *check)
+{
+	size_t n = b->nlat;
+	struct i2c_lat l;
+
+	if (!n) {
+		printf("%-6s %8d %10s %9s %9s %9s %9s  %s\n", name, 0, "-", "-",
+		       "-", "-", "-", check);
+		return;
+	}
+
+	i2c_lat_stats(b->lat, n, &l);
+	printf("%-6s %8zu %10.0f %9.1f %9.1f %9.1f %9.1f  %s\n", name,
+	       n / passes, (double)b->size * passes / (ns / 1e9), l.mean,
+	       l.p50, l.p99, l.max, check);
+}
+
+static int bench_path(const struct path *p, struct bench *b,
+		      unsigned long funcs, unsigned int passes, uint8_t *ref,
+		      int *have_ref, uint8_t *buf)
+{
+	unsigned int pass, off, len;
+	uint64_t t0;
+	int ret = 0;
+
+	if (p->addr8 && !b->addr8) {
+		printf("%-6s skipped, needs one byte addressing (-8)\n", p->name);
+		return 0;
+	}
+	if (p->funcs && (funcs & p->funcs) != p->funcs) {
+		printf("%-6s skipped, not supported by the adapter\n", p->name);
+		return 0;
+	}
+	if (p->read == read_sysfs && access(b->eeprom, R_OK)) {
+		printf("%-6s skipped, %s: %s\n", p->name, b->eeprom,
+		       strerror(errno));
+		return 0;
+	}
+
+	b->nlat = 0;
+	t0 = i2c_now();
+	for (pass = 0; pass < passes && !ret; pass++) {
+		for (off = 0; off < b->size && !ret; off += len) {
+			len = b->size - off < b->chunk ? b->size - off : b->chunk;
+			ret = p->read(b, off, buf + off, len);
+		}
+	}
+	if (ret) {
+		printf("%-6s failed at %#x: %s\n", p->name, off - len,
+		       strerror(-ret));
+		return ret;
+	}
+
+	if (!*have_ref) {
+		memcpy(ref, buf, b->size);
+		*have_ref = 1;
+		report(p->name, b, passes, i2c_now() - t0, "reference");
+	} else {
+		report(p->name, b, passes, i2c_now() - t0,
+		       memcmp(ref, buf, b->size) ? "MISMATCH" : "ok");
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("\nUsage: eeprom-bench [OPTION]...\n\n");
+	printf("   -b bus           i2c bus number\n");
+	printf("   -a addr          eeprom address (default %#x)\n",
+	       DEFAULT_ADDR);
+	printf("   -s size          eeprom size in bytes (default %d)\n",
+	       DEFAULT_SIZE);
+	printf("   -c chunk         bytes per sysfs read, address pointer set\n");
+	printf("                    and I2C_RDWR message (default %d)\n",
+	       DEFAULT_CHUNK);
+	printf("   -n passes        reads of the whole eeprom per path (default %d)\n",
+	       DEFAULT_PASSES);
+	printf("   -p paths         comma separated subset of\n");
+	printf("                    sysfs,byte,word,block,rdwr (default all)\n");
+	printf("   -8               one address byte (24c02, i2c-stub)\n");
+	printf("   -e file          at24 eeprom file\n");
+	printf("                    (default /sys/bus/i2c/devices/<bus>-00<addr>/eeprom)\n");
+	printf("Example:\n");
+	printf("\teeprom-bench -b 11\n");
+	printf("\teeprom-bench -b 11 -p byte,rdwr -c 32\n");
+	printf("\tmodprobe i2c-stub chip_addr=0x50; eeprom-bench -b <stub bus> -8 -s 256\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench b = {
+		.bus = -1,
+		.addr = DEFAULT_ADDR,
+		.size = DEFAULT_SIZE,
+		.chunk = DEFAULT_CHUNK,
+	};
+	unsigned int passes = DEFAULT_PASSES;
+	char *sel = NULL, *eeprom = NULL, dev[64], sysfs[128];
+	unsigned long funcs = 0;
+	uint8_t *ref = NULL, *buf = NULL;
+	int i, have_ref = 0, ret = 1;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"b", required_argument, 0, 0},
+			{"a", required_argument, 0, 1},
+			{"s", required_argument, 0, 2},
+			{"c", required_argument, 0, 3},
+			{"n", required_argument, 0, 4},
+			{"p", required_argument, 0, 5},
+			{"8", no_argument, 0, 6},
+			{"e", required_argument, 0, 7},
+			{"help", no_argument, 0, 8},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "b:a:s:c:n:p:8e:h",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'b':
+			b.bus = atoi(optarg);
+			break;
+		case 1:
+		case 'a':
+			b.addr = strtol(optarg, NULL, 0);
+			break;
+		case 2:
+		case 's':
+			b.size = strtoul(optarg, NULL, 0);
+			break;
+		case 3:
+		case 'c':
+			b.chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 4:
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 5:
+		case 'p':
+			sel = optarg;
+			break;
+		case 6:
+		case '8':
+			b.addr8 = 1;
+			break;
+		case 7:
+		case 'e':
+			eeprom = optarg;
+			break;
+		case 8:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (b.bus < 0 || !b.size || !b.chunk || !passes) {
+		usage();
+		return 1;
+	}
+	if (b.chunk > RDWR_MAX) {
+		printf("error: chunk larger than %d\n", RDWR_MAX);
+		return 1;
+	}
+	if (b.addr8 && b.size > 256) {
+		printf("error: one address byte reaches 256 bytes only\n");
+		return 1;
+	}
+
+	snprintf(sysfs, sizeof(sysfs), "/sys/bus/i2c/devices/%d-%04x/eeprom",
+		 b.bus, b.addr);
+	b.eeprom = eeprom ? eeprom : sysfs;
+
+	snprintf(dev, sizeof(dev), "/dev/i2c-%d", b.bus);
+	b.fd = open(dev, O_RDWR);
+	if (b.fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(b.fd, I2C_FUNCS, &funcs))
+		perror("I2C_FUNCS");
+
+	/* at24 owns the address, reading beside it is harmless */
+	if (ioctl(b.fd, I2C_SLAVE, b.addr) && (errno != EBUSY ||
+	    ioctl(b.fd, I2C_SLAVE_FORCE, b.addr))) {
+		perror("I2C_SLAVE");
+		goto out;
+	}
+
+	ref = malloc(b.size);
+	buf = malloc(b.size);
+	if (!ref || !buf) {
+		perror("malloc");
+		goto out;
+	}
+
+	printf("%s address %#x, %u bytes, %s addressing, chunk %u, "
+	       "%u passes\n", dev, b.addr, b.size, b.addr8 ? "8 bit" :
+	       "16 bit", b.chunk, passes);
+	printf("\n%-6s %8s %10s %9s %9s %9s %9s  %s\n", "path", "xfers",
+	       "bytes/s", "mean[us]", "p50[us]", "p99[us]", "max[us]",
+	       "data");
+
+	ret = 0;
+	for (i = 0; paths[i].name; i++) {
+		const char *s = sel;
+		size_t n = strlen(paths[i].name);
+
+		/* a path is selected when it is one of the list items */
+		while (s && (strncmp(s, paths[i].name, n) ||
+			     (s[n] && s[n] != ','))) {
+			s = strchr(s, ',');
+			if (s)
+				s++;
+		}
+		if (sel && !s)
+			continue;
+
+		if (bench_path(&paths[i], &b, funcs, passes, ref, &have_ref,
+			       buf))
+			ret = 1;
+	}
+
+out:
+	close(b.fd);
+	free(b.lat);
+	free(ref);
+	free(buf);
+	return ret;
+}
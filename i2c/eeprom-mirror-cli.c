@@ -0,0 +1,223 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Command line client of the EEPROM mirror
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "eeprom-mirror.h"
+
+#define DEFAULT_ADDR	0x50
+#define DEFAULT_SYNC_MS	1000
+
+static void usage(void)
+{
+	printf("\nUsage: eeprom-mirror-cli {-b bus [-a addr] | -m file} command [args]\n\n");
+	printf("   -b bus           i2c bus number of the mirrored eeprom\n");
+	printf("   -a addr          eeprom address (default %#x)\n", DEFAULT_ADDR);
+	printf("   -m file          mirror file (default /dev/shm/eeprom-<bus>-<addr>,\n");
+	printf("                    as eeprom-mirrord)\n");
+	printf("Commands:\n");
+	printf("   read off len     hex dump of len bytes at off\n");
+	printf("   write off hex    write the hex bytes at off\n");
+	printf("   sync [ms]        wait until the writes are on the device\n");
+	printf("                    (default %d ms)\n", DEFAULT_SYNC_MS);
+	printf("   check            compare the mirror with the device crc\n");
+	printf("   stat             header and counters\n");
+	printf("   bench n          time n reads of 16 bytes\n");
+	printf("Example:\n");
+	printf("\teeprom-mirror-cli -b 11 write 0x100 deadbeef && "
+	       "eeprom-mirror-cli -b 11 sync\n\n");
+}
+
+static int cmd_read(struct eem *m, unsigned int off, unsigned int len)
+{
+	uint8_t *buf = malloc(len);
+	unsigned int i;
+	int ret;
+
+	if (!buf)
+		return -ENOMEM;
+
+	ret = eem_read(m, off, buf, len);
+	for (i = 0; i < len && !ret; i++)
+		printf("%s%02x", i % 16 ? " " : i ? "\n" : "", buf[i]);
+	if (!ret && len)
+		printf("\n");
+
+	free(buf);
+	return ret;
+}
+
+static int cmd_write(struct eem *m, unsigned int off, const char *hex)
+{
+	size_t n = strlen(hex) / 2, i;
+	uint8_t *buf;
+	int ret;
+
+	if (!n || strlen(hex) % 2)
+		return -EINVAL;
+	buf = malloc(n);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		char byte[3] = { hex[2 * i], hex[2 * i + 1], 0 }, *end;
+
+		buf[i] = strtoul(byte, &end, 16);
+		if (*end) {
+			free(buf);
+			return -EINVAL;
+		}
+	}
+
+	ret = eem_write(m, off, buf, n);
+	free(buf);
+	return ret;
+}
+
+static void cmd_stat(struct eem *m)
+{
+	struct eem_hdr *h = m->hdr;
+	unsigned int pg, dirty = 0;
+
+	for (pg = 0; pg < h->size / h->page; pg++)
+		dirty += eem_dirty(m, pg);
+
+	printf("size %u, page %u, daemon %d, %s, crc %08x\n", h->size, h->page,
+	       h->pid, h->valid ? "valid" : "INVALID", h->crc);
+	printf("loaded %llu, validated %llu (realtime s)\n",
+	       (unsigned long long)(h->loaded / 1000000000ull),
+	       (unsigned long long)(h->validated / 1000000000ull));
+	printf("dirty pages %u%s\n", dirty, h->busy ? ", writeback running" : "");
+	printf("flushes %llu, pages written %llu (%llu bytes), skipped %llu\n",
+	       (unsigned long long)h->flushes,
+	       (unsigned long long)h->pages_written,
+	       (unsigned long long)h->bytes_written,
+	       (unsigned long long)h->pages_skipped);
+	printf("write errors %llu, verify errors %llu\n",
+	       (unsigned long long)h->write_errors,
+	       (unsigned long long)h->verify_errors);
+	printf("external changes %llu, restored %llu\n",
+	       (unsigned long long)h->external,
+	       (unsigned long long)h->restored);
+}
+
+static int cmd_bench(struct eem *m, unsigned long n)
+{
+	struct timespec t0, t1;
+	uint8_t buf[16];
+	unsigned long i;
+	double ns;
+	int ret = 0;
+
+	if (!n || m->hdr->size < sizeof(buf))
+		return -EINVAL;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n && !ret; i++)
+		ret = eem_read(m, (i * 97) % (m->hdr->size - sizeof(buf)), buf,
+			       sizeof(buf));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	if (!ret)
+		printf("%lu reads of %zu bytes, %.1f ns per read\n", n,
+		       sizeof(buf), ns / n);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL, *cmd;
+	int bus = -1, addr = DEFAULT_ADDR, ret;
+	struct eem m;
+	char def[64];
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"m", required_argument, 0, 0},
+			{"b", required_argument, 0, 1},
+			{"a", required_argument, 0, 2},
+			{"help", no_argument, 0, 3},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "+m:b:a:h", long_options,
+				    &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'm':
+			path = optarg;
+			break;
+		case 1:
+		case 'b':
+			bus = atoi(optarg);
+			break;
+		case 2:
+		case 'a':
+			addr = strtol(optarg, NULL, 0);
+			break;
+		case 3:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind >= argc || (!path && bus < 0)) {
+		usage();
+		return 1;
+	}
+	if (!path) {
+		snprintf(def, sizeof(def), EEM_PATH, bus, addr);
+		path = def;
+	}
+	cmd = argv[optind++];
+	argc -= optind;
+	argv += optind;
+
+	/* only a write needs more than read access */
+	ret = eem_open(&m, path, strcmp(cmd, "write") ? O_RDONLY : O_RDWR);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+		return 1;
+	}
+
+	if (!strcmp(cmd, "read") && argc == 2) {
+		ret = cmd_read(&m, strtoul(argv[0], NULL, 0),
+			       strtoul(argv[1], NULL, 0));
+	} else if (!strcmp(cmd, "write") && argc == 2) {
+		ret = cmd_write(&m, strtoul(argv[0], NULL, 0), argv[1]);
+	} else if (!strcmp(cmd, "sync") && argc <= 1) {
+		ret = eem_sync(&m, argc ? atoi(argv[0]) : DEFAULT_SYNC_MS);
+	} else if (!strcmp(cmd, "check") && !argc) {
+		ret = eem_check(&m);
+		if (!ret)
+			printf("mirror matches crc %08x\n", m.hdr->crc);
+	} else if (!strcmp(cmd, "stat") && !argc) {
+		cmd_stat(&m);
+		ret = 0;
+	} else if (!strcmp(cmd, "bench") && argc == 1) {
+		ret = cmd_bench(&m, strtoul(argv[0], NULL, 0));
+	} else {
+		usage();
+		ret = -EINVAL;
+	}
+
+	if (ret)
+		fprintf(stderr, "%s: %s\n", cmd, strerror(-ret));
+	eem_close(&m);
+	return ret ? 1 : 0;
+}
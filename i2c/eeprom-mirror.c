@@ -0,0 +1,293 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Shared memory mirror of an EEPROM, client library and helpers
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "eeprom-mirror.h"
+
+#define EEM_READ_TRIES	1000
+
+uint32_t eem_crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = ~0u;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static int eem_map(struct eem *m, int prot)
+{
+	void *p;
+
+	p = mmap(NULL, m->len, prot, MAP_SHARED, m->fd, 0);
+	if (p == MAP_FAILED)
+		return -errno;
+
+	m->hdr = p;
+	m->data = (uint8_t *)p + EEM_DATA_OFF;
+	return 0;
+}
+
+/* flags O_RDONLY or O_RDWR, a read-only mirror refuses eem_write() */
+int eem_open(struct eem *m, const char *path, int flags)
+{
+	struct eem_hdr h;
+	int ret;
+
+	m->rdonly = (flags & O_ACCMODE) == O_RDONLY;
+	m->fd = open(path, m->rdonly ? O_RDONLY : O_RDWR);
+	if (m->fd < 0)
+		return -errno;
+
+	if (pread(m->fd, &h, sizeof(h), 0) != sizeof(h) ||
+	    memcmp(h.magic, EEM_MAGIC, sizeof(h.magic)) ||
+	    h.version != EEM_VERSION) {
+		close(m->fd);
+		return -EPROTO;
+	}
+
+	m->len = EEM_DATA_OFF + h.size;
+	ret = eem_map(m, m->rdonly ? PROT_READ : PROT_READ | PROT_WRITE);
+	if (ret)
+		close(m->fd);
+	return ret;
+}
+
+void eem_close(struct eem *m)
+{
+	munmap(m->hdr, m->len);
+	close(m->fd);
+}
+
+int eem_lock(struct eem *m)
+{
+	while (flock(m->fd, LOCK_EX))
+		if (errno != EINTR)
+			return -errno;
+	return 0;
+}
+
+void eem_unlock(struct eem *m)
+{
+	flock(m->fd, LOCK_UN);
+}
+
+/* bracket a change of the data, under the lock */
+void eem_begin(struct eem *m)
+{
+	__atomic_store_n(&m->hdr->gen, m->hdr->gen + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void eem_end(struct eem *m)
+{
+	__atomic_store_n(&m->hdr->gen, m->hdr->gen + 1, __ATOMIC_RELEASE);
+}
+
+static int eem_range(struct eem *m, unsigned int off, unsigned int len)
+{
+	return off > m->hdr->size || len > m->hdr->size - off ? -EINVAL : 0;
+}
+
+/* data and, if asked for, the published CRC of one generation */
+static int eem_snap(struct eem *m, unsigned int off, void *buf,
+		    unsigned int len, uint32_t *crc, uint32_t *genp)
+{
+	uint32_t gen;
+	int i;
+
+	if (eem_range(m, off, len))
+		return -EINVAL;
+
+	for (i = 0; i < EEM_READ_TRIES; i++) {
+		gen = __atomic_load_n(&m->hdr->gen, __ATOMIC_ACQUIRE);
+		if (gen & 1) {
+			sched_yield();
+			continue;
+		}
+		if (crc)
+			*crc = m->hdr->crc;
+		memcpy(buf, m->data + off, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&m->hdr->gen, __ATOMIC_RELAXED) != gen)
+			continue;
+
+		if (genp)
+			*genp = gen;
+		return __atomic_load_n(&m->hdr->valid, __ATOMIC_RELAXED) ?
+		       0 : -ESTALE;
+	}
+
+	return -EAGAIN;
+}
+
+int eem_read(struct eem *m, unsigned int off, void *buf, unsigned int len)
+{
+	return eem_snap(m, off, buf, len, NULL, NULL);
+}
+
+int eem_write(struct eem *m, unsigned int off, const void *buf,
+	      unsigned int len)
+{
+	struct eem_hdr *h = m->hdr;
+	unsigned int pg;
+	int ret;
+
+	if (m->rdonly)
+		return -EBADF;
+	if (!len)
+		return 0;
+	if (eem_range(m, off, len))
+		return -EINVAL;
+	if (!h->valid)
+		return -ESTALE;
+
+	ret = eem_lock(m);
+	if (ret)
+		return ret;
+
+	eem_begin(m);
+	memcpy(m->data + off, buf, len);
+	for (pg = off / h->page; pg <= (off + len - 1) / h->page; pg++)
+		h->dirty[pg / 64] |= 1ull << (pg % 64);
+	eem_end(m);
+
+	eem_unlock(m);
+	return 0;
+}
+
+/*
+ * Under the lock: the daemon clears dirty and sets busy in one locked
+ * section, a lock free look could see neither.
+ */
+static int eem_pending(struct eem *m)
+{
+	struct eem_hdr *h = m->hdr;
+	unsigned int i;
+	int ret;
+
+	ret = eem_lock(m);
+	if (ret)
+		return ret;
+	ret = !!h->busy;
+	for (i = 0; i < EEM_MAX_PAGES / 64 && !ret; i++)
+		ret = !!h->dirty[i];
+	eem_unlock(m);
+	return ret;
+}
+
+/* ask for a writeback and wait until nothing is pending */
+int eem_sync(struct eem *m, unsigned int timeout_ms)
+{
+	struct eem_hdr *h = m->hdr;
+	uint64_t errors = h->verify_errors + h->write_errors;
+	struct timespec ts = { 0, 1000000 };
+	unsigned int ms;
+	int ret;
+
+	ret = eem_pending(m);
+	if (ret <= 0)
+		return ret;
+	if (h->pid <= 0)
+		return -ESRCH;
+	if (kill(h->pid, SIGUSR1))
+		return -errno;
+
+	for (ms = 0; ms < timeout_ms; ms++) {
+		nanosleep(&ts, NULL);
+		if (h->verify_errors + h->write_errors != errors)
+			return -EIO;
+		ret = eem_pending(m);
+		if (ret <= 0)
+			return ret;
+	}
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Checks the mirror against the CRC of the device contents. Only
+ * meaningful without pending writes, -EAGAIN otherwise.
+ */
+int eem_check(struct eem *m)
+{
+	uint32_t crc, gen;
+	uint8_t *buf;
+	int ret;
+
+	buf = malloc(m->hdr->size);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = eem_snap(m, 0, buf, m->hdr->size, &crc, &gen);
+	/* nothing pending now and nothing changed since the copy */
+	if (!ret) {
+		ret = eem_pending(m);
+		if (!ret && __atomic_load_n(&m->hdr->gen, __ATOMIC_ACQUIRE) !=
+		    gen)
+			ret = 1;
+		if (ret > 0)
+			ret = -EAGAIN;
+	}
+	if (!ret && eem_crc32(buf, m->hdr->size) != crc)
+		ret = -EBADMSG;
+
+	free(buf);
+	return ret;
+}
+
+/* a fresh mirror, not valid until the daemon loaded it */
+int eem_create(struct eem *m, const char *path, unsigned int size,
+	       unsigned int page)
+{
+	int ret;
+
+	if (size / page > EEM_MAX_PAGES || size % page)
+		return -EINVAL;
+
+	/* clients of an old mirror keep their mapping of the old file */
+	unlink(path);
+	m->rdonly = 0;
+	m->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (m->fd < 0)
+		return -errno;
+
+	m->len = EEM_DATA_OFF + size;
+	if (ftruncate(m->fd, m->len)) {
+		ret = -errno;
+		goto err;
+	}
+	ret = eem_map(m, PROT_READ | PROT_WRITE);
+	if (ret)
+		goto err;
+
+	memcpy(m->hdr->magic, EEM_MAGIC, sizeof(m->hdr->magic));
+	m->hdr->version = EEM_VERSION;
+	m->hdr->size = size;
+	m->hdr->page = page;
+	m->hdr->pid = getpid();
+	return 0;
+
+err:
+	close(m->fd);
+	unlink(path);
+	return ret;
+}
@@ -0,0 +1,78 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Shared memory mirror of an EEPROM, kept by eeprom-mirrord
+ *
+ * The mirror is a file on tmpfs: a header page followed by the EEPROM
+ * contents. Clients map it and read without any bus traffic. Writes go
+ * into the mirror and mark their pages dirty; the daemon writes them
+ * back, page by page, and verifies them.
+ *
+ * Readers are lock free: gen is odd while the data changes, a read is
+ * retried when gen moved under it. Everything that changes the data
+ * (client writes, the daemon) holds an flock() on the mirror file.
+ * The file is created 0644, clients that only read open it O_RDONLY.
+ */
+#ifndef _EEPROM_MIRROR_H_
+#define _EEPROM_MIRROR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEM_MAGIC		"EEMR"
+#define EEM_VERSION		1
+#define EEM_MAX_PAGES	1024
+#define EEM_DATA_OFF	4096
+#define EEM_PATH		"/dev/shm/eeprom-%d-%02x"	/* bus, addr */
+
+struct eem_hdr {
+	char magic[4];
+	uint32_t version;
+	uint32_t size, page;
+	uint32_t gen;		/* odd while the data changes */
+	uint32_t valid;		/* cleared when the device can't be trusted */
+	uint32_t busy;		/* a writeback is in flight */
+	uint32_t crc;		/* CRC-32 of the device contents */
+	int32_t pid;		/* daemon, SIGUSR1 asks for a writeback */
+	uint32_t pad;
+	uint64_t loaded;	/* CLOCK_REALTIME ns of the initial load */
+	uint64_t validated;	/* and of the last revalidation */
+	uint64_t flushes, pages_written, pages_skipped, bytes_written;
+	uint64_t verify_errors, write_errors;
+	uint64_t external;	/* pages changed on the device behind us */
+	uint64_t restored;	/* mirror pages changed without eem_write() */
+	uint64_t dirty[EEM_MAX_PAGES / 64];
+};
+
+struct eem {
+	int fd;
+	int rdonly;
+	size_t len;
+	struct eem_hdr *hdr;
+	uint8_t *data;
+};
+
+uint32_t eem_crc32(const uint8_t *p, size_t len);
+
+/* client side */
+int eem_open(struct eem *m, const char *path, int flags);
+void eem_close(struct eem *m);
+int eem_read(struct eem *m, unsigned int off, void *buf, unsigned int len);
+int eem_write(struct eem *m, unsigned int off, const void *buf,
+	      unsigned int len);
+int eem_sync(struct eem *m, unsigned int timeout_ms);
+int eem_check(struct eem *m);
+
+/* daemon side */
+int eem_create(struct eem *m, const char *path, unsigned int size,
+	       unsigned int page);
+int eem_lock(struct eem *m);
+void eem_unlock(struct eem *m);
+void eem_begin(struct eem *m);
+void eem_end(struct eem *m);
+
+static inline int eem_dirty(struct eem *m, unsigned int pg)
+{
+	return (m->hdr->dirty[pg / 64] >> (pg % 64)) & 1;
+}
+
+#endif /* _EEPROM_MIRROR_H_ */
@@ -0,0 +1,369 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * EEPROM mirror daemon
+ *
+ * Loads the EEPROM once into a shared memory mirror (eeprom-mirror.h)
+ * and keeps the two in step:
+ *
+ *  - writeback: every interval, or right away on SIGUSR1, the dirty
+ *    pages are taken from the mirror. Whatever clients wrote into a page
+ *    in the meantime goes out as one write, and only the span that
+ *    differs from the device. Each write is read back; a page that
+ *    doesn't verify is dirtied again.
+ *  - revalidation: every few seconds the device is read again. Pages
+ *    that changed behind our back (sysfs, other tools) are taken over
+ *    unless a client has pending writes to them, and clean mirror pages
+ *    that no longer match the device are restored. If the device can't
+ *    be read the mirror is marked invalid until it can.
+ *
+ * The daemon keeps its own copy of what is on the device, the CRC of
+ * that copy is published in the header for eem_check().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+
+#include "eeprom.h"
+#include "eeprom-mirror.h"
+
+#define DEFAULT_ADDR		0x50
+#define DEFAULT_SIZE		4096
+#define DEFAULT_FLUSH_MS	100
+#define DEFAULT_CHECK_S		60
+
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void publish_crc(struct eem *m, const uint8_t *dev)
+{
+	eem_begin(m);
+	m->hdr->crc = eem_crc32(dev, m->hdr->size);
+	eem_end(m);
+}
+
+/* write one page back, only the span that differs, and verify it */
+static int writeback_page(struct eeprom *e, struct eem *m, unsigned int pg,
+			  const uint8_t *want, uint8_t *dev)
+{
+	unsigned int page = m->hdr->page, off = pg * page, lo, hi;
+	uint8_t check[page];
+	int ret;
+
+	for (lo = 0; lo < page && want[lo] == dev[off + lo]; lo++)
+		;
+	if (lo == page) {
+		m->hdr->pages_skipped++;
+		return 0;
+	}
+	for (hi = page; want[hi - 1] == dev[off + hi - 1]; hi--)
+		;
+
+	ret = eeprom_write(e, off + lo, want + lo, hi - lo, 0);
+	if (ret) {
+		m->hdr->write_errors++;
+		return ret;
+	}
+	ret = eeprom_read(e, off + lo, check, hi - lo);
+	if (ret || memcmp(check, want + lo, hi - lo)) {
+		m->hdr->verify_errors++;
+		return ret ? ret : -EIO;
+	}
+
+	memcpy(dev + off + lo, want + lo, hi - lo);
+	m->hdr->pages_written++;
+	m->hdr->bytes_written += hi - lo;
+	return 0;
+}
+
+static void writeback(struct eeprom *e, struct eem *m, uint8_t *dev,
+		      uint8_t *work, unsigned char *pages)
+{
+	struct eem_hdr *h = m->hdr;
+	unsigned int n = h->size / h->page, pg, any = 0;
+
+	/* take the dirty pages as they are now, clients may go on writing */
+	if (eem_lock(m))
+		return;
+	for (pg = 0; pg < n; pg++) {
+		pages[pg] = eem_dirty(m, pg);
+		if (!pages[pg])
+			continue;
+		memcpy(work + pg * h->page, m->data + pg * h->page, h->page);
+		any = 1;
+	}
+	if (any) {
+		memset(h->dirty, 0, sizeof(h->dirty));
+		__atomic_store_n(&h->busy, 1, __ATOMIC_RELEASE);
+	}
+	eem_unlock(m);
+	if (!any)
+		return;
+
+	for (pg = 0; pg < n; pg++) {
+		if (!pages[pg])
+			continue;
+		if (!writeback_page(e, m, pg, work + pg * h->page, dev))
+			continue;
+
+		fprintf(stderr, "page %#x: writeback failed, retrying later\n",
+			pg * h->page);
+		eem_lock(m);
+		h->dirty[pg / 64] |= 1ull << (pg % 64);
+		eem_unlock(m);
+	}
+
+	eem_lock(m);
+	publish_crc(m, dev);
+	h->flushes++;
+	__atomic_store_n(&h->busy, 0, __ATOMIC_RELEASE);
+	eem_unlock(m);
+}
+
+static void revalidate(struct eeprom *e, struct eem *m, uint8_t *dev,
+		       uint8_t *work)
+{
+	struct eem_hdr *h = m->hdr;
+	unsigned int n = h->size / h->page, pg, page = h->page;
+	unsigned long ext = 0, res = 0;
+	int ret;
+
+	ret = eeprom_read(e, 0, work, h->size);
+	if (ret) {
+		if (h->valid)
+			fprintf(stderr, "revalidate: %s, mirror invalid\n",
+				strerror(-ret));
+		__atomic_store_n(&h->valid, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (eem_lock(m))
+		return;
+	eem_begin(m);
+	for (pg = 0; pg < n; pg++) {
+		unsigned int off = pg * page;
+		int changed = memcmp(work + off, dev + off, page);
+
+		if (changed) {
+			memcpy(dev + off, work + off, page);
+			ext++;
+		}
+		/* a pending client write wins over the device */
+		if (eem_dirty(m, pg) || !memcmp(m->data + off, dev + off, page))
+			continue;
+		memcpy(m->data + off, dev + off, page);
+		if (!changed)
+			res++;
+	}
+	h->crc = eem_crc32(dev, h->size);
+	h->external += ext;
+	h->restored += res;
+	h->validated = realtime_ns();
+	h->valid = 1;
+	eem_end(m);
+	eem_unlock(m);
+
+	if (ext || res)
+		fprintf(stderr, "revalidate: %lu pages changed on the device, "
+			"%lu mirror pages restored\n", ext, res);
+}
+
+static void usage(void)
+{
+	printf("\nUsage: eeprom-mirrord [OPTION]...\n\n");
+	printf("   -b bus           i2c bus number\n");
+	printf("   -a addr          eeprom address (default %#x)\n",
+	       DEFAULT_ADDR);
+	printf("   -s size          eeprom size in bytes (default %d)\n",
+	       DEFAULT_SIZE);
+	printf("   -P page          page size in bytes (default %d)\n",
+	       EEPROM_PAGE_24C32);
+	printf("   -8               one address byte (24c02, i2c-stub)\n");
+	printf("   -m file          mirror file (default /dev/shm/eeprom-<bus>-<addr>)\n");
+	printf("   -i ms            writeback interval (default %d)\n",
+	       DEFAULT_FLUSH_MS);
+	printf("   -r secs          revalidation interval, 0: off (default %d)\n",
+	       DEFAULT_CHECK_S);
+	printf("Example:\n");
+	printf("\teeprom-mirrord -b 11 &\n");
+	printf("\teeprom-mirror-cli -m /dev/shm/eeprom-11-50 read 0 16\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct eeprom e;
+	struct eem m;
+	int bus = -1, addr = DEFAULT_ADDR, addr8 = 0, ret;
+	unsigned int size = DEFAULT_SIZE, page = EEPROM_PAGE_24C32;
+	unsigned int flush_ms = DEFAULT_FLUSH_MS, check_s = DEFAULT_CHECK_S;
+	char *path = NULL, def[64];
+	uint8_t *dev = NULL, *work = NULL;
+	unsigned char *pages = NULL;
+	uint64_t t0, next_check;
+	struct timespec ts;
+	sigset_t mask;
+	int sig;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"b", required_argument, 0, 0},
+			{"a", required_argument, 0, 1},
+			{"s", required_argument, 0, 2},
+			{"P", required_argument, 0, 3},
+			{"8", no_argument, 0, 4},
+			{"m", required_argument, 0, 5},
+			{"i", required_argument, 0, 6},
+			{"r", required_argument, 0, 7},
+			{"help", no_argument, 0, 8},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "b:a:s:P:8m:i:r:h",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'b':
+			bus = atoi(optarg);
+			break;
+		case 1:
+		case 'a':
+			addr = strtol(optarg, NULL, 0);
+			break;
+		case 2:
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 3:
+		case 'P':
+			page = strtoul(optarg, NULL, 0);
+			break;
+		case 4:
+		case '8':
+			addr8 = 1;
+			break;
+		case 5:
+		case 'm':
+			path = optarg;
+			break;
+		case 6:
+		case 'i':
+			flush_ms = atoi(optarg);
+			break;
+		case 7:
+		case 'r':
+			check_s = atoi(optarg);
+			break;
+		case 8:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (bus < 0 || !size || !flush_ms) {
+		usage();
+		return 1;
+	}
+	if (!page || (page & (page - 1)) || page > 8192 || size % page) {
+		printf("error: bad page size %u\n", page);
+		return 1;
+	}
+	if (!path) {
+		snprintf(def, sizeof(def), EEM_PATH, bus, addr);
+		path = def;
+	}
+
+	dev = malloc(size);
+	work = malloc(size);
+	pages = malloc(size / page);
+	if (!dev || !work || !pages) {
+		perror("malloc");
+		return 1;
+	}
+
+	if (eeprom_open(&e, bus, addr, size, page, addr8))
+		return 1;
+	ret = eem_create(&m, path, size, page);
+	if (ret) {
+		fprintf(stderr, "error: mirror %s: %s\n", path, strerror(-ret));
+		eeprom_close(&e);
+		return 1;
+	}
+
+	/*
+	 * Taken with sigtimedwait(): a SIGUSR1 that comes in during a
+	 * writeback stays pending and ends the next wait right away.
+	 */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	t0 = i2c_now();
+	ret = eeprom_read(&e, 0, dev, size);
+	if (ret) {
+		fprintf(stderr, "error: loading the eeprom: %s\n", strerror(-ret));
+		goto out;
+	}
+	memcpy(m.data, dev, size);
+	m.hdr->crc = eem_crc32(dev, size);
+	m.hdr->loaded = m.hdr->validated = realtime_ns();
+	__atomic_store_n(&m.hdr->valid, 1, __ATOMIC_RELEASE);
+	printf("%s: %u bytes loaded in %.1f ms, crc %08x\n", path, size,
+	       (i2c_now() - t0) / 1e6, m.hdr->crc);
+	fflush(stdout);
+
+	next_check = i2c_now() + check_s * 1000000000ull;
+	for (;;) {
+		ts.tv_sec = flush_ms / 1000;
+		ts.tv_nsec = (flush_ms % 1000) * 1000000;
+		/* SIGUSR1 cuts the wait short */
+		sig = sigtimedwait(&mask, NULL, &ts);
+		if (sig == SIGINT || sig == SIGTERM)
+			break;
+
+		writeback(&e, &m, dev, work, pages);
+		if (check_s && i2c_now() >= next_check) {
+			revalidate(&e, &m, dev, work);
+			next_check += check_s * 1000000000ull;
+		}
+	}
+
+	/* what clients wrote last still goes out */
+	writeback(&e, &m, dev, work, pages);
+	printf("%lu flushes, %lu pages written (%lu bytes), %lu skipped, "
+	       "%lu write and %lu verify errors\n",
+	       (unsigned long)m.hdr->flushes,
+	       (unsigned long)m.hdr->pages_written,
+	       (unsigned long)m.hdr->bytes_written,
+	       (unsigned long)m.hdr->pages_skipped,
+	       (unsigned long)m.hdr->write_errors,
+	       (unsigned long)m.hdr->verify_errors);
+
+out:
+	__atomic_store_n(&m.hdr->valid, 0, __ATOMIC_RELEASE);
+	m.hdr->pid = 0;
+	unlink(path);
+	eem_close(&m);
+	eeprom_close(&e);
+	free(dev);
+	free(work);
+	free(pages);
+	return ret ? 1 : 0;
+}
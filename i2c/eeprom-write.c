@@ -0,0 +1,231 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Page batched EEPROM writer
+ *
+ * Splits the data into page aligned writes, reads what the EEPROM holds
+ * first and only writes the pages that differ. After a page the device
+ * is polled until it acknowledges again, so every page costs its real
+ * write cycle instead of the worst case; -D sleeps a fixed delay instead
+ * for comparison.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "eeprom.h"
+
+#define DEFAULT_ADDR	0x50
+#define DEFAULT_SIZE	4096
+
+static void usage(void)
+{
+	printf("\nUsage: eeprom-write [OPTION]... file\n\n");
+	printf("   -b bus           i2c bus number\n");
+	printf("   -a addr          eeprom address (default %#x)\n",
+	       DEFAULT_ADDR);
+	printf("   -s size          eeprom size in bytes (default %d)\n",
+	       DEFAULT_SIZE);
+	printf("   -P page          page size in bytes (default %d)\n",
+	       EEPROM_PAGE_24C32);
+	printf("   -o offset        eeprom offset of the data (default 0)\n");
+	printf("   -8               one address byte (24c02, i2c-stub)\n");
+	printf("   -D us            sleep us after each write instead of\n");
+	printf("                    polling for the end of the write cycle\n");
+	printf("   -V               read back and compare after writing\n");
+	printf("   -n               only report the pages that would be written\n");
+	printf("Example:\n");
+	printf("\teeprom-write -b 11 config.bin\n");
+	printf("\teeprom-write -b 11 -o 0x800 -V config.bin\n\n");
+}
+
+static int load_file(const char *path, uint8_t *buf, unsigned int max,
+		     unsigned int *len)
+{
+	FILE *fp = fopen(path, "rb");
+	size_t n;
+
+	if (!fp) {
+		perror(path);
+		return -errno;
+	}
+	n = fread(buf, 1, max, fp);
+	if (!feof(fp) && fgetc(fp) != EOF) {
+		fprintf(stderr, "error: %s doesn't fit in %u bytes\n", path, max);
+		fclose(fp);
+		return -EFBIG;
+	}
+	fclose(fp);
+
+	*len = n;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct eeprom e;
+	int bus = -1, addr = DEFAULT_ADDR, addr8 = 0, verify = 0, dry = 0;
+	unsigned int size = DEFAULT_SIZE, page = EEPROM_PAGE_24C32;
+	unsigned int off = 0, delay_us = 0, len, p, n;
+	unsigned long written = 0, skipped = 0;
+	uint8_t *data = NULL, *cur = NULL;
+	uint64_t t0, t;
+	int ret = 1;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"b", required_argument, 0, 0},
+			{"a", required_argument, 0, 1},
+			{"s", required_argument, 0, 2},
+			{"P", required_argument, 0, 3},
+			{"o", required_argument, 0, 4},
+			{"8", no_argument, 0, 5},
+			{"D", required_argument, 0, 6},
+			{"V", no_argument, 0, 7},
+			{"n", no_argument, 0, 8},
+			{"help", no_argument, 0, 9},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "b:a:s:P:o:8D:Vnh",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'b':
+			bus = atoi(optarg);
+			break;
+		case 1:
+		case 'a':
+			addr = strtol(optarg, NULL, 0);
+			break;
+		case 2:
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 3:
+		case 'P':
+			page = strtoul(optarg, NULL, 0);
+			break;
+		case 4:
+		case 'o':
+			off = strtoul(optarg, NULL, 0);
+			break;
+		case 5:
+		case '8':
+			addr8 = 1;
+			break;
+		case 6:
+		case 'D':
+			delay_us = atoi(optarg);
+			break;
+		case 7:
+		case 'V':
+			verify = 1;
+			break;
+		case 8:
+		case 'n':
+			dry = 1;
+			break;
+		case 9:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (bus < 0 || optind != argc - 1 || !size || off >= size) {
+		usage();
+		return 1;
+	}
+	/* pages are powers of two and one I2C_RDWR message at most */
+	if (!page || (page & (page - 1)) || page > 8192 || size % page) {
+		printf("error: bad page size %u\n", page);
+		return 1;
+	}
+
+	data = malloc(size);
+	cur = malloc(size);
+	if (!data || !cur) {
+		perror("malloc");
+		goto out_free;
+	}
+	if (load_file(argv[optind], data, size - off, &len))
+		goto out_free;
+	if (!len) {
+		printf("nothing to write\n");
+		ret = 0;
+		goto out_free;
+	}
+
+	if (eeprom_open(&e, bus, addr, size, page, addr8))
+		goto out_free;
+
+	t0 = i2c_now();
+	ret = eeprom_read(&e, off, cur, len);
+	if (ret) {
+		fprintf(stderr, "error: reading %u bytes at %#x: %s\n", len, off,
+			strerror(-ret));
+		goto out;
+	}
+
+	/* p walks the data, n is the part of it in the current page */
+	for (p = 0; p < len; p += n) {
+		n = page - (off + p) % page;
+		if (n > len - p)
+			n = len - p;
+
+		if (!memcmp(data + p, cur + p, n)) {
+			skipped++;
+			continue;
+		}
+		written++;
+		if (dry) {
+			printf("page %#x: %u bytes differ\n", off + p, n);
+			continue;
+		}
+
+		ret = eeprom_write(&e, off + p, data + p, n, delay_us);
+		if (ret) {
+			fprintf(stderr, "error: writing %u bytes at %#x: %s\n", n,
+				off + p, strerror(-ret));
+			goto out;
+		}
+	}
+
+	if (verify && !dry) {
+		ret = eeprom_read(&e, off, cur, len);
+		if (!ret && memcmp(data, cur, len))
+			ret = -EIO;
+		if (ret) {
+			fprintf(stderr, "error: verify failed: %s\n", strerror(-ret));
+			goto out;
+		}
+	}
+	t = i2c_now() - t0;
+
+	printf("%u bytes at %#x: %lu pages written, %lu skipped, %.1f ms%s\n",
+	       len, off, written, skipped, t / 1e6, verify ? ", verified" : "");
+	if (e.cycles)
+		printf("write cycle: mean %.1f us, max %.1f us, %s\n",
+		       e.wait_ns / 1e3 / e.cycles, e.wait_max / 1e3,
+		       delay_us ? "fixed delay" : "ack polling");
+	if (e.polls)
+		printf("ack polls: %lu, %.1f per cycle\n", e.polls,
+		       (double)e.polls / e.cycles);
+	ret = 0;
+
+out:
+	eeprom_close(&e);
+out_free:
+	free(data);
+	free(cur);
+	return ret ? 1 : 0;
+}
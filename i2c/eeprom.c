@@ -0,0 +1,249 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Raw I2C EEPROM access, shared by the eeprom tools
+ *
+ * Uses combined I2C_RDWR transfers when the adapter can do plain I2C,
+ * SMBus transfers otherwise. Writes never cross a page and return once
+ * the write cycle is over: the device doesn't acknowledge its address
+ * while it is busy, so it is polled until it does (or, for comparison,
+ * a fixed delay is slept instead).
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "eeprom.h"
+
+#define RDWR_MAX	8192	/* kernel limit of one I2C_RDWR message */
+
+static int rdwr(struct eeprom *e, struct i2c_msg *msgs, int n)
+{
+	struct i2c_rdwr_ioctl_data args = { .msgs = msgs, .nmsgs = n };
+	int ret;
+
+	ret = ioctl(e->fd, I2C_RDWR, &args);
+	return ret == n ? 0 : ret < 0 ? -errno : -EIO;
+}
+
+/* the address bytes of off, returns their count */
+static int addr_bytes(struct eeprom *e, unsigned int off, uint8_t *a)
+{
+	if (e->addr8) {
+		a[0] = off;
+		return 1;
+	}
+	a[0] = off >> 8;
+	a[1] = off;
+	return 2;
+}
+
+int eeprom_open(struct eeprom *e, int bus, int addr, unsigned int size,
+		unsigned int page, int addr8)
+{
+	char dev[64];
+
+	memset(e, 0, sizeof(*e));
+	e->addr = addr;
+	e->addr8 = addr8;
+	e->size = size;
+	e->page = page;
+
+	snprintf(dev, sizeof(dev), "/dev/i2c-%d", bus);
+	e->fd = open(dev, O_RDWR);
+	if (e->fd < 0) {
+		perror(dev);
+		return -errno;
+	}
+	if (ioctl(e->fd, I2C_FUNCS, &e->funcs))
+		e->funcs = 0;
+
+	/* at24 may own the address, the tools work beside it */
+	if (ioctl(e->fd, I2C_SLAVE, addr) && (errno != EBUSY ||
+	    ioctl(e->fd, I2C_SLAVE_FORCE, addr))) {
+		perror("I2C_SLAVE");
+		close(e->fd);
+		return -errno;
+	}
+
+	return 0;
+}
+
+void eeprom_close(struct eeprom *e)
+{
+	close(e->fd);
+}
+
+static int read_smbus(struct eeprom *e, unsigned int off, uint8_t *buf,
+		      unsigned int len)
+{
+	union i2c_smbus_data data;
+	unsigned int i, n;
+	int ret = 0;
+
+	if (e->addr8 && (e->funcs & I2C_FUNC_SMBUS_READ_I2C_BLOCK)) {
+		for (i = 0; i < len && !ret; i += n) {
+			n = len - i < I2C_SMBUS_BLOCK_MAX ? len - i :
+			    I2C_SMBUS_BLOCK_MAX;
+			data.block[0] = n;
+			ret = i2c_smbus(e->fd, I2C_SMBUS_READ, off + i,
+					I2C_SMBUS_I2C_BLOCK_DATA, &data);
+			if (!ret && data.block[0] != n)
+				ret = -EIO;
+			memcpy(buf + i, data.block + 1, n);
+		}
+		return ret;
+	}
+
+	/* set the address pointer, then read sequentially */
+	if (e->addr8) {
+		ret = i2c_smbus(e->fd, I2C_SMBUS_WRITE, off, I2C_SMBUS_BYTE,
+				NULL);
+	} else {
+		data.byte = off & 0xff;
+		ret = i2c_smbus(e->fd, I2C_SMBUS_WRITE, off >> 8,
+				I2C_SMBUS_BYTE_DATA, &data);
+	}
+	for (i = 0; i < len && !ret; i++) {
+		ret = i2c_smbus(e->fd, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data);
+		buf[i] = data.byte;
+	}
+
+	return ret;
+}
+
+int eeprom_read(struct eeprom *e, unsigned int off, void *buf,
+		unsigned int len)
+{
+	unsigned int i, n;
+	int ret = 0;
+
+	if (off + len > e->size)
+		return -EINVAL;
+	if (!(e->funcs & I2C_FUNC_I2C))
+		return read_smbus(e, off, buf, len);
+
+	for (i = 0; i < len && !ret; i += n) {
+		uint8_t a[2];
+		struct i2c_msg msgs[2] = {
+			{ .addr = e->addr, .len = addr_bytes(e, off + i, a),
+			  .buf = a },
+			{ .addr = e->addr, .flags = I2C_M_RD,
+			  .buf = (uint8_t *)buf + i },
+		};
+
+		n = len - i < RDWR_MAX ? len - i : RDWR_MAX;
+		msgs[1].len = n;
+		ret = rdwr(e, msgs, 2);
+	}
+
+	return ret;
+}
+
+/* anything the device acknowledges without side effects */
+static int probe(struct eeprom *e)
+{
+	union i2c_smbus_data data;
+
+	if (e->funcs & I2C_FUNC_SMBUS_QUICK)
+		return i2c_smbus(e->fd, I2C_SMBUS_WRITE, 0, I2C_SMBUS_QUICK,
+				 NULL);
+	if (e->funcs & I2C_FUNC_I2C) {
+		struct i2c_msg msg = { .addr = e->addr, .len = 0, .buf = NULL };
+
+		return rdwr(e, &msg, 1);
+	}
+	return i2c_smbus(e->fd, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data);
+}
+
+/* wait for the end of the write cycle started at t0 */
+static int wait_cycle(struct eeprom *e, uint64_t t0, unsigned int delay_us)
+{
+	uint64_t end = t0 + EEPROM_POLL_TIMEOUT_US * 1000ull, t;
+	int ret;
+
+	if (delay_us) {
+		usleep(delay_us);
+		ret = 0;
+	} else {
+		do {
+			e->polls++;
+			ret = probe(e);
+			t = i2c_now();
+		} while (ret && t < end);
+	}
+
+	t = i2c_now() - t0;
+	e->cycles++;
+	e->wait_ns += t;
+	if (t > e->wait_max)
+		e->wait_max = t;
+
+	return ret ? -ETIMEDOUT : 0;
+}
+
+/* one write transfer of at most a page and its write cycle */
+static int write_xfer(struct eeprom *e, unsigned int off, const uint8_t *buf,
+		      unsigned int len, unsigned int delay_us)
+{
+	union i2c_smbus_data data;
+	uint8_t tmp[2 + RDWR_MAX];
+	int n, ret;
+
+	if (e->funcs & I2C_FUNC_I2C) {
+		struct i2c_msg msg = { .addr = e->addr, .buf = tmp };
+
+		n = addr_bytes(e, off, tmp);
+		memcpy(tmp + n, buf, len);
+		msg.len = n + len;
+		ret = rdwr(e, &msg, 1);
+	} else if (e->addr8) {
+		data.block[0] = len;
+		memcpy(data.block + 1, buf, len);
+		ret = i2c_smbus(e->fd, I2C_SMBUS_WRITE, off,
+				I2C_SMBUS_I2C_BLOCK_DATA, &data);
+	} else {
+		/* the low address byte travels in the block */
+		data.block[0] = len + 1;
+		data.block[1] = off & 0xff;
+		memcpy(data.block + 2, buf, len);
+		ret = i2c_smbus(e->fd, I2C_SMBUS_WRITE, off >> 8,
+				I2C_SMBUS_I2C_BLOCK_DATA, &data);
+	}
+	if (ret)
+		return ret;
+
+	return wait_cycle(e, i2c_now(), delay_us);
+}
+
+/*
+ * Writes within the page of off. SMBus block writes carry at most 32
+ * bytes including the second address byte, so a page may take two.
+ */
+int eeprom_write(struct eeprom *e, unsigned int off, const void *buf,
+		 unsigned int len, unsigned int delay_us)
+{
+	unsigned int max = e->page, i, n;
+	int ret = 0;
+
+	if (off + len > e->size || off / e->page != (off + len - 1) / e->page)
+		return -EINVAL;
+
+	if (!(e->funcs & I2C_FUNC_I2C)) {
+		if (!(e->funcs & I2C_FUNC_SMBUS_WRITE_I2C_BLOCK))
+			return -EOPNOTSUPP;
+		max = I2C_SMBUS_BLOCK_MAX - !e->addr8;
+	}
+
+	for (i = 0; i < len && !ret; i += n) {
+		n = len - i < max ? len - i : max;
+		ret = write_xfer(e, off + i, (const uint8_t *)buf + i, n,
+				 delay_us);
+	}
+
+	return ret;
+}
@@ -0,0 +1,34 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Raw I2C EEPROM access, shared by the eeprom tools
+ */
+#ifndef _EEPROM_H_
+#define _EEPROM_H_
+
+#include <stdint.h>
+
+#include "i2c-util.h"
+
+#define EEPROM_PAGE_24C32		32
+/* at24 gives a write cycle this long before it fails the write */
+#define EEPROM_POLL_TIMEOUT_US	25000
+
+struct eeprom {
+	int fd;
+	int addr, addr8;
+	unsigned int size, page;
+	unsigned long funcs;
+	/* write cycle completion */
+	unsigned long cycles, polls;
+	uint64_t wait_ns, wait_max;
+};
+
+int eeprom_open(struct eeprom *e, int bus, int addr, unsigned int size,
+		unsigned int page, int addr8);
+void eeprom_close(struct eeprom *e);
+int eeprom_read(struct eeprom *e, unsigned int off, void *buf,
+		unsigned int len);
+int eeprom_write(struct eeprom *e, unsigned int off, const void *buf,
+		 unsigned int len, unsigned int delay_us);
+
+#endif /* _EEPROM_H_ */
@@ -0,0 +1,426 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * I2C adapter transaction latency
+ *
+ * Issues one transaction type at a time in a tight loop against one
+ * address and reports transfers per second, latency percentiles and a
+ * histogram per type:
+ *
+ *   quick         SMBus quick write
+ *   byte          SMBus receive byte
+ *   byte-data     SMBus read byte data
+ *   word-data     SMBus read word data
+ *   block         SMBus block read (length from the device)
+ *   i2c-block/N   SMBus I2C block read of N bytes
+ *   rdwr/N        I2C_RDWR, one read message of N bytes
+ *   rdwr/MxN      I2C_RDWR, M read messages of N bytes
+ *
+ * Only reads are issued (and the quick write, which carries no data).
+ * Least squares fits over the sized types split the cost into a fixed
+ * part per transfer and a part per byte or per message.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c-util.h"
+
+#define DEFAULT_ADDR	0x50
+#define DEFAULT_MS		200
+#define DEFAULT_MSGS	8
+#define DEFAULT_LEN		256
+#define MAX_XFERS		(1 << 20)
+#define LAT_BUCKETS		20	/* < 1 us, then powers of two */
+
+enum { T_QUICK, T_BYTE, T_BYTE_DATA, T_WORD_DATA, T_BLOCK, T_I2C_BLOCK,
+	   T_RDWR };
+
+struct test {
+	char name[24];
+	int type;
+	unsigned int len, msgs;
+	/* results */
+	unsigned long n;
+	double secs;
+	struct i2c_lat st;
+	unsigned long hist[LAT_BUCKETS];
+	int err;
+};
+
+static int fd, addr;
+static uint8_t cmd;
+static uint8_t rbuf[I2C_RDWR_IOCTL_MAX_MSGS][8192];
+static uint32_t *lat;
+
+static int xfer(struct test *t)
+{
+	union i2c_smbus_data data;
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct i2c_rdwr_ioctl_data args = { .msgs = msgs, .nmsgs = t->msgs };
+	unsigned int i;
+	int ret;
+
+	switch (t->type) {
+	case T_QUICK:
+		return i2c_smbus(fd, I2C_SMBUS_WRITE, cmd, I2C_SMBUS_QUICK,
+				 NULL);
+	case T_BYTE:
+		return i2c_smbus(fd, I2C_SMBUS_READ, cmd, I2C_SMBUS_BYTE,
+				 &data);
+	case T_BYTE_DATA:
+		return i2c_smbus(fd, I2C_SMBUS_READ, cmd, I2C_SMBUS_BYTE_DATA,
+				 &data);
+	case T_WORD_DATA:
+		return i2c_smbus(fd, I2C_SMBUS_READ, cmd, I2C_SMBUS_WORD_DATA,
+				 &data);
+	case T_BLOCK:
+		return i2c_smbus(fd, I2C_SMBUS_READ, cmd, I2C_SMBUS_BLOCK_DATA,
+				 &data);
+	case T_I2C_BLOCK:
+		data.block[0] = t->len;
+		return i2c_smbus(fd, I2C_SMBUS_READ, cmd,
+				 I2C_SMBUS_I2C_BLOCK_DATA, &data);
+	case T_RDWR:
+		for (i = 0; i < t->msgs; i++) {
+			msgs[i].addr = addr;
+			msgs[i].flags = I2C_M_RD;
+			msgs[i].len = t->len;
+			msgs[i].buf = rbuf[i];
+		}
+		ret = ioctl(fd, I2C_RDWR, &args);
+		return ret == t->msgs ? 0 : ret < 0 ? -errno : -EIO;
+	}
+
+	return -EINVAL;
+}
+
+static int lat_bucket(uint32_t ns)
+{
+	int b = 0;
+
+	for (ns /= 1000; ns && b < LAT_BUCKETS - 1; ns >>= 1)
+		b++;
+	return b;
+}
+
+static void run(struct test *t, unsigned int ms)
+{
+	uint64_t t0, t1, end;
+	unsigned long i;
+	int ret;
+
+	t0 = i2c_now();
+	end = t0 + ms * 1000000ull;
+	for (t->n = 0, t1 = t0; t->n < MAX_XFERS && t1 < end; t->n++) {
+		uint64_t s = t1;
+
+		ret = xfer(t);
+		if (ret) {
+			t->err = -ret;
+			return;
+		}
+		t1 = i2c_now();
+		lat[t->n] = t1 - s;
+	}
+	t->secs = (t1 - t0) / 1e9;
+
+	i2c_lat_stats(lat, t->n, &t->st);
+	for (i = 0; i < t->n; i++)
+		t->hist[lat_bucket(lat[i])]++;
+}
+
+static void print_hist(struct test *t)
+{
+	unsigned long max = 0;
+	int b, lo = LAT_BUCKETS, hi = 0;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		if (!t->hist[b])
+			continue;
+		if (b < lo)
+			lo = b;
+		hi = b;
+		if (t->hist[b] > max)
+			max = t->hist[b];
+	}
+
+	printf("\n%s\n", t->name);
+	for (b = lo; b <= hi; b++) {
+		char range[48];
+		int bar = t->hist[b] * 40 / max;
+
+		if (!b)
+			snprintf(range, sizeof(range), "< 1");
+		else
+			snprintf(range, sizeof(range), "%lu..%lu", 1ul << (b - 1),
+				 1ul << b);
+		printf("  %-14s %9lu %.*s\n", range, t->hist[b], bar,
+		       "########################################");
+	}
+}
+
+/* mean latency against x over the tests of one kind */
+static void fit(const char *what, const char *unit, struct test *tests,
+		int n, int type, int by_msgs, int fixed_msgs)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, d, a, b;
+	int i, k = 0;
+
+	for (i = 0; i < n; i++) {
+		struct test *t = &tests[i];
+		double x;
+
+		if (t->type != type || !t->n ||
+		    (by_msgs ? t->len != 1 : t->msgs != fixed_msgs))
+			continue;
+		x = by_msgs ? t->msgs : t->len;
+		sx += x;
+		sy += t->st.mean;
+		sxx += x * x;
+		sxy += x * t->st.mean;
+		k++;
+	}
+
+	d = k * sxx - sx * sx;
+	if (k < 2 || d == 0)
+		return;
+	b = (k * sxy - sx * sy) / d;
+	a = (sy - b * sx) / k;
+	printf("%-12s %9.2f us fixed + %7.3f us per %s (%d points)\n", what,
+	       a, b, unit, k);
+}
+
+static void usage(void)
+{
+	printf("\nUsage: i2c-bench [OPTION]...\n\n");
+	printf("   -b bus           i2c bus number\n");
+	printf("   -a addr          target address (default %#x)\n",
+	       DEFAULT_ADDR);
+	printf("   -c cmd           command/register byte (default 0)\n");
+	printf("   -t ms            time per transaction type (default %d)\n",
+	       DEFAULT_MS);
+	printf("   -L bytes         largest I2C_RDWR read (default %d)\n",
+	       DEFAULT_LEN);
+	printf("   -M msgs          most I2C_RDWR messages (default %d)\n",
+	       DEFAULT_MSGS);
+	printf("   -T types         comma separated subset of quick,byte,\n");
+	printf("                    byte-data,word-data,block,i2c-block,rdwr\n");
+	printf("   -q               no histograms\n");
+	printf("Example:\n");
+	printf("\ti2c-bench -b 11 -a 0x50\n");
+	printf("\tmodprobe i2c-stub chip_addr=0x50; i2c-bench -b <stub bus> -T byte,i2c-block\n\n");
+}
+
+static int selected(const char *sel, const char *name)
+{
+	size_t n = strlen(name);
+
+	while (sel) {
+		if (!strncmp(sel, name, n) && (!sel[n] || sel[n] == ','))
+			return 1;
+		sel = strchr(sel, ',');
+		if (sel)
+			sel++;
+	}
+	return 0;
+}
+
+static int add(struct test *tests, int n, int type, const char *name,
+	       unsigned int len, unsigned int msgs)
+{
+	struct test *t = &tests[n];
+
+	memset(t, 0, sizeof(*t));
+	t->type = type;
+	t->len = len;
+	t->msgs = msgs;
+	if (type == T_I2C_BLOCK || (type == T_RDWR && msgs == 1))
+		snprintf(t->name, sizeof(t->name), "%s/%u", name, len);
+	else if (type == T_RDWR)
+		snprintf(t->name, sizeof(t->name), "%s/%ux%u", name, msgs, len);
+	else
+		snprintf(t->name, sizeof(t->name), "%s", name);
+
+	return n + 1;
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		int type;
+		unsigned long funcs;
+	} types[] = {
+		{ "quick", T_QUICK, I2C_FUNC_SMBUS_QUICK },
+		{ "byte", T_BYTE, I2C_FUNC_SMBUS_READ_BYTE },
+		{ "byte-data", T_BYTE_DATA, I2C_FUNC_SMBUS_READ_BYTE_DATA },
+		{ "word-data", T_WORD_DATA, I2C_FUNC_SMBUS_READ_WORD_DATA },
+		{ "block", T_BLOCK, I2C_FUNC_SMBUS_READ_BLOCK_DATA },
+		{ "i2c-block", T_I2C_BLOCK, I2C_FUNC_SMBUS_READ_I2C_BLOCK },
+		{ "rdwr", T_RDWR, I2C_FUNC_I2C },
+	};
+	struct test tests[64];
+	unsigned int ms = DEFAULT_MS, max_len = DEFAULT_LEN;
+	unsigned int max_msgs = DEFAULT_MSGS, len, m;
+	unsigned long funcs = 0;
+	char *sel = NULL, dev[64];
+	int bus = -1, quiet = 0, n = 0, i;
+
+	addr = DEFAULT_ADDR;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"b", required_argument, 0, 0},
+			{"a", required_argument, 0, 1},
+			{"c", required_argument, 0, 2},
+			{"t", required_argument, 0, 3},
+			{"L", required_argument, 0, 4},
+			{"M", required_argument, 0, 5},
+			{"T", required_argument, 0, 6},
+			{"q", no_argument, 0, 7},
+			{"help", no_argument, 0, 8},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "b:a:c:t:L:M:T:qh",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'b':
+			bus = atoi(optarg);
+			break;
+		case 1:
+		case 'a':
+			addr = strtol(optarg, NULL, 0);
+			break;
+		case 2:
+		case 'c':
+			cmd = strtol(optarg, NULL, 0);
+			break;
+		case 3:
+		case 't':
+			ms = atoi(optarg);
+			break;
+		case 4:
+		case 'L':
+			max_len = atoi(optarg);
+			break;
+		case 5:
+		case 'M':
+			max_msgs = atoi(optarg);
+			break;
+		case 6:
+		case 'T':
+			sel = optarg;
+			break;
+		case 7:
+		case 'q':
+			quiet = 1;
+			break;
+		case 8:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (bus < 0 || !ms || !max_len || max_len > sizeof(rbuf[0]) ||
+	    !max_msgs || max_msgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+		usage();
+		return 1;
+	}
+
+	snprintf(dev, sizeof(dev), "/dev/i2c-%d", bus);
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(fd, I2C_FUNCS, &funcs))
+		perror("I2C_FUNCS");
+	if (ioctl(fd, I2C_SLAVE, addr) && (errno != EBUSY ||
+	    ioctl(fd, I2C_SLAVE_FORCE, addr))) {
+		perror("I2C_SLAVE");
+		return 1;
+	}
+
+	lat = malloc(MAX_XFERS * sizeof(*lat));
+	if (!lat) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%s address %#x, command %#x, %u ms per type\n", dev, addr, cmd,
+	       ms);
+	printf("\n%-14s %10s %9s %9s %9s %9s\n", "type", "xfers/s",
+	       "mean[us]", "p50[us]", "p99[us]", "max[us]");
+
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		int first = n, j;
+
+		if (sel && !selected(sel, types[i].name))
+			continue;
+		if ((funcs & types[i].funcs) != types[i].funcs) {
+			printf("%-14s not supported by the adapter\n",
+			       types[i].name);
+			continue;
+		}
+
+		if (types[i].type == T_I2C_BLOCK) {
+			for (len = 1; len <= I2C_SMBUS_BLOCK_MAX; len *= 2)
+				n = add(tests, n, T_I2C_BLOCK, types[i].name, len, 1);
+		} else if (types[i].type == T_RDWR) {
+			for (len = 1; len <= max_len; len *= 2)
+				n = add(tests, n, T_RDWR, types[i].name, len, 1);
+			for (m = 2; m <= max_msgs; m *= 2)
+				n = add(tests, n, T_RDWR, types[i].name, 1, m);
+		} else {
+			n = add(tests, n, types[i].type, types[i].name, 0, 1);
+		}
+
+		for (j = first; j < n; j++) {
+			struct test *t = &tests[j];
+
+			run(t, ms);
+			if (t->err) {
+				printf("%-14s failed: %s\n", t->name, strerror(t->err));
+				t->n = 0;
+				continue;
+			}
+			printf("%-14s %10.0f %9.1f %9.1f %9.1f %9.1f\n", t->name,
+			       t->n / t->secs, t->st.mean, t->st.p50, t->st.p99,
+			       t->st.max);
+		}
+	}
+
+	printf("\n");
+	fit("i2c-block", "byte", tests, n, T_I2C_BLOCK, 0, 1);
+	fit("rdwr", "byte", tests, n, T_RDWR, 0, 1);
+	fit("rdwr msgs", "message", tests, n, T_RDWR, 1, 0);
+
+	if (!quiet) {
+		printf("\nlatency histograms [us]\n");
+		for (i = 0; i < n; i++)
+			if (tests[i].n)
+				print_hist(&tests[i]);
+	}
+
+	free(lat);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,499 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * I2C bus contention and fairness between concurrent clients
+ *
+ * Forks N client processes, each with its own /dev/i2c-N file and its
+ * own transaction mix, starts them at the same moment and lets them
+ * hammer the same adapter. Each client first runs alone for a moment,
+ * so its contended latency can be set against what it sees on an idle
+ * bus. Reported per client: operations and bytes per second, latency
+ * percentiles, the slowdown against the solo run; for the whole run the
+ * total rate and Jain's fairness index (1: all clients get the same
+ * rate, 1/N: one client gets everything).
+ *
+ * A mix is a comma separated list of type[/len][:weight] items, picked
+ * at random by weight:
+ *
+ *   quick, byte, byte-data, word-data, i2c-block/N, rdwr/N
+ *
+ * -B k batches k rdwr operations of a client into one I2C_RDWR call
+ * with k messages, one adapter lock instead of k. Only reads and the
+ * data-less quick write are issued. Failed calls are counted apart,
+ * they add no bytes and no latency.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c-util.h"
+
+#define DEFAULT_ADDR	0x50
+#define DEFAULT_SECS	5
+#define DEFAULT_SOLO_MS	1000
+#define DEFAULT_MIX		"byte:4,i2c-block/32:1"
+#define MAX_CLIENTS		64
+#define MAX_ITEMS		16
+#define MAX_LAT			(1 << 20)
+#define MAX_LEN			8192
+
+enum { T_QUICK, T_BYTE, T_BYTE_DATA, T_WORD_DATA, T_I2C_BLOCK, T_RDWR,
+	   T_COUNT };
+
+static const char *const type_name[T_COUNT] = {
+	"quick", "byte", "byte-data", "word-data", "i2c-block", "rdwr",
+};
+
+struct item {
+	int type;
+	unsigned int len, weight;
+};
+
+struct mix {
+	const char *spec;
+	struct item items[MAX_ITEMS];
+	int n;
+	unsigned int weights;
+};
+
+struct stats {
+	unsigned long ops, calls, bytes, errors;
+	int first_err;
+	double secs;
+	struct i2c_lat lat;
+};
+
+/* written by the clients, read by the parent */
+struct client_res {
+	struct stats solo, run;
+};
+
+struct client {
+	int fd;
+	const struct mix *mix;
+	uint64_t rnd;
+	uint32_t *lat;
+	size_t nlat;
+	uint8_t *buf;
+};
+
+static int bus, addr, batch = 1;
+static unsigned int gap_us;
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static uint64_t rnd(struct client *c)
+{
+	c->rnd ^= c->rnd << 13;
+	c->rnd ^= c->rnd >> 7;
+	c->rnd ^= c->rnd << 17;
+	return c->rnd;
+}
+
+static int mix_parse(const char *spec, struct mix *m)
+{
+	char *s = strdup(spec), *p, *save = s;
+	int t;
+
+	memset(m, 0, sizeof(*m));
+	m->spec = spec;
+	while (s && (p = strsep(&s, ","))) {
+		struct item *it = &m->items[m->n];
+		char *w = strchr(p, ':'), *l = strchr(p, '/');
+
+		if (m->n == MAX_ITEMS)
+			goto err;
+		it->weight = w ? atoi(w + 1) : 1;
+		if (w)
+			*w = 0;
+		it->len = l ? atoi(l + 1) : 0;
+		if (l)
+			*l = 0;
+
+		for (t = 0; t < T_COUNT; t++)
+			if (!strcmp(p, type_name[t]))
+				break;
+		if (t == T_COUNT || !it->weight)
+			goto err;
+		if ((t == T_I2C_BLOCK && (!it->len || it->len > I2C_SMBUS_BLOCK_MAX))
+		    || (t == T_RDWR && (!it->len || it->len > MAX_LEN)))
+			goto err;
+
+		it->type = t;
+		m->weights += it->weight;
+		m->n++;
+	}
+
+	free(save);
+	return m->n ? 0 : -EINVAL;
+
+err:
+	fprintf(stderr, "bad mix: %s\n", spec);
+	free(save);
+	return -EINVAL;
+}
+
+/*
+ * One call, returns the operations it carried or -errno. Only a call
+ * that went through adds its bytes.
+ */
+static int op(struct client *c, const struct item *it, unsigned long *bytes)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct i2c_rdwr_ioctl_data args = { .msgs = msgs, .nmsgs = batch };
+	union i2c_smbus_data data;
+	unsigned int len = 0;
+	int i, ret = 0;
+
+	switch (it->type) {
+	case T_QUICK:
+		ret = i2c_smbus(c->fd, I2C_SMBUS_WRITE, 0, I2C_SMBUS_QUICK,
+				NULL);
+		break;
+	case T_BYTE:
+		ret = i2c_smbus(c->fd, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE,
+				&data);
+		len = 1;
+		break;
+	case T_BYTE_DATA:
+		ret = i2c_smbus(c->fd, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE_DATA,
+				&data);
+		len = 1;
+		break;
+	case T_WORD_DATA:
+		ret = i2c_smbus(c->fd, I2C_SMBUS_READ, 0, I2C_SMBUS_WORD_DATA,
+				&data);
+		len = 2;
+		break;
+	case T_I2C_BLOCK:
+		data.block[0] = it->len;
+		ret = i2c_smbus(c->fd, I2C_SMBUS_READ, 0,
+				I2C_SMBUS_I2C_BLOCK_DATA, &data);
+		len = it->len;
+		break;
+	case T_RDWR:
+		for (i = 0; i < batch; i++) {
+			msgs[i].addr = addr;
+			msgs[i].flags = I2C_M_RD;
+			msgs[i].len = it->len;
+			msgs[i].buf = c->buf + i * it->len;
+		}
+		if (ioctl(c->fd, I2C_RDWR, &args) != batch)
+			return -errno;
+		*bytes += batch * it->len;
+		return batch;
+	}
+
+	if (ret)
+		return ret;
+	*bytes += len;
+	return 1;
+}
+
+static const struct item *pick(struct client *c)
+{
+	const struct mix *m = c->mix;
+	unsigned int w = rnd(c) % m->weights;
+	int i;
+
+	for (i = 0; w >= m->items[i].weight; i++)
+		w -= m->items[i].weight;
+	return &m->items[i];
+}
+
+static void run(struct client *c, uint64_t start, uint64_t end,
+		struct stats *st)
+{
+	uint64_t t, t1 = start;
+	int ret;
+
+	memset(st, 0, sizeof(*st));
+	c->nlat = 0;
+	sleep_until(start);
+
+	while (t1 < end) {
+		const struct item *it = pick(c);
+
+		t = i2c_now();
+		ret = op(c, it, &st->bytes);
+		t1 = i2c_now();
+
+		st->calls++;
+		if (ret < 0) {
+			/* counted apart, not part of the latencies */
+			if (!st->errors++)
+				st->first_err = -ret;
+		} else {
+			st->ops += ret;
+			if (c->nlat < MAX_LAT)
+				c->lat[c->nlat++] = t1 - t > UINT32_MAX ?
+						    UINT32_MAX : t1 - t;
+		}
+		if (gap_us)
+			sleep_until(t1 + gap_us * 1000ull);
+	}
+	st->secs = (t1 - start) / 1e9;
+
+	i2c_lat_stats(c->lat, c->nlat, &st->lat);
+}
+
+static void client(int id, const struct mix *mix, uint64_t solo_start,
+		   uint64_t solo_ms, uint64_t start, uint64_t secs,
+		   struct client_res *res)
+{
+	struct client c = { .mix = mix, .rnd = 88172645463325252ull + id };
+	char dev[64];
+
+	snprintf(dev, sizeof(dev), "/dev/i2c-%d", bus);
+	c.fd = open(dev, O_RDWR);
+	c.lat = malloc(MAX_LAT * sizeof(*c.lat));
+	c.buf = malloc(I2C_RDWR_IOCTL_MAX_MSGS * MAX_LEN);
+	if (c.fd < 0 || !c.lat || !c.buf)
+		_exit(1);
+	/* no page faults inside the measured loop */
+	memset(c.lat, 0, MAX_LAT * sizeof(*c.lat));
+	memset(c.buf, 0, I2C_RDWR_IOCTL_MAX_MSGS * MAX_LEN);
+	if (ioctl(c.fd, I2C_SLAVE, addr) && (errno != EBUSY ||
+	    ioctl(c.fd, I2C_SLAVE_FORCE, addr)))
+		_exit(1);
+
+	/* the solo runs take turns, the contended run starts together */
+	if (solo_ms)
+		run(&c, solo_start, solo_start + solo_ms * 1000000ull,
+		    &res->solo);
+	run(&c, start, start + secs * 1000000000ull, &res->run);
+
+	_exit(0);
+}
+
+static double jain(double *x, int n)
+{
+	double s = 0, ss = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		s += x[i];
+		ss += x[i] * x[i];
+	}
+	return ss ? s * s / (n * ss) : 0;
+}
+
+static void usage(void)
+{
+	printf("\nUsage: i2c-contend [OPTION]...\n\n");
+	printf("   -b bus           i2c bus number\n");
+	printf("   -a addr          target address (default %#x)\n",
+	       DEFAULT_ADDR);
+	printf("   -n clients       concurrent clients (default: one per -m)\n");
+	printf("   -m mix           transaction mix of the next client, the\n");
+	printf("                    mixes are reused when there are more\n");
+	printf("                    clients (default %s)\n", DEFAULT_MIX);
+	printf("   -t secs          contended run time (default %d)\n",
+	       DEFAULT_SECS);
+	printf("   -s ms            solo run per client, 0: none (default %d)\n",
+	       DEFAULT_SOLO_MS);
+	printf("   -B k             batch k rdwr operations per I2C_RDWR call\n");
+	printf("   -g us            pause between the calls of a client\n");
+	printf("Mix items: quick, byte, byte-data, word-data, i2c-block/N, rdwr/N,\n");
+	printf("each optionally weighted with :W\n");
+	printf("Example:\n");
+	printf("\ti2c-contend -b 11 -n 4\n");
+	printf("\ti2c-contend -b 11 -m rdwr/32:1 -m byte:1 -m word-data -B 8\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct mix mixes[MAX_CLIENTS];
+	double ops[MAX_CLIENTS], bps[MAX_CLIENTS];
+	struct client_res *res;
+	unsigned int secs = DEFAULT_SECS, solo_ms = DEFAULT_SOLO_MS;
+	unsigned long funcs = 0;
+	int nmix = 0, n = 0, i, fd, failed = 0;
+	uint64_t solo_start, start;
+	double tot_ops = 0, tot_bytes = 0;
+	char dev[64];
+
+	bus = -1;
+	addr = DEFAULT_ADDR;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"b", required_argument, 0, 0},
+			{"a", required_argument, 0, 1},
+			{"n", required_argument, 0, 2},
+			{"m", required_argument, 0, 3},
+			{"t", required_argument, 0, 4},
+			{"s", required_argument, 0, 5},
+			{"B", required_argument, 0, 6},
+			{"g", required_argument, 0, 7},
+			{"help", no_argument, 0, 8},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "b:a:n:m:t:s:B:g:h",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'b':
+			bus = atoi(optarg);
+			break;
+		case 1:
+		case 'a':
+			addr = strtol(optarg, NULL, 0);
+			break;
+		case 2:
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 3:
+		case 'm':
+			if (nmix == MAX_CLIENTS || mix_parse(optarg, &mixes[nmix]))
+				return 1;
+			nmix++;
+			break;
+		case 4:
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 5:
+		case 's':
+			solo_ms = atoi(optarg);
+			break;
+		case 6:
+		case 'B':
+			batch = atoi(optarg);
+			break;
+		case 7:
+		case 'g':
+			gap_us = atoi(optarg);
+			break;
+		case 8:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (!nmix && mix_parse(DEFAULT_MIX, &mixes[nmix++]))
+		return 1;
+	if (!n)
+		n = nmix;
+	if (bus < 0 || n < 1 || n > MAX_CLIENTS || !secs || batch < 1 ||
+	    batch > I2C_RDWR_IOCTL_MAX_MSGS) {
+		usage();
+		return 1;
+	}
+
+	snprintf(dev, sizeof(dev), "/dev/i2c-%d", bus);
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(fd, I2C_FUNCS, &funcs))
+		perror("I2C_FUNCS");
+	close(fd);
+	for (i = 0; i < nmix; i++) {
+		int j;
+
+		for (j = 0; j < mixes[i].n; j++)
+			if (mixes[i].items[j].type == T_RDWR &&
+			    !(funcs & I2C_FUNC_I2C)) {
+				fprintf(stderr, "error: %s needs plain I2C, which "
+					"the adapter can't do\n", mixes[i].spec);
+				return 1;
+			}
+	}
+
+	res = mmap(NULL, n * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memset(res, 0, n * sizeof(*res));
+
+	printf("%s address %#x: %d clients, %u s, batch %d, gap %u us\n", dev,
+	       addr, n, secs, batch, gap_us);
+
+	/* all children are forked before the first one starts */
+	solo_start = i2c_now() + 100000000ull;
+	start = solo_start + n * (solo_ms + 50) * 1000000ull;
+	for (i = 0; i < n; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid)
+			client(i, &mixes[i % nmix],
+			       solo_start + i * (solo_ms + 50) * 1000000ull, solo_ms,
+			       start, secs, &res[i]);
+	}
+	for (i = 0; i < n; i++) {
+		int status;
+
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			failed++;
+	}
+	if (failed)
+		fprintf(stderr, "warning: %d clients failed\n", failed);
+
+	printf("\n%3s %-24s %9s %9s %8s %8s %8s %8s %9s %8s %7s\n", "#", "mix",
+	       "ops/s", "bytes/s", "mean", "p50", "p99", "p99.9", "max[us]",
+	       "solo p99", "slower");
+	for (i = 0; i < n; i++) {
+		struct stats *s = &res[i].run, *solo = &res[i].solo;
+
+		ops[i] = s->secs ? s->ops / s->secs : 0;
+		bps[i] = s->secs ? s->bytes / s->secs : 0;
+		tot_ops += ops[i];
+		tot_bytes += bps[i];
+
+		printf("%3d %-24.24s %9.0f %9.0f %8.1f %8.1f %8.1f %8.1f %9.1f",
+		       i, mixes[i % nmix].spec, ops[i], bps[i], s->lat.mean,
+		       s->lat.p50, s->lat.p99, s->lat.p999, s->lat.max);
+		if (solo->lat.p99)
+			printf(" %8.1f %6.1fx", solo->lat.p99,
+			       s->lat.p99 / solo->lat.p99);
+		printf("\n");
+		if (s->errors)
+			printf("    %lu of %lu calls failed, first: %s\n", s->errors,
+			       s->calls, strerror(s->first_err));
+	}
+
+	printf("\ntotal %.0f ops/s, %.0f bytes/s\n", tot_ops, tot_bytes);
+	printf("Jain's fairness index: %.3f over ops/s, %.3f over bytes/s "
+	       "(1/N = %.3f)\n", jain(ops, n), jain(bps, n), 1.0 / n);
+
+	munmap(res, n * sizeof(*res));
+	return failed ? 1 : 0;
+}
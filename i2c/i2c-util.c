@@ -0,0 +1,52 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Helpers shared by the i2c tools
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c-util.h"
+
+/* 0 or -errno */
+int i2c_smbus(int fd, char rw, uint8_t cmd, int size,
+	      union i2c_smbus_data *data)
+{
+	struct i2c_smbus_ioctl_data args = {
+		.read_write = rw,
+		.command = cmd,
+		.size = size,
+		.data = data,
+	};
+
+	return ioctl(fd, I2C_SMBUS, &args) ? -errno : 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* n latencies in ns, sorted in place */
+void i2c_lat_stats(uint32_t *lat, size_t n, struct i2c_lat *s)
+{
+	double sum = 0;
+	size_t i;
+
+	memset(s, 0, sizeof(*s));
+	if (!n)
+		return;
+
+	qsort(lat, n, sizeof(*lat), cmp_u32);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	s->mean = sum / n / 1e3;
+	s->p50 = lat[n / 2] / 1e3;
+	s->p99 = lat[n - 1 - n / 100] / 1e3;
+	s->p999 = lat[n - 1 - n / 1000] / 1e3;
+	s->max = lat[n - 1] / 1e3;
+}
@@ -0,0 +1,31 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Helpers shared by the i2c tools: clock, SMBus transfers and latency
+ * percentiles
+ */
+#ifndef _I2C_UTIL_H_
+#define _I2C_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <linux/i2c.h>
+
+/* latency summary in us */
+struct i2c_lat {
+	double mean, p50, p99, p999, max;
+};
+
+static inline uint64_t i2c_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int i2c_smbus(int fd, char rw, uint8_t cmd, int size,
+	      union i2c_smbus_data *data);
+void i2c_lat_stats(uint32_t *lat, size_t n, struct i2c_lat *s);
+
+#endif /* _I2C_UTIL_H_ */
@@ -0,0 +1,202 @@
+/*
+ * cobs-bench - host side cost of the ser binary framing
+ *
+ * Measures CRC-32C (table, slice-by-8, CPU instructions), COBS encode
+ * and incremental decode per payload size, and converts the results to
+ * the highest 8N1 line rate one core could keep fed. Decoding is fed in
+ * randomly sized pieces like read() returns them, and every decoded
+ * frame is checked against what was sent.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/uio.h>
+
+#include "ser.h"
+
+#define BENCH_FRAMES	4096	/* frames per encoded block */
+#define BENCH_MAXSPLIT	4096
+
+volatile sig_atomic_t done;
+
+struct bench_check {
+	const uint8_t *payload;
+	size_t len;
+	unsigned long long frames, bad;
+};
+
+static uint64_t rnd_state = 88172645463325252ull;
+
+static uint64_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+static void usage(void)
+{
+	printf("\nUsage: cobs-bench [-P sizes] [-t ms]\n\n"
+	       "   -P list	comma separated payload sizes\n"
+	       "		(default 16,64,256,1024,4096)\n"
+	       "   -t ms	time per measurement (default 200)\n\n");
+}
+
+/* bytes/s as the 8N1 line rate it would saturate, in Mbaud */
+static double mbaud(double bps)
+{
+	return bps * 10 / 1e6;
+}
+
+static void bench_crc(const char *name, ser_crc32c_fn fn, const uint8_t *buf,
+		      size_t len, double secs)
+{
+	unsigned long long n = 0;
+	volatile uint32_t sink = 0;
+	double t0 = ser_now(), t;
+
+	do {
+		int i;
+
+		for (i = 0; i < 64; i++)
+			sink += fn(0, buf, len);
+		n += 64;
+		t = ser_now() - t0;
+	} while (t < secs);
+
+	printf("%-16s %6zu %12.1f %10.1f %10.0f\n", name, len,
+	       n * len / t / 1e6, n / t / 1e6, mbaud(n * len / t));
+}
+
+static void bench_check_frame(void *arg, const uint8_t *frame, size_t len)
+{
+	struct bench_check *c = arg;
+
+	c->frames++;
+	if (len != c->len || memcmp(frame, c->payload, len))
+		c->bad++;
+}
+
+static int bench_size(size_t len, double secs)
+{
+	size_t max = SER_COBS_MAX(len), wire = 0, pos;
+	struct ser_cobs_dec dec;
+	struct bench_check check = { 0 };
+	struct iovec iov;
+	uint8_t *payload, *enc;
+	unsigned long long n;
+	ser_crc32c_fn hw;
+	double t0, t;
+	size_t i;
+	int ret;
+
+	payload = malloc(len);
+	enc = malloc(max * BENCH_FRAMES);
+	ret = ser_cobs_dec_init(&dec, len);
+	if (!payload || !enc || ret) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* random data, about one zero in 256 bytes like real traffic */
+	for (i = 0; i < len; i++)
+		payload[i] = rnd();
+
+	bench_crc("crc32c byte", ser_crc32c_byte, payload, len, secs);
+	bench_crc("crc32c sb8", ser_crc32c_sb8, payload, len, secs);
+	hw = ser_crc32c_get_hw();
+	if (hw)
+		bench_crc("crc32c hw", hw, payload, len, secs);
+
+	iov.iov_base = payload;
+	iov.iov_len = len;
+	n = 0;
+	t0 = ser_now();
+	do {
+		for (i = 0, wire = 0; i < BENCH_FRAMES; i++)
+			wire += ser_cobs_encode(enc + wire, &iov, 1);
+		n += BENCH_FRAMES;
+		t = ser_now() - t0;
+	} while (t < secs);
+
+	printf("%-16s %6zu %12.1f %10.3f %10.0f  %.2f%% overhead\n", "encode",
+	       len, n * len / t / 1e6, n / t / 1e6, mbaud(n * len / t),
+	       100.0 * (wire - BENCH_FRAMES * len) / (BENCH_FRAMES * len));
+
+	check.payload = payload;
+	check.len = len;
+	n = 0;
+	t0 = ser_now();
+	do {
+		for (pos = 0; pos < wire; ) {
+			size_t split = rnd() % BENCH_MAXSPLIT + 1;
+
+			if (split > wire - pos)
+				split = wire - pos;
+			ser_cobs_decode(&dec, enc + pos, split,
+					bench_check_frame, &check);
+			pos += split;
+		}
+		n += BENCH_FRAMES;
+		t = ser_now() - t0;
+	} while (t < secs);
+
+	printf("%-16s %6zu %12.1f %10.3f %10.0f\n", "decode", len,
+	       n * len / t / 1e6, n / t / 1e6, mbaud(n * len / t));
+
+	if (check.frames != n || check.bad || dec.crc_err || dec.bad ||
+	    dec.too_long) {
+		fprintf(stderr, "decode mismatch: %llu of %llu frames, %llu "
+			"wrong, %llu crc, %llu bad, %llu too long\n",
+			check.frames, n, check.bad, dec.crc_err, dec.bad,
+			dec.too_long);
+		ret = -EIO;
+	}
+
+out:
+	ser_cobs_dec_free(&dec);
+	free(enc);
+	free(payload);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int sizes[SER_MAX_LIST] = { 16, 64, 256, 1024, 4096 };
+	int nsizes = 5, i, c, ret = 0;
+	double secs = 0.2;
+
+	while ((c = getopt(argc, argv, "P:t:h")) != -1) {
+		switch (c) {
+		case 'P':
+			nsizes = ser_parse_list(optarg, sizes, SER_MAX_LIST);
+			break;
+		case 't':
+			secs = strtoul(optarg, NULL, 0) / 1000.0;
+			break;
+		case 'h':
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (nsizes <= 0 || secs <= 0) {
+		usage();
+		return 1;
+	}
+
+	ser_crc32c_init();
+	printf("crc32c: %s, %d frames per block\n", ser_crc32c_impl(),
+	       BENCH_FRAMES);
+	printf("%-16s %6s %12s %10s %10s\n", "test", "size", "MB/s", "Mframes/s",
+	       "Mbaud");
+
+	for (i = 0; i < nsizes && !ret; i++)
+		ret = bench_size(sizes[i], secs);
+
+	return ret ? 1 : 0;
+}
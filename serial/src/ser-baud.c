@@ -0,0 +1,40 @@
+/*
+ * ser-baud - arbitrary line rates through termios2/BOTHER
+ *
+ * <asm/termbits.h> clashes with the libc <termios.h>, so this lives in
+ * its own unit and only exchanges plain integers with the rest of ser.
+ */
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+
+int ser_set_baud(int fd, unsigned int baud)
+{
+	struct termios2 tio;
+
+	if (ioctl(fd, TCGETS2, &tio))
+		return -errno;
+
+	/* output rate from c_ospeed, input rate follows it */
+	tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	tio.c_cflag |= BOTHER;
+	tio.c_ispeed = baud;
+	tio.c_ospeed = baud;
+
+	if (ioctl(fd, TCSETS2, &tio))
+		return -errno;
+
+	return 0;
+}
+
+/* rate the driver actually programmed, may differ from the requested one */
+int ser_get_baud(int fd, unsigned int *baud)
+{
+	struct termios2 tio;
+
+	if (ioctl(fd, TCGETS2, &tio))
+		return -errno;
+
+	*baud = tio.c_ospeed;
+	return 0;
+}
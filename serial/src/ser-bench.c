@@ -0,0 +1,197 @@
+/*
+ * ser-bench - raw throughput benchmark with rate and payload size sweep
+ *
+ * For every rate/size pair a writer thread keeps the tx side busy with
+ * payload sized writes while the main thread drains the rx side. The
+ * achieved rate is taken from the first received byte to the end of the
+ * step and compared against the theoretical 8N1 line rate.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "ser.h"
+
+#define BENCH_RXBUF	65536
+
+struct bench_writer {
+	int fd;
+	const char *buf;
+	size_t len;
+	volatile int stop;
+	unsigned long long bytes;
+	int err;
+};
+
+static void *bench_writer_thread(void *arg)
+{
+	struct bench_writer *w = arg;
+	struct pollfd pfd = { .fd = w->fd, .events = POLLOUT };
+
+	while (!w->stop && !done) {
+		ssize_t n = write(w->fd, w->buf, w->len);
+
+		if (n > 0) {
+			w->bytes += n;
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			w->err = -errno;
+			perror("write");
+			break;
+		}
+		/* short timeout so stop requests are noticed */
+		poll(&pfd, 1, 100);
+	}
+
+	return NULL;
+}
+
+static double bench_cpu_secs(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int bench_step(int txfd, int rxfd, unsigned int baud, size_t psize,
+		      unsigned int secs)
+{
+	struct bench_writer w = { 0 };
+	struct pollfd pfd = { .fd = rxfd, .events = POLLIN };
+	unsigned long long bytes = 0;
+	double t0 = 0, t1, tend, cpu0, cpu;
+	unsigned int actual = 0;
+	pthread_t t;
+	char *txbuf, *rxbuf;
+	size_t i;
+	int ret;
+
+	ret = ser_setup_raw(txfd, baud, 0, 0);
+	if (!ret && rxfd != txfd)
+		ret = ser_setup_raw(rxfd, baud, 0, 0);
+	if (ret) {
+		fprintf(stderr, "setting %u baud failed: %s\n", baud,
+			strerror(-ret));
+		return ret;
+	}
+	ser_get_baud(txfd, &actual);
+
+	txbuf = malloc(psize);
+	rxbuf = malloc(BENCH_RXBUF);
+	if (!txbuf || !rxbuf) {
+		free(txbuf);
+		free(rxbuf);
+		return -ENOMEM;
+	}
+	for (i = 0; i < psize; i++)
+		txbuf[i] = i;
+
+	w.fd = txfd;
+	w.buf = txbuf;
+	w.len = psize;
+
+	cpu0 = bench_cpu_secs();
+	tend = ser_now() + secs;
+	pthread_create(&t, NULL, bench_writer_thread, &w);
+
+	t1 = ser_now();
+	while (!done && t1 < tend) {
+		int rv = poll(&pfd, 1, 100);
+
+		t1 = ser_now();
+		if (rv < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+		if (rv <= 0)
+			continue;
+
+		ssize_t n = read(rxfd, rxbuf, BENCH_RXBUF);
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			perror("read");
+			break;
+		}
+		if (n <= 0)
+			continue;
+		if (!bytes)
+			t0 = t1;
+		bytes += n;
+	}
+
+	w.stop = 1;
+	pthread_join(t, NULL);
+	cpu = bench_cpu_secs() - cpu0;
+
+	tcflush(txfd, TCIOFLUSH);
+	if (rxfd != txfd)
+		tcflush(rxfd, TCIOFLUSH);
+
+	if (bytes && t1 > t0) {
+		double bps = bytes / (t1 - t0);
+
+		printf("%10u %10u %8zu %14llu %8.2f %12.0f %8.1f %10.2f\n",
+		       baud, actual, psize, bytes, t1 - t0, bps,
+		       100.0 * bps / ser_line_rate(actual ? actual : baud),
+		       1000.0 * cpu / (bytes / 1e6));
+	} else {
+		printf("%10u %10u %8zu %14s\n", baud, actual, psize,
+		       "no data");
+	}
+
+	free(txbuf);
+	free(rxbuf);
+	return w.err;
+}
+
+int ser_bench(struct ser_cfg *cfg)
+{
+	int txfd, rxfd, r, s, ret;
+
+	if (!cfg->secs)
+		cfg->secs = 5;
+	if (!cfg->nrates) {
+		cfg->rates[0] = cfg->baud;
+		cfg->nrates = 1;
+	}
+	if (!cfg->nsizes) {
+		cfg->sizes[0] = 4096;
+		cfg->nsizes = 1;
+	}
+
+	ret = ser_open_pair(cfg->dev, cfg->rdev, &txfd, &rxfd);
+	if (ret)
+		return ret;
+
+	fcntl(txfd, F_SETFL, fcntl(txfd, F_GETFL) | O_NONBLOCK);
+	fcntl(rxfd, F_SETFL, fcntl(rxfd, F_GETFL) | O_NONBLOCK);
+
+	printf("bench: %s -> %s, %u s per step\n", cfg->dev,
+	       cfg->rdev ? cfg->rdev : cfg->dev, cfg->secs);
+	printf("%10s %10s %8s %14s %8s %12s %8s %10s\n",
+	       "baud", "actual", "psize", "bytes", "secs", "B/s",
+	       "eff[%]", "cpu[ms/MB]");
+
+	for (r = 0; r < cfg->nrates && !done; r++) {
+		for (s = 0; s < cfg->nsizes && !done; s++) {
+			ret = bench_step(txfd, rxfd, cfg->rates[r],
+					 cfg->sizes[s], cfg->secs);
+			if (ret)
+				goto out;
+		}
+	}
+
+out:
+	ser_close_pair(txfd, rxfd);
+	return ret;
+}
@@ -0,0 +1,195 @@
+/*
+ * ser-cobs - COBS framing with CRC-32C
+ *
+ * A frame on the wire is the COBS encoded payload plus its CRC-32C
+ * (little endian), terminated by a 0x00 delimiter. COBS keeps 0x00 out
+ * of the encoded data, so a receiver resynchronizes on the next
+ * delimiter after any damage, at a cost of at most one byte per 254.
+ *
+ * The encoder works from an iovec straight into the caller's tx buffer,
+ * payloads never get copied into a staging frame. Zero free runs are
+ * moved with memcpy(), not byte by byte.
+ *
+ * The decoder is a small state machine fed with whatever read() returned,
+ * frames may be split at any byte.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "ser.h"
+
+#define COBS_BLOCK	254	/* data bytes behind a 0xff code */
+
+struct cobs_enc {
+	uint8_t *code;		/* code byte of the open block */
+	uint8_t *out;
+};
+
+static void cobs_put(struct cobs_enc *e, const uint8_t *p, size_t len)
+{
+	while (len) {
+		size_t run = COBS_BLOCK - (e->out - e->code - 1);
+		const uint8_t *z;
+
+		if (run > len)
+			run = len;
+		z = memchr(p, 0, run);
+		if (z)
+			run = z - p;
+
+		memcpy(e->out, p, run);
+		e->out += run;
+		p += run;
+		len -= run;
+
+		if (z) {
+			/* the zero itself is implied by the code byte */
+			*e->code = e->out - e->code;
+			e->code = e->out++;
+			p++;
+			len--;
+		} else if (e->out - e->code == COBS_BLOCK + 1) {
+			*e->code = 0xff;
+			e->code = e->out++;
+		}
+	}
+}
+
+/*
+ * Encode the concatenated iovec plus CRC into dst, which must hold
+ * SER_COBS_MAX() of the payload length. Returns the wire length.
+ */
+size_t ser_cobs_encode(uint8_t *dst, const struct iovec *iov, int cnt)
+{
+	struct cobs_enc e = { .code = dst, .out = dst + 1 };
+	uint32_t crc = 0;
+	uint8_t c[SER_COBS_CRC];
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		crc = ser_crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+		cobs_put(&e, iov[i].iov_base, iov[i].iov_len);
+	}
+
+	c[0] = crc;
+	c[1] = crc >> 8;
+	c[2] = crc >> 16;
+	c[3] = crc >> 24;
+	cobs_put(&e, c, sizeof(c));
+
+	*e.code = e.out - e.code;
+	*e.out++ = 0;
+	return e.out - dst;
+}
+
+/* max: largest payload accepted, longer frames are counted and dropped */
+int ser_cobs_dec_init(struct ser_cobs_dec *dec, size_t max)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->cap = max + SER_COBS_CRC;
+	dec->buf = malloc(dec->cap);
+
+	return dec->buf ? 0 : -ENOMEM;
+}
+
+void ser_cobs_dec_free(struct ser_cobs_dec *dec)
+{
+	free(dec->buf);
+	dec->buf = NULL;
+}
+
+static int cobs_dec_crc_ok(struct ser_cobs_dec *dec, size_t len)
+{
+	const uint8_t *c = dec->buf + len;
+
+	return (c[0] | c[1] << 8 | c[2] << 16 | (uint32_t)c[3] << 24) ==
+	       ser_crc32c(0, dec->buf, len);
+}
+
+static void cobs_dec_end(struct ser_cobs_dec *dec, ser_cobs_cb cb, void *arg)
+{
+	size_t len = dec->len - SER_COBS_CRC;
+
+	if (dec->drop) {
+		dec->too_long++;
+	} else if (dec->left) {
+		/* delimiter inside a block: the frame was cut */
+		dec->bad++;
+	} else if (dec->len < SER_COBS_CRC) {
+		/* back to back delimiters are idle fill, anything else junk */
+		if (dec->len || dec->code)
+			dec->bad++;
+	} else if (!cobs_dec_crc_ok(dec, len)) {
+		dec->crc_err++;
+	} else {
+		dec->frames++;
+		cb(arg, dec->buf, len);
+	}
+
+	dec->len = 0;
+	dec->code = 0;
+	dec->left = 0;
+	dec->drop = 0;
+}
+
+static void cobs_dec_push(struct ser_cobs_dec *dec, const uint8_t *p,
+			  size_t len)
+{
+	if (dec->drop)
+		return;
+
+	if (dec->len + len > dec->cap) {
+		dec->drop = 1;
+		return;
+	}
+
+	memcpy(dec->buf + dec->len, p, len);
+	dec->len += len;
+}
+
+void ser_cobs_decode(struct ser_cobs_dec *dec, const uint8_t *p, size_t len,
+		     ser_cobs_cb cb, void *arg)
+{
+	static const uint8_t zero;
+	const uint8_t *end = p + len;
+
+	while (p < end) {
+		uint8_t b;
+
+		if (dec->left) {
+			size_t run = dec->left;
+			const uint8_t *z;
+
+			if (run > end - p)
+				run = end - p;
+			/* a zero here is a delimiter, the block ends early */
+			z = memchr(p, 0, run);
+			if (z)
+				run = z - p;
+
+			cobs_dec_push(dec, p, run);
+			dec->left -= run;
+			p += run;
+			if (z) {
+				p++;
+				cobs_dec_end(dec, cb, arg);
+			}
+			continue;
+		}
+
+		b = *p++;
+		if (!b) {
+			cobs_dec_end(dec, cb, arg);
+			continue;
+		}
+
+		/* a block that ended below 0xff stood for a zero */
+		if (dec->code && dec->code < 0xff)
+			cobs_dec_push(dec, &zero, 1);
+		dec->code = b;
+		dec->left = b - 1;
+	}
+}
@@ -0,0 +1,165 @@
+/*
+ * ser-crc - CRC-32C (Castagnoli) for the binary test frames
+ *
+ * Three implementations: the plain table walk, slice-by-8 and the CRC32
+ * instructions of SSE4.2 or ARMv8. ser_crc32c_init() picks the fastest
+ * one the CPU supports, ser_crc32c() dispatches to it.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef __aarch64__
+#include <sys/auxv.h>
+#endif
+
+#include "ser.h"
+
+#define CRC32C_POLY	0x82f63b78	/* reflected */
+
+static uint32_t crc32c_table[8][256];
+
+static ser_crc32c_fn crc32c_fn = ser_crc32c_byte;
+static const char *crc32c_name = "byte";
+
+uint32_t ser_crc32c_byte(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	crc = ~crc;
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static inline uint32_t crc_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint32_t ser_crc32c_sb8(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t hi;
+
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		crc ^= crc_le32(p);
+		hi = crc_le32(p + 4);
+		crc = crc32c_table[7][crc & 0xff] ^
+		      crc32c_table[6][(crc >> 8) & 0xff] ^
+		      crc32c_table[5][(crc >> 16) & 0xff] ^
+		      crc32c_table[4][crc >> 24] ^
+		      crc32c_table[3][hi & 0xff] ^
+		      crc32c_table[2][(hi >> 8) & 0xff] ^
+		      crc32c_table[1][(hi >> 16) & 0xff] ^
+		      crc32c_table[0][hi >> 24];
+	}
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t c = ~crc, v;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, 8);
+		c = __builtin_ia32_crc32di(c, v);
+	}
+	crc = c;
+	while (len--)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+
+	return ~crc;
+}
+
+static int crc32c_hw_ok(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32	(1 << 7)
+#endif
+
+__attribute__((target("+crc")))
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t v;
+
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, 8);
+		crc = __builtin_aarch64_crc32cx(crc, v);
+	}
+	while (len--)
+		crc = __builtin_aarch64_crc32cb(crc, *p++);
+
+	return ~crc;
+}
+
+static int crc32c_hw_ok(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+}
+#else
+static uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	return ser_crc32c_sb8(crc, buf, len);
+}
+
+static int crc32c_hw_ok(void)
+{
+	return 0;
+}
+#endif
+
+/* NULL when the CPU has no CRC32C instructions */
+ser_crc32c_fn ser_crc32c_get_hw(void)
+{
+	return crc32c_hw_ok() ? crc32c_hw : NULL;
+}
+
+void ser_crc32c_init(void)
+{
+	uint32_t i, j, c;
+
+	if (crc32c_table[0][1])
+		return;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ (c & 1 ? CRC32C_POLY : 0);
+		crc32c_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^
+				crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+
+	if (crc32c_hw_ok()) {
+		crc32c_fn = crc32c_hw;
+		crc32c_name = "hw";
+	} else {
+		crc32c_fn = ser_crc32c_sb8;
+		crc32c_name = "slice-by-8";
+	}
+}
+
+const char *ser_crc32c_impl(void)
+{
+	return crc32c_name;
+}
+
+uint32_t ser_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	return crc32c_fn(crc, buf, len);
+}
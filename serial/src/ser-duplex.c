@@ -0,0 +1,640 @@
+/*
+ * ser-duplex - full duplex loopback test with sequence and CRC checks
+ *
+ * One epoll loop drives tx and rx of either a single looped back port,
+ * or of two ports wired to each other (-r, or the two ends of a pty),
+ * in which case both directions run at the same time.
+ *
+ * The multi mode runs the same engine over a list of ports, each with
+ * its own rate and role. Every port sends its own stream, the stream id
+ * in each frame tells the receiving port where it came from, so any
+ * wiring between the ports works.
+ *
+ * Frame layout, little endian:
+ *   0  sync   0xa5 0x5a
+ *   2  stream u8, sending end
+ *   3  len    u8, payload length
+ *   4  seq    u32
+ *   8  ts     u64, CLOCK_MONOTONIC send time in ns
+ *  16  payload
+ *   .. crc    u32, CRC-32C over stream..payload
+ *
+ * With -C the frames go out COBS encoded instead (see ser-cobs.c): the
+ * stream..payload part, its CRC and a 0x00 delimiter, no sync bytes.
+ * The payload then covers all byte values, zeros included, and is sent
+ * from one pre-generated block.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include "ser.h"
+#include "dmec-trace.h"
+
+#define DPX_SYNC0	0xa5
+#define DPX_SYNC1	0x5a
+#define DPX_HDR		16
+#define DPX_CRC		4
+#define DPX_MAX_ENDS	SER_MAX_LIST
+#define DPX_RXBUF	65536
+#define DPX_TXBUF	8192
+#define DPX_LAT_SAMPLES	(1 << 20)
+#define DPX_DRAIN	0.5	/* seconds to collect in-flight frames */
+#define DPX_QTIME	0.02
+
+struct dpx_stream {
+	int rxend;		/* end the stream was last seen on */
+	uint32_t sent;
+	unsigned long long txbytes;
+	uint32_t expect;
+	unsigned long long rx, rxbytes, lost, dup;
+	struct ser_lat lat;
+	double tokens;
+};
+
+struct dpx_end {
+	int fd;
+	char name[32];
+	unsigned int baud;
+	int txon, rxon;
+	double line, qtarget;
+	unsigned long long rxbytes;
+	uint8_t tx[DPX_TXBUF];
+	size_t txlen, txoff;
+	int pollout;
+	uint8_t rx[DPX_RXBUF];
+	size_t rxlen;
+	struct ser_cobs_dec dec;
+	unsigned long long corrupt, skipped;
+};
+
+struct dpx {
+	struct dpx_end end[DPX_MAX_ENDS];
+	struct dpx_stream stream[DPX_MAX_ENDS];
+	int nends;
+	int epfd;
+	size_t plen, flen;
+	double rate;
+	int txstop;
+	int cobs;
+	uint8_t payload[255];
+};
+
+struct dpx_rx_ctx {
+	struct dpx *d;
+	struct dpx_end *e;
+	uint64_t now;
+};
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void dpx_hdr_build(uint8_t *h, int stream, uint32_t seq, size_t plen)
+{
+	uint64_t ts = ser_now_ns();
+
+	h[0] = stream;
+	h[1] = plen;
+	put_le32(h + 2, seq);
+	put_le32(h + 6, ts);
+	put_le32(h + 10, ts >> 32);
+}
+
+static size_t dpx_frame_build(struct dpx *d, uint8_t *f, int stream,
+			      uint32_t seq)
+{
+	size_t plen = d->plen, i;
+
+	if (d->cobs) {
+		uint8_t h[DPX_HDR - 2];
+		struct iovec iov[2] = {
+			{ h, sizeof(h) },
+			{ d->payload, plen },
+		};
+
+		dpx_hdr_build(h, stream, seq, plen);
+		return ser_cobs_encode(f, iov, 2);
+	}
+
+	f[0] = DPX_SYNC0;
+	f[1] = DPX_SYNC1;
+	dpx_hdr_build(f + 2, stream, seq, plen);
+	/* keep sync bytes out of the payload */
+	for (i = 0; i < plen; i++)
+		f[DPX_HDR + i] = (seq + i) & 0x7f;
+	put_le32(f + DPX_HDR + plen,
+		 ser_crc32c(0, f + 2, DPX_HDR - 2 + plen));
+
+	return DPX_HDR + plen + DPX_CRC;
+}
+
+static void dpx_set_pollout(struct dpx *d, struct dpx_end *e, int on)
+{
+	struct epoll_event ev = {
+		.events = (e->rxon ? EPOLLIN : 0) | (on ? EPOLLOUT : 0),
+		.data.ptr = e,
+	};
+
+	if (e->pollout == on)
+		return;
+	e->pollout = on;
+	epoll_ctl(d->epfd, EPOLL_CTL_MOD, e->fd, &ev);
+}
+
+/*
+ * Refill and write the tx buffer of one end. Returns the time in ms
+ * until the budget allows more frames, -1 when only tx readiness
+ * matters.
+ */
+static int dpx_tx(struct dpx *d, int idx, double dt)
+{
+	struct dpx_end *e = &d->end[idx];
+	struct dpx_stream *s = &d->stream[idx];
+	double room = DPX_TXBUF;
+	int outq = 0, wait = -1;
+	ssize_t n;
+
+	if (d->rate) {
+		s->tokens += dt * d->rate;
+		if (s->tokens > d->rate * DPX_QTIME + d->flen)
+			s->tokens = d->rate * DPX_QTIME + d->flen;
+	}
+
+	if (!e->txon)
+		return -1;
+
+	if (e->txoff == e->txlen && !d->txstop) {
+		e->txlen = e->txoff = 0;
+
+		if (!ioctl(e->fd, TIOCOUTQ, &outq) && e->qtarget - outq < room)
+			room = e->qtarget - outq;
+		if (d->rate && s->tokens < room)
+			room = s->tokens;
+
+		while (room >= d->flen && e->txlen + d->flen <= DPX_TXBUF) {
+			e->txlen += dpx_frame_build(d, e->tx + e->txlen, idx,
+						    s->sent++);
+			room -= d->flen;
+		}
+		if (d->rate)
+			s->tokens -= e->txlen;
+
+		if (!e->txlen) {
+			double need = (outq - e->qtarget / 2) / e->line;
+
+			if (d->rate && outq <= e->qtarget / 2)
+				need = (d->flen - s->tokens) / d->rate;
+			wait = need > 0 ? need * 1000 + 1 : 1;
+		}
+	}
+
+	if (e->txoff < e->txlen) {
+		n = write(e->fd, e->tx + e->txoff, e->txlen - e->txoff);
+		if (n > 0) {
+			e->txoff += n;
+			__atomic_store_n(&s->txbytes, s->txbytes + n,
+					 __ATOMIC_RELAXED);
+		} else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			perror("write");
+			return -2;
+		}
+	}
+
+	dpx_set_pollout(d, e, e->txoff < e->txlen);
+	return wait;
+}
+
+/* h: frame from the stream byte on, wire: bytes it took on the line */
+static void dpx_frame_check(struct dpx *d, struct dpx_end *e,
+			    const uint8_t *h, size_t wire, uint64_t now)
+{
+	struct dpx_stream *s = &d->stream[h[0]];
+	uint32_t seq = get_le32(h + 2);
+	uint64_t ts = get_le32(h + 6) | (uint64_t)get_le32(h + 10) << 32;
+
+	s->rxend = e - d->end;
+
+	if (seq < s->expect) {
+		s->dup++;
+		return;
+	}
+
+	s->lost += seq - s->expect;
+	s->expect = seq + 1;
+	s->rx++;
+	s->rxbytes += wire;
+	ser_lat_add(&s->lat, now - ts);
+	/* on the wire from the time stamp of the sender to the read */
+	dmec_trace_async("serial", "frame", ts, now, (uint64_t)h[0] << 32 | seq);
+}
+
+static void dpx_cobs_frame(void *arg, const uint8_t *h, size_t len)
+{
+	struct dpx_rx_ctx *c = arg;
+
+	if (len < DPX_HDR - 2 || len != DPX_HDR - 2 + h[1] ||
+	    h[0] >= c->d->nends) {
+		c->e->corrupt++;
+		return;
+	}
+
+	/* code byte and delimiter, stuffing overhead is not known here */
+	dpx_frame_check(c->d, c->e, h, len + SER_COBS_CRC + 2, c->now);
+}
+
+static int dpx_rx(struct dpx *d, struct dpx_end *e)
+{
+	uint64_t now;
+	size_t pos = 0;
+	ssize_t n;
+
+	n = read(e->fd, e->rx + e->rxlen, DPX_RXBUF - e->rxlen);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -errno;
+	/* readable but nothing there: hung up */
+	if (!n)
+		return -EPIPE;
+	now = ser_now_ns();
+	__atomic_store_n(&e->rxbytes, e->rxbytes + n, __ATOMIC_RELAXED);
+
+	if (d->cobs) {
+		struct dpx_rx_ctx c = { d, e, now };
+
+		ser_cobs_decode(&e->dec, e->rx, n, dpx_cobs_frame, &c);
+		return 0;
+	}
+
+	e->rxlen += n;
+
+	while (e->rxlen - pos >= DPX_HDR) {
+		const uint8_t *f = e->rx + pos;
+		size_t len;
+
+		if (f[0] != DPX_SYNC0 || f[1] != DPX_SYNC1) {
+			e->skipped++;
+			pos++;
+			continue;
+		}
+
+		len = DPX_HDR + f[3] + DPX_CRC;
+		if (e->rxlen - pos < len)
+			break;
+
+		if (f[2] >= d->nends ||
+		    get_le32(f + len - DPX_CRC) !=
+		    ser_crc32c(0, f + 2, len - DPX_CRC - 2)) {
+			/* resync on the next byte */
+			e->corrupt++;
+			pos++;
+			continue;
+		}
+
+		dpx_frame_check(d, e, f + 2, len, now);
+		pos += len;
+	}
+
+	e->rxlen -= pos;
+	memmove(e->rx, e->rx + pos, e->rxlen);
+	return 0;
+}
+
+static void dpx_stream_name(struct dpx *d, int i, char *buf, size_t len)
+{
+	struct dpx_stream *s = &d->stream[i];
+
+	snprintf(buf, len, "%s -> %s", d->end[i].name,
+		 s->rx ? d->end[s->rxend].name : "?");
+}
+
+static void dpx_report(struct dpx *d, double secs)
+{
+	unsigned long long sent = 0, rx = 0, lost = 0, dup = 0, corrupt = 0;
+	double txtotal = 0, rxtotal = 0;
+	char name[64];
+	int i;
+
+	printf("\n%-24s %10s %12s %12s %10s %10s\n", "port", "baud",
+	       "tx[B/s]", "rx[B/s]", "corrupt", "skipped");
+	for (i = 0; i < d->nends; i++) {
+		struct dpx_end *e = &d->end[i];
+
+		e->corrupt += e->dec.crc_err + e->dec.bad + e->dec.too_long;
+		printf("%-24s %10u %12.0f %12.0f %10llu %10llu\n", e->name,
+		       e->baud, d->stream[i].txbytes / secs,
+		       e->rxbytes / secs, e->corrupt, e->skipped);
+		txtotal += d->stream[i].txbytes / secs;
+		rxtotal += e->rxbytes / secs;
+		corrupt += e->corrupt;
+	}
+
+	printf("\n%-24s %10s %10s %10s %10s %12s %7s\n", "stream",
+	       "sent", "recv", "lost", "dup", "B/s", "eff[%]");
+	for (i = 0; i < d->nends; i++) {
+		struct dpx_stream *s = &d->stream[i];
+		double bps = s->rxbytes / secs;
+
+		if (!d->end[i].txon)
+			continue;
+
+		/* frames never seen are lost, too */
+		s->lost += s->sent - s->expect;
+		dpx_stream_name(d, i, name, sizeof(name));
+		printf("%-24s %10u %10llu %10llu %10llu %12.0f %7.1f\n",
+		       name, s->sent, s->rx, s->lost, s->dup, bps,
+		       100.0 * bps / d->end[i].line);
+		sent += s->sent;
+		rx += s->rx;
+		lost += s->lost;
+		dup += s->dup;
+	}
+
+	printf("\ntotal: %d ports, tx %.0f B/s, rx %.0f B/s, frames sent %llu "
+	       "recv %llu lost %llu dup %llu corrupt %llu\n\n", d->nends,
+	       txtotal, rxtotal, sent, rx, lost, dup, corrupt);
+
+	ser_lat_print_hdr("latency");
+	for (i = 0; i < d->nends; i++) {
+		if (!d->end[i].txon)
+			continue;
+		dpx_stream_name(d, i, name, sizeof(name));
+		ser_lat_print(name, &d->stream[i].lat);
+	}
+}
+
+static int dpx_add_end(struct dpx *d, int fd, const char *name,
+		       unsigned int baud, int tx, int rx, unsigned int qtarget)
+{
+	struct dpx_end *e;
+	struct epoll_event ev;
+	int ret;
+
+	if (d->nends == DPX_MAX_ENDS) {
+		fprintf(stderr, "too many ports\n");
+		close(fd);
+		return -E2BIG;
+	}
+
+	e = &d->end[d->nends];
+	e->fd = fd;
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->baud = baud;
+	e->txon = tx;
+	e->rxon = rx;
+	e->line = ser_line_rate(baud);
+	e->qtarget = qtarget ? qtarget : e->line * DPX_QTIME;
+	if (e->qtarget < d->flen)
+		e->qtarget = d->flen;
+
+	ret = ser_setup_raw(fd, baud, 0, 0);
+	if (!ret)
+		ret = ser_lat_init(&d->stream[d->nends].lat, DPX_LAT_SAMPLES);
+	if (!ret && d->cobs)
+		ret = ser_cobs_dec_init(&e->dec, sizeof(d->payload) + DPX_HDR);
+	if (ret) {
+		fprintf(stderr, "%s: setup failed\n", name);
+		close(fd);
+		return ret;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	ev.events = rx ? EPOLLIN : 0;
+	ev.data.ptr = e;
+	epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev);
+
+	d->nends++;
+	return 0;
+}
+
+/* both ends of a new pty, wired to each other */
+static int dpx_add_pty(struct dpx *d, unsigned int baud, int tx, int rx,
+		       unsigned int qtarget)
+{
+	char name[32];
+	int m, s, ret;
+
+	ret = ser_open_pty(&m, &s);
+	if (ret) {
+		fprintf(stderr, "pty: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	snprintf(name, sizeof(name), "ptm%s", strrchr(ptsname(m), '/') + 1);
+	ret = dpx_add_end(d, m, name, baud, tx, rx, qtarget);
+	if (ret) {
+		close(s);
+		return ret;
+	}
+
+	return dpx_add_end(d, s, ptsname(m), baud, tx, rx, qtarget);
+}
+
+static struct dpx *dpx_alloc(struct ser_cfg *cfg)
+{
+	struct dpx *d;
+	size_t i;
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	ser_crc32c_init();
+
+	d->plen = cfg->nsizes ? cfg->sizes[0] : 32;
+	if (d->plen > sizeof(d->payload))
+		d->plen = sizeof(d->payload);
+	d->flen = DPX_HDR + d->plen + DPX_CRC;
+	d->cobs = cfg->cobs;
+	if (d->cobs) {
+		d->flen = SER_COBS_MAX(DPX_HDR - 2 + d->plen);
+		for (i = 0; i < sizeof(d->payload); i++)
+			d->payload[i] = i;
+	}
+	d->rate = cfg->rate;
+	d->epfd = epoll_create1(0);
+
+	return d;
+}
+
+static void dpx_free(struct dpx *d)
+{
+	int i;
+
+	for (i = 0; i < d->nends; i++) {
+		ser_lat_free(&d->stream[i].lat);
+		ser_cobs_dec_free(&d->end[i].dec);
+		close(d->end[i].fd);
+	}
+	close(d->epfd);
+	free(d);
+}
+
+static int dpx_run(struct dpx *d, struct ser_cfg *cfg)
+{
+	struct epoll_event ev[DPX_MAX_ENDS];
+	struct ser_stats *st;
+	double t0, tprev, tstop = 0, now;
+	unsigned int secs = cfg->secs;
+	int i, ret = 0;
+
+	st = ser_stats_open(cfg);
+	for (i = 0; i < d->nends; i++)
+		ser_stats_add(st, d->end[i].fd, d->end[i].name,
+			      &d->end[i].rxbytes, &d->stream[i].txbytes);
+	ser_stats_start(st);
+
+	t0 = tprev = ser_now();
+	while (1) {
+		int timeout = 100, nfds;
+
+		now = ser_now();
+		if (!d->txstop && (done || (secs && now - t0 >= secs))) {
+			d->txstop = 1;
+			tstop = now;
+		}
+		if (d->txstop && now - tstop >= DPX_DRAIN)
+			break;
+
+		for (i = 0; i < d->nends; i++) {
+			int w = dpx_tx(d, i, now - tprev);
+
+			if (w == -2) {
+				ret = -EIO;
+				goto report;
+			}
+			if (w >= 0 && w < timeout)
+				timeout = w;
+		}
+		tprev = now;
+
+		nfds = epoll_wait(d->epfd, ev, DPX_MAX_ENDS, timeout);
+		if (nfds < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			struct dpx_end *e = ev[i].data.ptr;
+
+			/*
+			 * Level triggered: an error or hangup nobody reads away
+			 * comes back on every wait, it ends the run.
+			 */
+			if (ev[i].events & EPOLLIN)
+				ret = dpx_rx(d, e);
+			else if (ev[i].events & (EPOLLERR | EPOLLHUP))
+				ret = -EIO;
+			if (ret) {
+				fprintf(stderr, "%s: read: %s\n", e->name,
+					strerror(-ret));
+				goto report;
+			}
+		}
+	}
+
+report:
+	ser_stats_stop(st);
+	dpx_report(d, (tstop ? tstop : now) - t0);
+	return ret;
+}
+
+int ser_duplex(struct ser_cfg *cfg)
+{
+	struct dpx *d;
+	int fd, ret;
+
+	d = dpx_alloc(cfg);
+	if (!d)
+		return -ENOMEM;
+
+	if (!strcmp(cfg->dev, SER_PTY)) {
+		ret = dpx_add_pty(d, cfg->baud, 1, 1, cfg->qtarget);
+	} else {
+		fd = open(cfg->dev, O_RDWR | O_NOCTTY);
+		ret = fd < 0 ? -errno : dpx_add_end(d, fd, cfg->dev, cfg->baud,
+						    1, 1, cfg->qtarget);
+		if (!ret && cfg->rdev) {
+			fd = open(cfg->rdev, O_RDWR | O_NOCTTY);
+			ret = fd < 0 ? -errno :
+			      dpx_add_end(d, fd, cfg->rdev, cfg->baud, 1, 1,
+					  cfg->qtarget);
+		}
+		if (fd < 0)
+			perror("open");
+	}
+	if (ret)
+		goto out;
+
+	printf("duplex: %s <-> %s, %u baud, frame %zu bytes%s\n",
+	       d->end[0].name, d->end[d->nends - 1].name, cfg->baud, d->flen,
+	       d->cobs ? " max, cobs" : "");
+
+	ret = dpx_run(d, cfg);
+out:
+	dpx_free(d);
+	return ret;
+}
+
+int ser_multi(struct ser_cfg *cfg)
+{
+	struct ser_port ports[DPX_MAX_ENDS];
+	struct dpx *d;
+	int n, i, fd, ret = 0;
+
+	n = ser_parse_ports(cfg->dev, ports, DPX_MAX_ENDS, cfg->baud);
+	if (n < 0)
+		return n;
+
+	d = dpx_alloc(cfg);
+	if (!d) {
+		ret = -ENOMEM;
+		goto out_ports;
+	}
+
+	for (i = 0; i < n && !ret; i++) {
+		struct ser_port *p = &ports[i];
+
+		if (!strcmp(p->dev, SER_PTY)) {
+			ret = dpx_add_pty(d, p->baud, p->tx, p->rx,
+					  cfg->qtarget);
+			continue;
+		}
+
+		fd = open(p->dev, O_RDWR | O_NOCTTY);
+		if (fd < 0) {
+			ret = -errno;
+			perror(p->dev);
+			break;
+		}
+		ret = dpx_add_end(d, fd, p->dev, p->baud, p->tx, p->rx,
+				  cfg->qtarget);
+	}
+
+	if (!ret) {
+		printf("multi: %d ports, frame %zu bytes%s\n", d->nends,
+		       d->flen, d->cobs ? " max, cobs" : "");
+		ret = dpx_run(d, cfg);
+	}
+
+	dpx_free(d);
+out_ports:
+	for (i = 0; i < n; i++)
+		free(ports[i].dev);
+	return ret;
+}
@@ -0,0 +1,255 @@
+/*
+ * ser-flood - saturating sender
+ *
+ * Frames are pre-generated once into a ring block, only the sequence
+ * digits are stamped in before a frame goes out. Batches are written
+ * with writev() straight from the block. The amount written per batch
+ * follows the driver tx queue depth (TIOCOUTQ), so the UART never runs
+ * dry while the queue is not overfilled. An optional token bucket caps
+ * the average to an exact target rate.
+ *
+ * Frame layout: "[0000000042].deadbeefdeadb...\n"
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include "ser.h"
+
+#define FLOOD_NFRAMES	512
+#define FLOOD_QTIME	0.02	/* default tx queue target in seconds */
+
+struct flood_ring {
+	char *block;
+	size_t flen;
+	unsigned int nframes;
+	unsigned int head;	/* frame holding the next byte to send */
+	size_t off;		/* offset of that byte inside the frame */
+	unsigned int seq;	/* sequence number of the head frame */
+	unsigned int stamped;	/* frames from head on already stamped */
+};
+
+void ser_frame_stamp(char *frame, unsigned int seq)
+{
+	int i;
+
+	for (i = SER_FRAME_DIGITS; i > 0; i--) {
+		frame[i] = '0' + seq % 10;
+		seq /= 10;
+	}
+}
+
+void ser_frame_init(char *frame, size_t flen, unsigned int seq)
+{
+	static const char pattern[] = "deadbeef";
+	size_t i;
+
+	frame[0] = '[';
+	ser_frame_stamp(frame, seq);
+	frame[SER_FRAME_DIGITS + 1] = ']';
+	frame[SER_FRAME_DIGITS + 2] = '.';
+	for (i = SER_FRAME_HDR; i < flen - 1; i++)
+		frame[i] = pattern[(i - SER_FRAME_HDR) % (sizeof(pattern) - 1)];
+	frame[flen - 1] = '\n';
+}
+
+static int flood_ring_init(struct flood_ring *r, size_t flen)
+{
+	unsigned int i;
+
+	r->flen = flen;
+	r->nframes = FLOOD_NFRAMES;
+	r->block = malloc(flen * r->nframes);
+	if (!r->block)
+		return -ENOMEM;
+
+	for (i = 0; i < r->nframes; i++)
+		ser_frame_init(r->block + i * flen, flen, 0);
+
+	r->head = 0;
+	r->off = 0;
+	r->seq = 0;
+	r->stamped = 0;
+	return 0;
+}
+
+/* describe up to want bytes from the ring in at most two iovecs */
+static int flood_ring_fill(struct flood_ring *r, size_t want,
+			   struct iovec *iov)
+{
+	size_t size = r->flen * r->nframes;
+	size_t pos = r->head * r->flen + r->off;
+	unsigned int nf, i;
+
+	/* keep the head frame out of a batch that wraps onto itself */
+	if (want > size - r->flen)
+		want = size - r->flen;
+
+	nf = (r->off + want + r->flen - 1) / r->flen;
+	for (i = r->stamped; i < nf; i++)
+		ser_frame_stamp(r->block +
+				((r->head + i) % r->nframes) * r->flen,
+				r->seq + i);
+	if (nf > r->stamped)
+		r->stamped = nf;
+
+	iov[0].iov_base = r->block + pos;
+	if (pos + want <= size) {
+		iov[0].iov_len = want;
+		return 1;
+	}
+
+	iov[0].iov_len = size - pos;
+	iov[1].iov_base = r->block;
+	iov[1].iov_len = want - iov[0].iov_len;
+	return 2;
+}
+
+static void flood_ring_advance(struct flood_ring *r, size_t n)
+{
+	unsigned int nf;
+
+	n += r->off;
+	nf = n / r->flen;
+	r->off = n % r->flen;
+	r->head = (r->head + nf) % r->nframes;
+	r->seq += nf;
+	r->stamped -= nf;
+}
+
+static void flood_sleep(double secs)
+{
+	struct timespec ts;
+
+	if (secs <= 0)
+		return;
+
+	ts.tv_sec = secs;
+	ts.tv_nsec = (secs - ts.tv_sec) * 1e9;
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+
+int ser_flood(struct ser_cfg *cfg)
+{
+	struct flood_ring ring;
+	struct ser_stats *st;
+	unsigned long long bytes = 0, last_bytes = 0;
+	double rate, line, qtarget, tokens, burst;
+	double t0, tlast, tprev, now;
+	size_t flen;
+	int txfd, rxfd, ret;
+
+	flen = cfg->nsizes ? cfg->sizes[0] : SER_FRAME_MIN;
+	if (flen < SER_FRAME_MIN)
+		flen = SER_FRAME_MIN;
+
+	ret = ser_open_pair(cfg->dev, NULL, &txfd, &rxfd);
+	if (ret)
+		return ret;
+
+	ret = ser_setup_raw(txfd, cfg->baud, 1, 0);
+	if (ret) {
+		fprintf(stderr, "setup failed: %s\n", strerror(-ret));
+		goto out;
+	}
+
+	ret = flood_ring_init(&ring, flen);
+	if (ret)
+		goto out;
+
+	line = ser_line_rate(cfg->baud);
+	rate = cfg->rate;
+	qtarget = cfg->qtarget ? cfg->qtarget : line * FLOOD_QTIME;
+	if (qtarget < flen)
+		qtarget = flen;
+	burst = rate ? (rate * FLOOD_QTIME > flen ? rate * FLOOD_QTIME : flen)
+		     : 0;
+	tokens = burst;
+
+	printf("flood: %s %u baud, frame %zu bytes, queue target %.0f bytes",
+	       cfg->dev, cfg->baud, flen, qtarget);
+	if (rate)
+		printf(", limit %.0f B/s", rate);
+	printf("\n");
+
+	st = ser_stats_open(cfg);
+	ser_stats_add(st, txfd, cfg->dev, NULL, &bytes);
+	ser_stats_start(st);
+
+	t0 = tlast = tprev = ser_now();
+	while (!done) {
+		struct iovec iov[2];
+		double room, wait;
+		int outq = 0, cnt;
+		ssize_t n;
+
+		now = ser_now();
+		if (cfg->secs && now - t0 >= cfg->secs)
+			break;
+
+		if (rate) {
+			tokens += (now - tprev) * rate;
+			if (tokens > burst)
+				tokens = burst;
+		}
+		tprev = now;
+
+		if (ioctl(txfd, TIOCOUTQ, &outq))
+			outq = 0;
+		room = qtarget - outq;
+		if (rate && tokens < room)
+			room = tokens;
+
+		if (room < flen) {
+			/* wait until the queue drained or tokens refilled */
+			wait = (flen - room) / (rate ? rate : line);
+			if (outq > qtarget / 2)
+				wait = (outq - qtarget / 2) / line;
+			flood_sleep(wait);
+			continue;
+		}
+
+		cnt = flood_ring_fill(&ring, room, iov);
+		n = writev(txfd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			ret = -errno;
+			perror("writev");
+			break;
+		}
+
+		flood_ring_advance(&ring, n);
+		__atomic_store_n(&bytes, bytes + n, __ATOMIC_RELAXED);
+		if (rate)
+			tokens -= n;
+
+		if (now - tlast >= 1.0) {
+			printf("sent: %14llu bytes %10u frames %12.0f B/s "
+			       "outq: %6d\n", bytes, ring.seq,
+			       (bytes - last_bytes) / (now - tlast), outq);
+			last_bytes = bytes;
+			tlast = now;
+		}
+	}
+
+	/* include the queued tail in the measurement */
+	tcdrain(txfd);
+	now = ser_now();
+	ser_stats_stop(st);
+	if (now > t0)
+		printf("total: %llu bytes, %u frames in %.2f s, %.0f B/s "
+		       "(%.1f%% of line rate)\n", bytes, ring.seq, now - t0,
+		       bytes / (now - t0),
+		       100.0 * bytes / (now - t0) / line);
+
+	free(ring.block);
+out:
+	ser_close_pair(txfd, rxfd);
+	return ret;
+}
@@ -0,0 +1,102 @@
+/*
+ * ser-lat - latency sample collection and percentiles
+ *
+ * Samples are kept in a fixed size reservoir, so long runs keep a
+ * uniform sample of all latencies at constant memory. Min/max/mean are
+ * exact.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ser.h"
+
+int ser_lat_init(struct ser_lat *l, size_t cap)
+{
+	memset(l, 0, sizeof(*l));
+	l->v = malloc(cap * sizeof(*l->v));
+	if (!l->v)
+		return -1;
+
+	l->cap = cap;
+	l->min = UINT64_MAX;
+	l->rnd = 88172645463325252ull;
+	return 0;
+}
+
+void ser_lat_free(struct ser_lat *l)
+{
+	free(l->v);
+	l->v = NULL;
+}
+
+void ser_lat_add(struct ser_lat *l, uint64_t ns)
+{
+	if (ns < l->min)
+		l->min = ns;
+	if (ns > l->max)
+		l->max = ns;
+	l->sum += ns;
+	l->sorted = 0;
+
+	if (l->n < l->cap) {
+		l->v[l->n++] = ns;
+	} else {
+		/* reservoir sampling, cheap xorshift is plenty here */
+		uint64_t r;
+
+		l->rnd ^= l->rnd << 13;
+		l->rnd ^= l->rnd >> 7;
+		l->rnd ^= l->rnd << 17;
+		r = l->rnd % (l->seen + 1);
+		if (r < l->cap)
+			l->v[r] = ns;
+	}
+	l->seen++;
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* sorts the samples, call once all samples are in */
+uint64_t ser_lat_pct(struct ser_lat *l, double pct)
+{
+	size_t i;
+
+	if (!l->n)
+		return 0;
+
+	if (!l->sorted) {
+		qsort(l->v, l->n, sizeof(*l->v), lat_cmp);
+		l->sorted = 1;
+	}
+
+	i = pct / 100.0 * (l->n - 1) + 0.5;
+	return l->v[i];
+}
+
+void ser_lat_print_hdr(const char *name)
+{
+	printf("%-24s %10s %10s %10s %10s %10s %10s %10s\n", name,
+	       "samples", "min[us]", "mean[us]", "p50[us]", "p99[us]",
+	       "p99.9[us]", "max[us]");
+}
+
+void ser_lat_print(const char *name, struct ser_lat *l)
+{
+	if (!l->seen) {
+		printf("%-24s %10s\n", name, "-");
+		return;
+	}
+
+	printf("%-24s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+	       name, (unsigned long long)l->seen, l->min / 1e3,
+	       (double)l->sum / l->seen / 1e3, ser_lat_pct(l, 50) / 1e3,
+	       ser_lat_pct(l, 99) / 1e3, ser_lat_pct(l, 99.9) / 1e3,
+	       l->max / 1e3);
+}
@@ -0,0 +1,374 @@
+/*
+ * ser-log - receive logging without per line fsync
+ *
+ * Three back ends, picked in this order:
+ *  - ring:   fixed size mmap'd circular file (-F size), for soak tests.
+ *            Data is read from the tty straight into the mapping and left
+ *            to the page cache writeback, the file never grows.
+ *  - splice: tty -> pipe -> file, data never enters user space.
+ *  - thread: reads go straight into a large in-memory buffer, a writer
+ *            thread empties it to the file in big chunks. When the disk
+ *            falls behind, data is dropped and counted instead of
+ *            throttling reception.
+ *
+ * Ring file layout: a struct ser_ring_hdr page followed by the data
+ * area. Byte n of the stream is stored at data[n % size]; with head
+ * bytes written in total, the oldest byte still present is
+ * head - size when head > size.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "ser.h"
+
+#define LOG_BUFSZ	(4 << 20)
+#define LOG_CHUNK	65536
+#define LOG_PIPESZ	(1 << 20)
+#define LOG_RING_HDR	4096
+#define LOG_RING_MAGIC	"SERRING1"
+
+struct ser_ring_hdr {
+	char magic[8];
+	uint64_t size;		/* size of the data area */
+	uint64_t head;		/* total bytes written */
+	uint64_t first_ns;	/* CLOCK_REALTIME of first and last write */
+	uint64_t last_ns;
+};
+
+enum ser_log_mode {
+	SER_LOG_RING,
+	SER_LOG_SPLICE,
+	SER_LOG_THREAD,
+};
+
+struct ser_log {
+	enum ser_log_mode mode;
+	int fd;
+	unsigned long long bytes;
+	unsigned long long dropped;
+
+	/* ring */
+	struct ser_ring_hdr *hdr;
+	char *data;
+	size_t map_len;
+
+	/* splice */
+	int pipe[2];
+
+	/* thread */
+	char *buf;
+	size_t head, tail;	/* head == tail: empty */
+	int stop;
+	int err;		/* first write error */
+	unsigned long long failed;	/* bytes lost to write errors */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char scratch[LOG_CHUNK];
+};
+
+static uint64_t log_realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *log_writer_thread(void *arg)
+{
+	struct ser_log *l = arg;
+
+	pthread_mutex_lock(&l->lock);
+	while (1) {
+		size_t head, len;
+		ssize_t n;
+
+		while (l->head == l->tail && !l->stop)
+			pthread_cond_wait(&l->cond, &l->lock);
+		if (l->head == l->tail)
+			break;
+
+		/* write the contiguous part, wrap is picked up next pass */
+		head = l->head;
+		len = head > l->tail ? head - l->tail : LOG_BUFSZ - l->tail;
+		pthread_mutex_unlock(&l->lock);
+
+		n = write(l->fd, l->buf + l->tail, len);
+
+		pthread_mutex_lock(&l->lock);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!l->err) {
+				l->err = -errno;
+				perror("log write");
+			}
+			/* keep draining so the reader never blocks on us */
+			l->failed += len;
+			n = len;
+		}
+		l->tail = (l->tail + n) % LOG_BUFSZ;
+	}
+	pthread_mutex_unlock(&l->lock);
+
+	return NULL;
+}
+
+static int log_ring_open(struct ser_log *l, size_t size)
+{
+	int new = 0;
+
+	size = (size + LOG_RING_HDR - 1) & ~(size_t)(LOG_RING_HDR - 1);
+	l->map_len = LOG_RING_HDR + size;
+
+	if (lseek(l->fd, 0, SEEK_END) != l->map_len) {
+		if (ftruncate(l->fd, l->map_len))
+			return -errno;
+		new = 1;
+	}
+
+	l->hdr = mmap(NULL, l->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      l->fd, 0);
+	if (l->hdr == MAP_FAILED)
+		return -errno;
+	l->data = (char *)l->hdr + LOG_RING_HDR;
+
+	/* continue an existing ring of the same size across restarts */
+	if (new || memcmp(l->hdr->magic, LOG_RING_MAGIC, 8) ||
+	    l->hdr->size != size) {
+		memset(l->hdr, 0, sizeof(*l->hdr));
+		memcpy(l->hdr->magic, LOG_RING_MAGIC, 8);
+		l->hdr->size = size;
+	}
+
+	return 0;
+}
+
+struct ser_log *ser_log_open(const char *path, size_t ring_size)
+{
+	struct ser_log *l;
+	int ret;
+
+	l = calloc(1, sizeof(*l));
+	if (!l)
+		return NULL;
+
+	l->fd = open(path, O_RDWR | O_CREAT | (ring_size ? 0 : O_TRUNC),
+		     0644);
+	if (l->fd < 0) {
+		perror(path);
+		free(l);
+		return NULL;
+	}
+
+	if (ring_size) {
+		l->mode = SER_LOG_RING;
+		ret = log_ring_open(l, ring_size);
+		if (ret) {
+			fprintf(stderr, "%s: ring setup failed: %s\n", path,
+				strerror(-ret));
+			close(l->fd);
+			free(l);
+			return NULL;
+		}
+		printf("log: %s ring of %llu bytes\n", path,
+		       (unsigned long long)l->hdr->size);
+		return l;
+	}
+
+	if (!pipe(l->pipe)) {
+		l->mode = SER_LOG_SPLICE;
+		fcntl(l->pipe[1], F_SETPIPE_SZ, LOG_PIPESZ);
+		printf("log: %s via splice\n", path);
+		return l;
+	}
+
+	ser_log_fallback(l);
+	return l;
+}
+
+/* switch from splice to the writer thread, e.g. when the tty refuses */
+void ser_log_fallback(struct ser_log *l)
+{
+	if (l->mode == SER_LOG_SPLICE) {
+		close(l->pipe[0]);
+		close(l->pipe[1]);
+	}
+
+	l->mode = SER_LOG_THREAD;
+	l->buf = malloc(LOG_BUFSZ);
+	pthread_mutex_init(&l->lock, NULL);
+	pthread_cond_init(&l->cond, NULL);
+	if (!l->buf || pthread_create(&l->thread, NULL, log_writer_thread, l)) {
+		fprintf(stderr, "log: writer thread setup failed\n");
+		free(l->buf);
+		l->buf = NULL;
+		return;
+	}
+	printf("log: buffered writer thread\n");
+}
+
+int ser_log_splicing(struct ser_log *l)
+{
+	return l->mode == SER_LOG_SPLICE;
+}
+
+/*
+ * Move whatever the tty has to the log without copying it to user space.
+ * Returns the number of bytes moved, -EINVAL when splice is not supported
+ * for this pair of files.
+ */
+ssize_t ser_log_splice(struct ser_log *l, int fd)
+{
+	ssize_t n, m, left;
+
+	n = splice(fd, NULL, l->pipe[1], NULL, LOG_PIPESZ,
+		   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n <= 0)
+		return n < 0 ? -errno : 0;
+
+	for (left = n; left > 0; left -= m) {
+		m = splice(l->pipe[0], NULL, l->fd, NULL, left, SPLICE_F_MOVE);
+		if (m < 0) {
+			if (errno == EINTR) {
+				m = 0;
+				continue;
+			}
+			/* taken from the tty, but not in the file */
+			l->bytes += n - left;
+			l->dropped += left;
+			/* EINVAL: the caller falls back to the writer thread */
+			if (errno != EINVAL)
+				l->err = -errno;
+			return -errno;
+		}
+	}
+
+	l->bytes += n;
+	return n;
+}
+
+/*
+ * Reserve room for the next read. Data is read straight into the log
+ * buffer and handed over with ser_log_commit().
+ */
+char *ser_log_reserve(struct ser_log *l, size_t *len)
+{
+	size_t room;
+
+	if (l->mode == SER_LOG_RING) {
+		size_t pos = l->hdr->head % l->hdr->size;
+
+		room = l->hdr->size - pos;
+		*len = room < LOG_CHUNK ? room : LOG_CHUNK;
+		return l->data + pos;
+	}
+
+	if (!l->buf) {
+		*len = sizeof(l->scratch);
+		return l->scratch;
+	}
+
+	pthread_mutex_lock(&l->lock);
+	/* one byte stays free to tell full from empty */
+	if (l->head >= l->tail)
+		room = LOG_BUFSZ - l->head - (l->tail ? 0 : 1);
+	else
+		room = l->tail - l->head - 1;
+	pthread_mutex_unlock(&l->lock);
+
+	if (!room) {
+		*len = sizeof(l->scratch);
+		return l->scratch;
+	}
+
+	*len = room < LOG_CHUNK ? room : LOG_CHUNK;
+	return l->buf + l->head;
+}
+
+void ser_log_commit(struct ser_log *l, const char *p, size_t n)
+{
+	if (!n)
+		return;
+
+	if (l->mode == SER_LOG_RING) {
+		uint64_t now = log_realtime_ns();
+
+		if (!l->hdr->first_ns)
+			l->hdr->first_ns = now;
+		l->hdr->last_ns = now;
+		l->hdr->head += n;
+		l->bytes += n;
+		return;
+	}
+
+	if (p == l->scratch) {
+		l->dropped += n;
+		return;
+	}
+
+	pthread_mutex_lock(&l->lock);
+	l->head = (l->head + n) % LOG_BUFSZ;
+	pthread_cond_signal(&l->cond);
+	pthread_mutex_unlock(&l->lock);
+	l->bytes += n;
+}
+
+/* returns the first write error of the log, 0 if all went to the file */
+int ser_log_close(struct ser_log *l)
+{
+	int ret;
+
+	if (!l)
+		return 0;
+
+	switch (l->mode) {
+	case SER_LOG_RING:
+		if (msync(l->hdr, l->map_len, MS_SYNC) && !l->err)
+			l->err = -errno;
+		munmap(l->hdr, l->map_len);
+		break;
+	case SER_LOG_SPLICE:
+		close(l->pipe[0]);
+		close(l->pipe[1]);
+		break;
+	case SER_LOG_THREAD:
+		if (!l->buf)
+			break;
+		pthread_mutex_lock(&l->lock);
+		l->stop = 1;
+		pthread_cond_signal(&l->cond);
+		pthread_mutex_unlock(&l->lock);
+		pthread_join(l->thread, NULL);
+		free(l->buf);
+		/* committed, but the writer could not get rid of them */
+		l->bytes -= l->failed;
+		l->dropped += l->failed;
+		break;
+	}
+
+	/* one sync for the whole run instead of one per line */
+	if (fdatasync(l->fd) && !l->err)
+		l->err = -errno;
+	if (close(l->fd) && !l->err)
+		l->err = -errno;
+
+	printf("log: %llu bytes logged", l->bytes);
+	if (l->dropped)
+		printf(", %llu bytes dropped", l->dropped);
+	if (l->err)
+		printf(", write error: %s", strerror(-l->err));
+	printf("\n");
+	ret = l->err;
+	free(l);
+	return ret;
+}
@@ -0,0 +1,326 @@
+/*
+ * ser-ping - request/response turnaround in raw mode
+ *
+ * The requester writes a message and reads until the full response is
+ * back, using plain blocking reads so only the termios settings under
+ * test (VMIN/VTIME, ASYNC_LOW_LATENCY) decide when read() returns.
+ *
+ * Responses come from a looped back port (a single device), from an echo
+ * thread on the second port (-r, or the slave of a pty), or from
+ * "ser -m echo" running on the far end.
+ *
+ * Lost responses are caught by a 1 s interval timer: its signal breaks
+ * a blocked read() and an exchange older than PING_TIMEOUT is given up.
+ * That keeps timeout handling out of the per exchange path.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/serial.h>
+
+#include "ser.h"
+#include "dmec-trace.h"
+
+#define PING_COUNT	1000
+#define PING_WARMUP	10
+#define PING_TIMEOUT	1.0
+#define PING_MAXMSG	65536
+#define PING_VMIN_SIZE	-1
+
+struct ping_echo {
+	int fd;
+	volatile int stop;
+};
+
+static void ping_alarm(int sig)
+{
+}
+
+static void *ping_echo_thread(void *arg)
+{
+	struct ping_echo *e = arg;
+	char buf[4096];
+
+	while (!e->stop && !done) {
+		ssize_t n = read(e->fd, buf, sizeof(buf)), off = 0;
+
+		while (n > 0 && off < n) {
+			ssize_t m = write(e->fd, buf + off, n - off);
+
+			if (m < 0 && errno != EINTR)
+				break;
+			if (m > 0)
+				off += m;
+		}
+	}
+
+	return NULL;
+}
+
+static int ping_low_latency(int fd, int on)
+{
+	struct serial_struct ss;
+
+	if (ioctl(fd, TIOCGSERIAL, &ss))
+		return -errno;
+
+	if (on)
+		ss.flags |= ASYNC_LOW_LATENCY;
+	else
+		ss.flags &= ~ASYNC_LOW_LATENCY;
+
+	if (ioctl(fd, TIOCSSERIAL, &ss))
+		return -errno;
+
+	return 0;
+}
+
+/* one exchange, returns the turnaround in ns or 0 on timeout */
+static uint64_t ping_once(int fd, const char *msg, char *rsp, size_t len)
+{
+	uint64_t t0 = ser_now_ns(), now;
+	size_t got = 0, off = 0;
+	ssize_t n;
+
+	while (off < len) {
+		n = write(fd, msg + off, len - off);
+		if (n < 0 && errno != EINTR)
+			return 0;
+		if (n > 0)
+			off += n;
+	}
+
+	while (got < len) {
+		n = read(fd, rsp + got, len - got);
+		if (n > 0) {
+			got += n;
+			continue;
+		}
+		if (n < 0 && errno != EINTR)
+			return 0;
+		if (done || ser_now_ns() - t0 > PING_TIMEOUT * 1e9)
+			return 0;
+	}
+
+	now = ser_now_ns();
+	dmec_trace_span("serial", "exchange", t0, now, len);
+	return now - t0;
+}
+
+static void ping_step(struct ser_cfg *cfg, int fd, unsigned int vmin,
+		      unsigned int vtime, int lowlat, size_t len,
+		      char *msg, char *rsp)
+{
+	unsigned int count = cfg->count ? cfg->count : PING_COUNT;
+	unsigned long timeouts = 0, bad = 0;
+	struct ser_lat lat;
+	char name[32];
+	unsigned int i;
+	int ret;
+
+	ret = ser_setup_raw(fd, cfg->baud, vmin, vtime);
+	if (ret) {
+		fprintf(stderr, "termios setup failed: %s\n", strerror(-ret));
+		return;
+	}
+	snprintf(name, sizeof(name), "%u/%u %s %zu", vmin, vtime,
+		 lowlat > 0 ? "ll" : "-", len);
+	if (lowlat >= 0 && ping_low_latency(fd, lowlat)) {
+		/* a comment, the table stays parseable */
+		printf("# %s: ASYNC_LOW_LATENCY not supported\n", name);
+		return;
+	}
+
+	if (ser_lat_init(&lat, count))
+		return;
+
+	for (i = 0; i < count + PING_WARMUP && !done; i++) {
+		uint64_t ns;
+
+		/* vary the content so stale data shows up as mismatch */
+		memset(msg, 'a' + i % 26, len);
+		ns = ping_once(fd, msg, rsp, len);
+		if (!ns) {
+			timeouts++;
+			tcflush(fd, TCIOFLUSH);
+			continue;
+		}
+		if (memcmp(msg, rsp, len)) {
+			bad++;
+			tcflush(fd, TCIOFLUSH);
+			continue;
+		}
+		if (i >= PING_WARMUP)
+			ser_lat_add(&lat, ns);
+	}
+
+	ser_lat_print(name, &lat);
+	if (timeouts || bad)
+		printf("%-24s %lu timeouts, %lu mismatches\n", "", timeouts,
+		       bad);
+	ser_lat_free(&lat);
+}
+
+/*
+ * termios configurations as "vmin/vtime" list, e.g. "1/0,0/0,s/1",
+ * VMIN "s" stands for the message size.
+ */
+static int ping_parse_modes(const char *s, int *vmin, unsigned int *vtime,
+			    int max)
+{
+	char *end;
+	int n = 0;
+
+	while (*s && n < max) {
+		if (*s == 's') {
+			vmin[n] = PING_VMIN_SIZE;
+			end = (char *)s + 1;
+		} else {
+			vmin[n] = strtoul(s, &end, 0);
+		}
+		if (*end != '/')
+			return -EINVAL;
+		vtime[n++] = strtoul(end + 1, &end, 0);
+		if (*end == ',')
+			end++;
+		s = end;
+	}
+
+	return n;
+}
+
+int ser_ping(struct ser_cfg *cfg)
+{
+	int vmin[SER_MAX_LIST] = { 1 };
+	unsigned int vtime[SER_MAX_LIST] = { 0 };
+	struct ping_echo echo = { 0 };
+	struct sigaction sa = { .sa_handler = ping_alarm };
+	struct itimerval it = {
+		.it_interval = { .tv_sec = 1 },
+		.it_value = { .tv_sec = 1 },
+	};
+	int lmin = cfg->lowlat ? 0 : -1, lmax = cfg->lowlat ? 1 : -1;
+	int nmodes = 1, txfd, rxfd, m, s, l, ret;
+	pthread_t t;
+	char *msg, *rsp;
+
+	if (cfg->modes) {
+		nmodes = ping_parse_modes(cfg->modes, vmin, vtime,
+					  SER_MAX_LIST);
+		if (nmodes <= 0) {
+			fprintf(stderr, "bad termios list: %s\n", cfg->modes);
+			return -EINVAL;
+		}
+	}
+	if (!cfg->nsizes) {
+		cfg->sizes[0] = 1;
+		cfg->sizes[1] = 16;
+		cfg->sizes[2] = 64;
+		cfg->nsizes = 3;
+	}
+
+	msg = malloc(PING_MAXMSG);
+	rsp = malloc(PING_MAXMSG);
+	if (!msg || !rsp) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	ret = ser_open_pair(cfg->dev, cfg->rdev, &txfd, &rxfd);
+	if (ret)
+		goto out_free;
+	/*
+	 * The termios sweep is about the timed read. On a pty only the
+	 * slave is a terminal whose VMIN/VTIME mean anything, so the
+	 * exchange runs there and the master echoes.
+	 */
+	if (!strcmp(cfg->dev, SER_PTY)) {
+		m = txfd;
+		txfd = rxfd;
+		rxfd = m;
+	}
+
+	if (rxfd != txfd) {
+		ret = ser_setup_raw(rxfd, cfg->baud, 1, 0);
+		if (ret)
+			goto out;
+		echo.fd = rxfd;
+		pthread_create(&t, NULL, ping_echo_thread, &echo);
+	}
+
+	sigaction(SIGALRM, &sa, NULL);
+	setitimer(ITIMER_REAL, &it, NULL);
+
+	printf("ping: %s, %s, %u baud\n", cfg->dev,
+	       rxfd != txfd ? "local echo" : "loopback/remote echo",
+	       cfg->baud);
+	ser_lat_print_hdr("vmin/vtime ll size");
+
+	for (s = 0; s < cfg->nsizes && !done; s++) {
+		size_t len = cfg->sizes[s];
+
+		if (len > PING_MAXMSG)
+			len = PING_MAXMSG;
+		printf("# %zu bytes: %.1f us on the wire each way\n", len,
+		       len / ser_line_rate(cfg->baud) * 1e6);
+
+		for (m = 0; m < nmodes && !done; m++) {
+			unsigned int vm = vmin[m];
+
+			if (vmin[m] == PING_VMIN_SIZE)
+				vm = len < 255 ? len : 255;
+
+			/* -1: leave ASYNC_LOW_LATENCY alone */
+			for (l = lmin; l <= lmax; l++)
+				ping_step(cfg, txfd, vm, vtime[m], l, len, msg,
+					  rsp);
+		}
+	}
+
+	memset(&it, 0, sizeof(it));
+	setitimer(ITIMER_REAL, &it, NULL);
+
+	if (rxfd != txfd) {
+		echo.stop = 1;
+		/* the echo thread sits in read(), wake it up */
+		if (write(txfd, "", 1) < 0)
+			perror("write");
+		pthread_join(t, NULL);
+	}
+out:
+	ser_close_pair(txfd, rxfd);
+out_free:
+	free(msg);
+	free(rsp);
+	return ret;
+}
+
+/* far end of a ping run */
+int ser_echo(struct ser_cfg *cfg)
+{
+	struct ping_echo echo = { 0 };
+	int ret;
+
+	echo.fd = open(cfg->dev, O_RDWR | O_NOCTTY);
+	if (echo.fd < 0) {
+		perror(cfg->dev);
+		return -errno;
+	}
+
+	ret = ser_setup_raw(echo.fd, cfg->baud, 1, 0);
+	if (!ret) {
+		printf("echo: %s, %u baud\n", cfg->dev, cfg->baud);
+		ping_echo_thread(&echo);
+	}
+
+	close(echo.fd);
+	return ret;
+}
@@ -0,0 +1,235 @@
+/*
+ * ser-port - opening and configuring ports for the raw test modes
+ *
+ * The device name "pty" creates a pseudo terminal pair instead, so the
+ * modes can be exercised without hardware. Tx goes to the master, rx
+ * comes from the slave.
+ */
+#include <termios.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "ser.h"
+
+int ser_parse_list(const char *s, unsigned int *v, int max)
+{
+	char *end;
+	int n = 0;
+
+	while (*s && n < max) {
+		v[n++] = strtoul(s, &end, 0);
+		if (end == s)
+			return -EINVAL;
+		if (*end == ',')
+			end++;
+		s = end;
+	}
+
+	return n;
+}
+
+/* size with optional K/M/G suffix, -ERANGE if it does not fit size_t */
+int ser_parse_size(const char *s, size_t *size)
+{
+	unsigned long long v;
+	unsigned int shift = 0;
+	char *end;
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (end == s || *s == '-')
+		return -EINVAL;
+	if (errno)
+		return -errno;
+
+	switch (*end) {
+	case 'G':
+	case 'g':
+		shift += 10;
+		/* fall through */
+	case 'M':
+	case 'm':
+		shift += 10;
+		/* fall through */
+	case 'K':
+	case 'k':
+		shift += 10;
+		end++;
+	}
+	if (*end)
+		return -EINVAL;
+	if (v > (unsigned long long)SIZE_MAX >> shift)
+		return -ERANGE;
+
+	*size = v << shift;
+	return 0;
+}
+
+int ser_setup_raw(int fd, unsigned int baud, int vmin, int vtime)
+{
+	struct termios tio;
+
+	if (tcgetattr(fd, &tio))
+		return -errno;
+
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = vmin;
+	tio.c_cc[VTIME] = vtime;
+
+	tcflush(fd, TCIOFLUSH);
+	if (tcsetattr(fd, TCSANOW, &tio))
+		return -errno;
+
+	if (baud)
+		return ser_set_baud(fd, baud);
+
+	return 0;
+}
+
+int ser_open_pty(int *master, int *slave)
+{
+	int mfd, sfd;
+
+	mfd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (mfd < 0)
+		return -errno;
+
+	if (grantpt(mfd) || unlockpt(mfd)) {
+		close(mfd);
+		return -errno;
+	}
+
+	sfd = open(ptsname(mfd), O_RDWR | O_NOCTTY);
+	if (sfd < 0) {
+		close(mfd);
+		return -errno;
+	}
+
+	printf("pty slave: %s\n", ptsname(mfd));
+	*master = mfd;
+	*slave = sfd;
+	return 0;
+}
+
+/*
+ * Without rdev the port is expected to be looped back (TX wired to RX)
+ * and both ends share one descriptor.
+ */
+int ser_open_pair(const char *dev, const char *rdev, int *txfd, int *rxfd)
+{
+	int ret;
+
+	if (!strcmp(dev, SER_PTY)) {
+		ret = ser_open_pty(txfd, rxfd);
+		if (ret)
+			fprintf(stderr, "pty: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	*txfd = open(dev, O_RDWR | O_NOCTTY);
+	if (*txfd < 0) {
+		ret = -errno;
+		perror(dev);
+		return ret;
+	}
+
+	if (!rdev) {
+		*rxfd = *txfd;
+		return 0;
+	}
+
+	*rxfd = open(rdev, O_RDWR | O_NOCTTY);
+	if (*rxfd < 0) {
+		ret = -errno;
+		perror(rdev);
+		close(*txfd);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Multi port list: dev[:baud[:role]][,dev...] with role tx, rx or loop
+ * (default, the port sends and checks what comes back).
+ */
+int ser_parse_ports(const char *s, struct ser_port *ports, int max,
+		    unsigned int baud)
+{
+	char *list, *tok, *save, *f;
+	int n = 0, ret = 0;
+
+	list = strdup(s);
+	if (!list)
+		return -ENOMEM;
+
+	for (tok = strtok_r(list, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		struct ser_port *p = &ports[n];
+
+		if (n == max) {
+			fprintf(stderr, "more than %d ports\n", max);
+			ret = -EINVAL;
+			break;
+		}
+
+		p->baud = baud;
+		p->tx = p->rx = 1;
+
+		f = strchr(tok, ':');
+		if (f) {
+			*f++ = 0;
+			if (*f && *f != ':')
+				p->baud = strtoul(f, &f, 0);
+			if (*f && *f != ':')
+				p->baud = 0;
+			if (*f == ':') {
+				f++;
+				if (!strcmp(f, "tx")) {
+					p->rx = 0;
+				} else if (!strcmp(f, "rx")) {
+					p->tx = 0;
+				} else if (strcmp(f, "loop")) {
+					fprintf(stderr, "bad role: %s\n", f);
+					ret = -EINVAL;
+					break;
+				}
+			}
+		}
+		/* a zero rate would be a zero line time later on */
+		if (!p->baud) {
+			fprintf(stderr, "%s: bad baud rate\n", tok);
+			ret = -EINVAL;
+			break;
+		}
+		p->dev = strdup(tok);
+		if (!p->dev) {
+			ret = -ENOMEM;
+			break;
+		}
+		n++;
+	}
+
+	free(list);
+	if (ret) {
+		/* the ports parsed so far are not handed out */
+		while (n--) {
+			free(ports[n].dev);
+			ports[n].dev = NULL;
+		}
+		return ret;
+	}
+	return n;
+}
+
+void ser_close_pair(int txfd, int rxfd)
+{
+	if (rxfd != txfd)
+		close(rxfd);
+	close(txfd);
+}
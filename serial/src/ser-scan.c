@@ -0,0 +1,300 @@
+/*
+ * ser-scan - streaming checker for "[N].deadbeef" text frames
+ *
+ * Works directly on large raw read buffers. Line ends are located 16
+ * bytes at a time with SSE2 where available, 8 bytes at a time with
+ * word tricks otherwise. Headers are parsed by hand, frames spanning two
+ * reads are carried over in a small buffer, and the expected sequence
+ * number follows the stream across read boundaries.
+ *
+ * Accepts the frames of both the plain send loop ("[42].deadbeef") and
+ * flood mode ("[0000000042].deadbeefdeadbe..."). The first line of a
+ * stream only synchronizes, it is usually cut. A jump back by more than
+ * a small reorder window is a sender restart, the count resyncs there.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ser.h"
+
+#define SCAN_BUF	(1 << 20)
+#define SCAN_MAXLINE	sizeof(((struct ser_scan *)0)->carry)
+#define SCAN_DIGITS	10
+#define SCAN_REORDER	64	/* older frames than this mean the sender restarted */
+
+static char scan_pattern[SCAN_MAXLINE];
+
+#define ONES	0x0101010101010101ull
+#define HIGHS	0x8080808080808080ull
+
+/* index of the first '\n' in p[0..len), len when there is none */
+static size_t scan_nl(const char *p, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i nl = _mm_set1_epi8('\n');
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+		if (m)
+			return i + __builtin_ctz(m);
+	}
+#else
+	for (; i + 8 <= len; i += 8) {
+		uint64_t v, x;
+
+		memcpy(&v, p + i, 8);
+		x = v ^ ('\n' * ONES);
+		x = (x - ONES) & ~x & HIGHS;
+		if (x)
+			break;	/* exact position found below */
+	}
+#endif
+	for (; i < len; i++)
+		if (p[i] == '\n')
+			return i;
+
+	return len;
+}
+
+static void scan_line(struct ser_scan *sc, const char *p, size_t len)
+{
+	uint64_t seq = 0;
+	size_t i = 1;
+
+	sc->lines++;
+
+	if (len && p[len - 1] == '\r')
+		len--;
+
+	if (len < 4 || p[0] != '[')
+		goto bad;
+
+	while (i < len && i <= SCAN_DIGITS && p[i] >= '0' && p[i] <= '9')
+		seq = seq * 10 + (p[i++] - '0');
+
+	if (i == 1 || i + 1 >= len || p[i] != ']' || p[i + 1] != '.')
+		goto bad;
+	i += 2;
+
+	/* payload length is constant within a stream */
+	if (len - i < 8 || len - i > sizeof(scan_pattern) ||
+	    (sc->synced && len - i != sc->plen) ||
+	    memcmp(p + i, scan_pattern, len - i))
+		goto bad;
+
+	sc->frames++;
+	if (!sc->synced) {
+		sc->synced = 1;
+		sc->plen = len - i;
+	} else if (seq > sc->expect) {
+		/* frames that arrived damaged are not lost */
+		uint64_t missing = seq - sc->expect;
+
+		if (missing > sc->bad_run) {
+			sc->gaps++;
+			sc->lost += missing - sc->bad_run;
+		}
+	} else if (seq + SCAN_REORDER < sc->expect) {
+		sc->restarts++;
+	} else if (seq < sc->expect) {
+		sc->late++;
+		sc->bad_run = 0;
+		return;
+	}
+	sc->expect = seq + 1;
+	sc->bad_run = 0;
+	return;
+
+bad:
+	/* a cut first line is expected, it only synchronizes */
+	if (sc->synced) {
+		sc->corrupt++;
+		sc->bad_run++;
+	} else {
+		sc->skipped++;
+	}
+}
+
+void ser_scan_init(struct ser_scan *sc)
+{
+	size_t i;
+
+	memset(sc, 0, sizeof(*sc));
+	for (i = 0; i < sizeof(scan_pattern); i++)
+		scan_pattern[i] = "deadbeef"[i % 8];
+}
+
+void ser_scan_feed(struct ser_scan *sc, const char *buf, size_t len)
+{
+	size_t pos = 0, nl;
+
+	__atomic_store_n(&sc->bytes, sc->bytes + len, __ATOMIC_RELAXED);
+
+	/* complete the line carried over from the last buffer */
+	if (sc->carry_len || sc->overlong) {
+		nl = scan_nl(buf, len);
+		if (!sc->overlong && sc->carry_len + nl <= SCAN_MAXLINE) {
+			memcpy(sc->carry + sc->carry_len, buf, nl);
+			sc->carry_len += nl;
+		} else {
+			sc->overlong = 1;
+		}
+		if (nl == len)
+			return;
+
+		if (sc->overlong) {
+			/* never a valid frame, let the checks count it */
+			scan_line(sc, "", 0);
+		} else {
+			scan_line(sc, sc->carry, sc->carry_len);
+		}
+		sc->carry_len = 0;
+		sc->overlong = 0;
+		pos = nl + 1;
+	}
+
+	while (pos < len) {
+		nl = scan_nl(buf + pos, len - pos);
+		if (pos + nl == len) {
+			if (nl <= SCAN_MAXLINE) {
+				memcpy(sc->carry, buf + pos, nl);
+				sc->carry_len = nl;
+			} else {
+				sc->overlong = 1;
+			}
+			break;
+		}
+		scan_line(sc, buf + pos, nl);
+		pos += nl + 1;
+	}
+}
+
+void ser_scan_report(struct ser_scan *sc)
+{
+	printf("scan: %llu bytes, %llu lines, %llu frames, %llu gaps, "
+	       "%llu lost, %llu late, %llu restarts, %llu corrupt, "
+	       "%llu skipped\n",
+	       sc->bytes, sc->lines, sc->frames, sc->gaps, sc->lost,
+	       sc->late, sc->restarts, sc->corrupt, sc->skipped);
+}
+
+/* replay a capture file as fast as possible */
+static int scan_file(struct ser_scan *sc, int fd, char *buf)
+{
+	double t = 0, t0;
+	ssize_t n;
+
+	while ((n = read(fd, buf, SCAN_BUF)) > 0 && !done) {
+		t0 = ser_now();
+		ser_scan_feed(sc, buf, n);
+		t += ser_now() - t0;
+	}
+	if (n < 0) {
+		perror("read");
+		return -errno;
+	}
+
+	ser_scan_report(sc);
+	if (t > 0)
+		printf("scan: %.1f MB/s parse rate\n", sc->bytes / t / 1e6);
+
+	return 0;
+}
+
+static int scan_tty(struct ser_scan *sc, int fd, char *buf,
+		    struct ser_cfg *cfg)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct ser_stats *st;
+	double t0, tlast, now;
+	ssize_t n;
+	int ret = 0;
+
+	st = ser_stats_open(cfg);
+	ser_stats_add(st, fd, cfg->dev, &sc->bytes, NULL);
+	ser_stats_start(st);
+
+	t0 = tlast = ser_now();
+	while (!done) {
+		int rv = poll(&pfd, 1, 100);
+
+		if (rv < 0 && errno != EINTR) {
+			ret = -errno;
+			perror("poll");
+			break;
+		}
+
+		now = ser_now();
+		if (rv > 0) {
+			n = read(fd, buf, SCAN_BUF);
+			if (n < 0 && errno != EAGAIN && errno != EINTR) {
+				ret = -errno;
+				perror("read");
+				break;
+			}
+			if (n > 0)
+				ser_scan_feed(sc, buf, n);
+		}
+
+		if (now - tlast >= 1.0) {
+			ser_scan_report(sc);
+			tlast = now;
+		}
+		if (cfg->secs && now - t0 >= cfg->secs)
+			break;
+	}
+
+	ser_stats_stop(st);
+	ser_scan_report(sc);
+	return ret;
+}
+
+int ser_scan(struct ser_cfg *cfg)
+{
+	struct ser_scan *sc;
+	struct stat st;
+	char *buf;
+	int fd, ret;
+
+	fd = open(cfg->dev, O_RDONLY | O_NOCTTY);
+	if (fd < 0) {
+		perror(cfg->dev);
+		return -errno;
+	}
+
+	sc = malloc(sizeof(*sc));
+	buf = malloc(SCAN_BUF);
+	if (!sc || !buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	ser_scan_init(sc);
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+		ret = scan_file(sc, fd, buf);
+	} else {
+		ret = ser_setup_raw(fd, cfg->baud, 1, 0);
+		if (!ret)
+			ret = scan_tty(sc, fd, buf, cfg);
+	}
+
+out:
+	free(buf);
+	free(sc);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,242 @@
+/*
+ * ser-stats - periodic UART telemetry
+ *
+ * A sampler thread wakes on absolute deadlines and records, per port,
+ * the driver interrupt counters (TIOCGICOUNT), the modem lines, the
+ * rx/tx queue depths and the byte counters of the running ser mode. It
+ * only reads, the test loops are never locked or slowed down. One line
+ * per port and sample:
+ *
+ *   t[ms] port rx tx frame overrun parity brk buf_overrun inq outq
+ *   modem ser_rx ser_tx
+ *
+ * t is relative to the CLOCK_REALTIME start stamp in the header.
+ * Driver counters are absolute, "-" where the driver has none (ptys).
+ * Modem lines are printed as TRCSDI (DTR RTS CTS DSR DCD RI), '-' when
+ * the line is inactive.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+#include "ser.h"
+
+#define STATS_MAX_PORTS	SER_MAX_LIST
+
+struct stats_port {
+	int fd;
+	char name[32];
+	unsigned long long *rx, *tx;
+	int no_icount;
+};
+
+struct ser_stats {
+	struct stats_port port[STATS_MAX_PORTS];
+	int nports;
+	unsigned int interval_ms;
+	FILE *fp;
+	int running;
+	pthread_t thread;
+};
+
+static unsigned long long stats_load(unsigned long long *p)
+{
+	return p ? __atomic_load_n(p, __ATOMIC_RELAXED) : 0;
+}
+
+static void stats_sample(struct ser_stats *st, struct stats_port *p,
+			 unsigned long ms)
+{
+	static const struct {
+		int bit;
+		char c;
+	} lines[] = {
+		{ TIOCM_DTR, 'T' }, { TIOCM_RTS, 'R' }, { TIOCM_CTS, 'C' },
+		{ TIOCM_DSR, 'S' }, { TIOCM_CD, 'D' }, { TIOCM_RI, 'I' },
+	};
+	struct serial_icounter_struct ic;
+	char modem[sizeof(lines) / sizeof(lines[0]) + 1];
+	int inq = -1, outq = -1, mbits, i;
+
+	ioctl(p->fd, TIOCINQ, &inq);
+	ioctl(p->fd, TIOCOUTQ, &outq);
+
+	if (ioctl(p->fd, TIOCMGET, &mbits))
+		mbits = 0;
+	for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+		modem[i] = mbits & lines[i].bit ? lines[i].c : '-';
+	modem[i] = 0;
+
+	fprintf(st->fp, "%lu %s ", ms, p->name);
+	if (!p->no_icount && !ioctl(p->fd, TIOCGICOUNT, &ic)) {
+		fprintf(st->fp, "%d %d %d %d %d %d %d ", ic.rx, ic.tx,
+			ic.frame, ic.overrun, ic.parity, ic.brk,
+			ic.buf_overrun);
+	} else {
+		/* don't retry ioctls the driver does not know */
+		p->no_icount = 1;
+		fprintf(st->fp, "- - - - - - - ");
+	}
+	fprintf(st->fp, "%d %d %s %llu %llu\n", inq, outq, modem,
+		stats_load(p->rx), stats_load(p->tx));
+}
+
+static void *stats_thread(void *arg)
+{
+	struct ser_stats *st = arg;
+	struct timespec t0, next, now;
+	unsigned long ms;
+	int i;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	next = t0;
+
+	while (1) {
+		next.tv_nsec += st->interval_ms % 1000 * 1000000L;
+		next.tv_sec += st->interval_ms / 1000 +
+			       next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+		/* only the sleep may be cancelled, never a half written line */
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (now.tv_sec - t0.tv_sec) * 1000 +
+		     (now.tv_nsec - t0.tv_nsec) / 1000000;
+		for (i = 0; i < st->nports; i++)
+			stats_sample(st, &st->port[i], ms);
+		fflush(st->fp);
+	}
+
+	return NULL;
+}
+
+/* NULL when telemetry is off, all other calls accept that */
+struct ser_stats *ser_stats_open(struct ser_cfg *cfg)
+{
+	struct ser_stats *st;
+
+	if (!cfg->stats_ms)
+		return NULL;
+
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return NULL;
+
+	st->interval_ms = cfg->stats_ms;
+	st->fp = stdout;
+	if (cfg->stats_file) {
+		st->fp = fopen(cfg->stats_file, "w");
+		if (!st->fp) {
+			perror(cfg->stats_file);
+			free(st);
+			return NULL;
+		}
+	}
+
+	return st;
+}
+
+void ser_stats_add(struct ser_stats *st, int fd, const char *name,
+		   unsigned long long *rx, unsigned long long *tx)
+{
+	struct stats_port *p;
+	const char *base;
+
+	if (!st || st->nports == STATS_MAX_PORTS)
+		return;
+
+	base = strncmp(name, "/dev/", 5) ? name : name + 5;
+	p = &st->port[st->nports++];
+	p->fd = fd;
+	snprintf(p->name, sizeof(p->name), "%s", base);
+	p->rx = rx;
+	p->tx = tx;
+}
+
+void ser_stats_start(struct ser_stats *st)
+{
+	struct timespec ts;
+
+	if (!st)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	fprintf(st->fp, "# start %lu.%06lu, interval %u ms\n",
+		(unsigned long)ts.tv_sec, ts.tv_nsec / 1000, st->interval_ms);
+	fprintf(st->fp, "# t[ms] port rx tx frame overrun parity brk "
+		"buf_overrun inq outq modem ser_rx ser_tx\n");
+	if (pthread_create(&st->thread, NULL, stats_thread, st))
+		fprintf(stderr, "stats: thread start failed\n");
+	else
+		st->running = 1;
+}
+
+void ser_stats_stop(struct ser_stats *st)
+{
+	if (!st)
+		return;
+
+	if (st->running) {
+		pthread_cancel(st->thread);
+		pthread_join(st->thread, NULL);
+	}
+	if (st->fp != stdout)
+		fclose(st->fp);
+	free(st);
+}
+
+/* sample a port that is driven by someone else */
+int ser_stats_mode(struct ser_cfg *cfg)
+{
+	struct ser_stats *st;
+	sigset_t mask, old;
+	int fd;
+
+	if (!cfg->stats_ms)
+		cfg->stats_ms = 1000;
+
+	fd = open(cfg->dev, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(cfg->dev);
+		return -errno;
+	}
+
+	st = ser_stats_open(cfg);
+	if (!st) {
+		close(fd);
+		return -ENOMEM;
+	}
+	ser_stats_add(st, fd, cfg->dev, NULL, NULL);
+
+	/*
+	 * Blocked before the sampler thread inherits the mask and taken
+	 * with sigwaitinfo(): a signal between a check of done and pause()
+	 * would otherwise be slept through.
+	 */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	ser_stats_start(st);
+
+	while (!done && sigwaitinfo(&mask, NULL) < 0 && errno == EINTR)
+		;
+
+	ser_stats_stop(st);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	close(fd);
+	return 0;
+}
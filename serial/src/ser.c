@@ -8,66 +8,68 @@
 #include <string.h>
 #include <signal.h>
 #include <getopt.h>
-#include <stdarg.h>
 #include <time.h>
 #include <math.h>
-#include <ctype.h>
+#include <errno.h>
 
+#include "ser.h"
+#include "dmec-trace.h"
 
-#define BAUDRATE B115200
 #define LOGNAME "ser.log"
 #define BILLION  1000000000.0
 
 volatile sig_atomic_t done = 0;
 
-#if 0
-static void log_print(FILE *fp, char *fmt, ... )
-{
-	va_list args, args_tmp;
-	struct timespec ts;
-	char *fmt_tmp = fmt;
-
-	if (!fp)
-		return;
-
-	va_start(args, fmt);
-	va_copy(args_tmp, args);
-	clock_gettime(CLOCK_REALTIME, &ts);
-	fprintf(fp, "[%08lu.%06lu] ",
-		    (unsigned long)ts.tv_sec, ts.tv_nsec / 1000);
-	fprintf(stdout, "[%08lu.%06lu] ",
-			(unsigned long)ts.tv_sec, ts.tv_nsec / 1000);
-	vfprintf(fp, fmt_tmp, args_tmp);
-	vfprintf(stdout, fmt, args);
-	fflush(stdout);
-	fsync(fileno(fp));
-	va_end(args);
-	va_end(args_tmp);
-}
-
-/* last byte in buf should be zero */
-static void ser_print(FILE *fp, char *buf, size_t bsz)
-{
-	int i;
-
-	/* filter non print chars without CR and ESC */
-	for (i = 0; i < bsz; i++)
-		if (!isprint(buf[i]) &&  buf[i] != 0xa && buf[i] != 0x1b)
-			buf[i]=' ';
-
-	log_print(fp, "%s", buf);
-	fsync(fileno(fp));
-}
-#endif
-
 static void usage()
 {
-	printf("\nUsage: ser -d device [-s] -f file\n\n");
-	printf("   -d device	serial device\n"
+	printf("\nUsage: ser -d device [-s] -f file [-m mode] [options]\n\n");
+	printf("   -d device	serial device (\"pty\" for a pseudo terminal pair)\n"
 	       "   -s		send\n"
 	       "   -f file	complete path name of logile\n"
+	       "   -F size	keep the receive log as a fixed size circular\n"
+	       "		file (K/M/G suffixes allowed)\n"
+	       "   -b baud	line rate, non-standard rates allowed (default %u)\n"
+	       "   -m mode	bench: raw throughput sweep\n"
+	       "		flood: saturating sender\n"
+	       "		duplex: full duplex loopback with sequence/CRC check\n"
+	       "		multi: duplex test over a list of ports, -d takes\n"
+	       "		dev[:baud[:tx|rx|loop]][,dev...]\n"
+	       "		scan: check [N].deadbeef frames for gaps and\n"
+	       "		corruption, device or replayed capture file\n"
+	       "		stats: only sample telemetry of a port\n"
+	       "		ping: request/response turnaround per message size\n"
+	       "		and termios setting\n"
+	       "		echo: far end for ping\n"
+	       "   -r device	receive device, other end of the link\n"
+	       "		(default: device looped back on itself)\n"
+	       "   -R list	bench: comma separated rates to sweep\n"
+	       "   -P list	bench: comma separated payload sizes\n"
+	       "		flood: frame size, duplex/multi: payload size\n"
+	       "		ping: message sizes\n"
+	       "   -t secs	duration of one measurement step (bench default 5,\n"
+	       "		otherwise run until interrupted)\n"
+	       "   -T rate	flood, duplex, multi: hold this rate in bytes/s\n"
+	       "   -Q bytes	flood, duplex, multi: tx queue fill target\n"
+	       "   -i ms	sample UART counters, queues and modem lines\n"
+	       "		every ms milliseconds\n"
+	       "   -I file	write telemetry samples to file (default stdout)\n"
+	       "   -n count	ping: exchanges per step (default 1000)\n"
+	       "   -V list	ping: termios settings to compare as\n"
+	       "		vmin/vtime,... (vmin \"s\": message size)\n"
+	       "   -L		ping: run each setting with and without\n"
+	       "		ASYNC_LOW_LATENCY\n"
+	       "   -C		duplex, multi: COBS framing with CRC-32C instead\n"
+	       "		of sync bytes\n"
+	       "   With %s=dir set, transfers and frames are recorded\n"
+	       "   for dmec-trace-merge.\n"
 	       "   Example:\n"
-	       "     ser -d /dev/ttyUSB0 \n\n");
+	       "     ser -d /dev/ttyUSB0 \n"
+	       "     ser -d pty -m bench -R 115200,921600 -P 16,4096\n"
+	       "     ser -d /dev/ttyS1 -m flood -b 3000000 -P 64\n"
+	       "     ser -d /dev/ttyS1 -r /dev/ttyS2 -m duplex -t 60\n"
+	       "     ser -d /dev/ttyS1:921600,/dev/ttyS2,/dev/ttyS3::rx -m multi\n"
+	       "     ser -d /dev/ttyS1 -m ping -P 1,16,64 -V 1/0,s/0,0/1 -L\n\n",
+	       SER_DEF_BAUD, DMEC_TRACE_ENV);
 }
 
 /* TODO: make this thread safe */
@@ -75,32 +77,8 @@ static void term(int signum)
 {
     done = 1;
 }
-static int ser_setup_serial(int fd, struct termios *oldtio)
-{
-	struct termios newtio;
-
-	tcgetattr(fd, oldtio);
-
-	memset(&newtio, 0, sizeof(newtio));
-
-	newtio.c_cflag = BAUDRATE | CS8 | CLOCAL | CREAD;
-	newtio.c_iflag = IGNPAR | IGNCR;
-	newtio.c_oflag = ONOCR | OCRNL;
-	newtio.c_lflag = ICANON;
-
-	// block for up till 128 characters
-	newtio.c_cc[VMIN] = 1;
-
-	// 0.5 seconds read timeout
-	newtio.c_cc[VTIME] = 1;
-
-	tcflush(fd, TCIFLUSH);
-	tcsetattr(fd, TCSANOW, &newtio);
-
-	return 0;
-}
 
-static int ser_read_line(int fd, char *buf, size_t bsz)
+static int ser_wait_readable(int fd)
 {
 	fd_set rfds;
 	struct timeval tv;
@@ -111,77 +89,116 @@ static int ser_read_line(int fd, char *buf, size_t bsz)
 	tv.tv_usec = 500*1000;
 
 	int rv = select(fd+1, &rfds, NULL, NULL, &tv);
-	if (0 > rv) {
+	if (0 > rv && errno != EINTR) {
 		perror("select()");
 		return -1;
 	}
-	if (0 < rv) {
-		int n = read(fd, buf, bsz-1);
-		if (n > 0)
-			buf[n] = 0;
-		return n;
-	}
 
-	return 0;
+	return rv > 0;
 }
 
-static void ser_send_loop(int fd, const char *lfn)
+static void ser_send_loop(int fd, struct ser_cfg *cfg)
 {
-	unsigned int nbs = 0, i = 0;
-	FILE *fp = fopen(lfn, "w+");
-	if (!fp)
-		perror("fopen");
+	unsigned long long nbs = 0;
+	unsigned int i = 0;
+	struct ser_stats *st;
+
+	st = ser_stats_open(cfg);
+	ser_stats_add(st, fd, cfg->dev, NULL, &nbs);
+	ser_stats_start(st);
 
 	printf("sending loop\n");
-	while(fp && !done) {
+	while (!done) {
 		char buf[256];
 		snprintf(buf, sizeof(buf)-1, "[%d].deadbeef\n", i++);
+		uint64_t t0 = dmec_trace_begin();
 		int n = write(fd, buf, strlen(buf));
+		dmec_trace_end("serial", "write", t0, n);
 		if (0 > n) {
 			perror("select()");
 			break;
 		}
-		nbs += n;
-		printf("bytes sent: %20s bytes: %-40d \n", buf, nbs);
+		__atomic_store_n(&nbs, nbs + n, __ATOMIC_RELAXED);
+		printf("bytes sent: %20s bytes: %-40llu \n", buf, nbs);
 		usleep(50*1000);
 	}
 
-	if (fp)
-		fclose(fp);
+	ser_stats_stop(st);
 }
 
-static void ser_recv_loop(int fd, const char *lfn)
+static int ser_recv_loop(int fd, struct ser_cfg *cfg)
 {
-	unsigned int nbr = 0;
-	FILE *fp = fopen(lfn, "w+");
-	if (!fp)
-		perror("fopen");
+	unsigned long long nbr = 0;
+	struct ser_stats *st;
+	struct ser_log *log = ser_log_open(cfg->logfile, cfg->logsize);
+	if (!log)
+		return -EIO;
+
+	st = ser_stats_open(cfg);
+	ser_stats_add(st, fd, cfg->dev, &nbr, NULL);
+	ser_stats_start(st);
 
 	printf("recving loop\n");
-	while(fp && !done) {
-		char buf[256];
-		int n = ser_read_line(fd, buf, sizeof(buf)-1);
+	while (!done) {
+		int rv = ser_wait_readable(fd);
+		if (0 > rv)
+			break;
+		if (!rv)
+			continue;
+
+		uint64_t t0 = dmec_trace_begin();
+
+		if (ser_log_splicing(log)) {
+			ssize_t n = ser_log_splice(log, fd);
+			dmec_trace_end("serial", "splice", t0, n);
+			if (n == -EINVAL) {
+				/* tty without splice support */
+				ser_log_fallback(log);
+				continue;
+			}
+			if (0 > n && n != -EAGAIN && n != -EINTR) {
+				fprintf(stderr, "splice: %s\n", strerror(-n));
+				break;
+			}
+			if (n > 0) {
+				__atomic_store_n(&nbr, nbr + n, __ATOMIC_RELAXED);
+				printf("bytes recv'd: %40llu\n", nbr);
+			}
+			continue;
+		}
+
+		size_t len;
+		char *buf = ser_log_reserve(log, &len);
+		int n = read(fd, buf, len);
+		dmec_trace_end("serial", "read", t0, n);
 		if (0 > n) {
-			perror("select()");
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			perror("read()");
 			break;
 		}
 		if (n > 0) {
-			nbr += n;
-			printf("bytes recv'd: %20s bytes: %40d\n", buf, nbr);
+			ser_log_commit(log, buf, n);
+			__atomic_store_n(&nbr, nbr + n, __ATOMIC_RELAXED);
+			printf("bytes recv'd: %20.*s bytes: %40llu\n",
+			       n, buf, nbr);
 		}
 	}
 
-	if (fp)
-		fclose(fp);
+	ser_stats_stop(st);
+	return ser_log_close(log);
 }
 
 int main(int argc, char **argv)
 {
-	int fd;
+	int fd, ret = 0;
 	struct termios oldtio;
 	struct sigaction action;
-	int c, send = 0;
-	char *dev = NULL, *logfile = NULL;
+	int c, send = 0, bad_size = 0;
+	char *mode = NULL;
+	struct ser_cfg cfg = {
+		.baud = SER_DEF_BAUD,
+	};
 
 	while (1) {
 		int option_index = 0;
@@ -190,10 +207,25 @@ int main(int argc, char **argv)
 			{"s", no_argument, 0, 1},
 			{"f", required_argument, 0, 2},
 			{"help", no_argument, 0, 3},
+			{"b", required_argument, 0, 5},
+			{"m", required_argument, 0, 6},
+			{"r", required_argument, 0, 7},
+			{"R", required_argument, 0, 8},
+			{"P", required_argument, 0, 9},
+			{"t", required_argument, 0, 10},
+			{"T", required_argument, 0, 11},
+			{"Q", required_argument, 0, 12},
+			{"F", required_argument, 0, 13},
+			{"i", required_argument, 0, 14},
+			{"I", required_argument, 0, 15},
+			{"n", required_argument, 0, 16},
+			{"V", required_argument, 0, 17},
+			{"L", no_argument, 0, 18},
+			{"C", no_argument, 0, 19},
 			{0, 0, 0, 4}
 		};
 
-		c = getopt_long(argc, argv, "d:sf:",
+		c = getopt_long(argc, argv, "d:sf:b:m:r:R:P:t:T:Q:F:i:I:n:V:LC",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -201,7 +233,7 @@ int main(int argc, char **argv)
 		switch (c) {
 		case 0:
 		case 'd':
-			dev = strdup(optarg);
+			cfg.dev = strdup(optarg);
 			break;
 		case 1:
 		case 's':
@@ -209,7 +241,69 @@ int main(int argc, char **argv)
 			break;
 		case 2:
 		case 'f':
-			logfile = strdup(optarg);
+			cfg.logfile = strdup(optarg);
+			break;
+		case 5:
+		case 'b':
+			cfg.baud = strtoul(optarg, NULL, 0);
+			break;
+		case 6:
+		case 'm':
+			mode = strdup(optarg);
+			break;
+		case 7:
+		case 'r':
+			cfg.rdev = strdup(optarg);
+			break;
+		case 8:
+		case 'R':
+			cfg.nrates = ser_parse_list(optarg, cfg.rates,
+						    SER_MAX_LIST);
+			break;
+		case 9:
+		case 'P':
+			cfg.nsizes = ser_parse_list(optarg, cfg.sizes,
+						    SER_MAX_LIST);
+			break;
+		case 10:
+		case 't':
+			cfg.secs = strtoul(optarg, NULL, 0);
+			break;
+		case 11:
+		case 'T':
+			cfg.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 12:
+		case 'Q':
+			cfg.qtarget = strtoul(optarg, NULL, 0);
+			break;
+		case 13:
+		case 'F':
+			bad_size = ser_parse_size(optarg, &cfg.logsize);
+			break;
+		case 14:
+		case 'i':
+			cfg.stats_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 15:
+		case 'I':
+			cfg.stats_file = strdup(optarg);
+			break;
+		case 16:
+		case 'n':
+			cfg.count = strtoul(optarg, NULL, 0);
+			break;
+		case 17:
+		case 'V':
+			cfg.modes = strdup(optarg);
+			break;
+		case 18:
+		case 'L':
+			cfg.lowlat = 1;
+			break;
+		case 19:
+		case 'C':
+			cfg.cobs = 1;
 			break;
 		case 'h':
 		case 4:
@@ -217,40 +311,75 @@ int main(int argc, char **argv)
 		default:
 			usage();
 		}
-		if (optind == 6)
-			break;
 	}
 
-	if (!dev) {
+	if (!cfg.dev || cfg.nrates < 0 || cfg.nsizes < 0 || bad_size) {
 		usage();
 		goto end;
 	}
 
-	if (!logfile)
-		logfile = strdup(LOGNAME);
+	if (!cfg.logfile)
+		cfg.logfile = strdup(LOGNAME);
 
 	memset(&action, 0, sizeof(struct sigaction));
 	action.sa_handler = term;
 	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	dmec_trace_open("ser");
+
+	if (mode) {
+		if (!strcmp(mode, "bench")) {
+			ret = ser_bench(&cfg);
+		} else if (!strcmp(mode, "flood")) {
+			ret = ser_flood(&cfg);
+		} else if (!strcmp(mode, "duplex")) {
+			ret = ser_duplex(&cfg);
+		} else if (!strcmp(mode, "multi")) {
+			ret = ser_multi(&cfg);
+		} else if (!strcmp(mode, "scan")) {
+			ret = ser_scan(&cfg);
+		} else if (!strcmp(mode, "stats")) {
+			ret = ser_stats_mode(&cfg);
+		} else if (!strcmp(mode, "ping")) {
+			ret = ser_ping(&cfg);
+		} else if (!strcmp(mode, "echo")) {
+			ret = ser_echo(&cfg);
+		} else {
+			fprintf(stderr, "unknown mode: %s\n", mode);
+			usage();
+			ret = -1;
+		}
+		goto end;
+	}
 
-	fd = open(dev, O_RDWR);
+	fd = open(cfg.dev, O_RDWR);
 	if (0 > fd) {
 		perror("open");
 		exit(1);
 	}
 
-	ser_setup_serial(fd, &oldtio);
+	tcgetattr(fd, &oldtio);
+	ret = ser_setup_raw(fd, cfg.baud, 1, 0);
+	if (ret) {
+		fprintf(stderr, "termios setup failed: %s\n", strerror(-ret));
+		close(fd);
+		goto end;
+	}
 
 	if (send)
-		ser_send_loop(fd, logfile);
+		ser_send_loop(fd, &cfg);
 	else
-		ser_recv_loop(fd, logfile);
+		ret = ser_recv_loop(fd, &cfg);
 
 	tcsetattr(fd,TCSANOW, &oldtio);
 
 end:
-	free(dev);
-	free(logfile);
-
-	return 0;
+	free(cfg.dev);
+	free(cfg.rdev);
+	free(mode);
+	free(cfg.logfile);
+	free(cfg.stats_file);
+	free(cfg.modes);
+
+	return ret ? 1 : 0;
 }
@@ -0,0 +1,192 @@
+/*
+ * ser - serial test tool, shared definitions
+ */
+#ifndef _SER_H_
+#define _SER_H_
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define SER_DEF_BAUD	115200
+#define SER_MAX_LIST	16
+#define SER_PTY		"pty"
+
+/* "[0000000042].deadbeef\n" test frames */
+#define SER_FRAME_DIGITS	10
+#define SER_FRAME_HDR		(SER_FRAME_DIGITS + 3)
+#define SER_FRAME_MIN		(SER_FRAME_HDR + 9)
+
+extern volatile sig_atomic_t done;
+
+struct ser_port {
+	char *dev;
+	unsigned int baud;
+	int tx, rx;		/* role of the port in multi port runs */
+};
+
+struct ser_cfg {
+	char *dev;		/* primary (tx) device */
+	char *rdev;		/* optional rx device, e.g. other end of a link */
+	char *logfile;
+	size_t logsize;		/* circular log size, 0: plain log file */
+	unsigned int baud;
+	unsigned int rates[SER_MAX_LIST];
+	int nrates;
+	unsigned int sizes[SER_MAX_LIST];
+	int nsizes;
+	unsigned int secs;	/* duration of one measurement step */
+	unsigned int rate;	/* token bucket limit in bytes/s, 0: none */
+	unsigned int qtarget;	/* tx queue fill target in bytes */
+	unsigned int stats_ms;	/* telemetry interval, 0: off */
+	char *stats_file;
+	unsigned int count;	/* exchanges per ping step */
+	char *modes;		/* ping: "vmin/vtime,..." */
+	int lowlat;		/* ping: also try ASYNC_LOW_LATENCY */
+	int cobs;		/* duplex/multi: COBS framed frames */
+};
+
+static inline double ser_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline uint64_t ser_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* bits on the wire per character for 8N1 */
+static inline double ser_line_rate(unsigned int baud)
+{
+	return baud / 10.0;
+}
+
+/* ser-baud.c */
+int ser_set_baud(int fd, unsigned int baud);
+int ser_get_baud(int fd, unsigned int *baud);
+
+/* ser-port.c */
+int ser_parse_list(const char *s, unsigned int *v, int max);
+int ser_parse_size(const char *s, size_t *size);
+int ser_setup_raw(int fd, unsigned int baud, int vmin, int vtime);
+int ser_parse_ports(const char *s, struct ser_port *ports, int max,
+		    unsigned int baud);
+int ser_open_pty(int *master, int *slave);
+int ser_open_pair(const char *dev, const char *rdev, int *txfd, int *rxfd);
+void ser_close_pair(int txfd, int rxfd);
+
+/* ser-bench.c */
+int ser_bench(struct ser_cfg *cfg);
+
+/* ser-flood.c */
+void ser_frame_init(char *frame, size_t flen, unsigned int seq);
+void ser_frame_stamp(char *frame, unsigned int seq);
+int ser_flood(struct ser_cfg *cfg);
+
+/* ser-crc.c */
+typedef uint32_t (*ser_crc32c_fn)(uint32_t crc, const void *buf, size_t len);
+
+void ser_crc32c_init(void);
+uint32_t ser_crc32c(uint32_t crc, const void *buf, size_t len);
+uint32_t ser_crc32c_byte(uint32_t crc, const void *buf, size_t len);
+uint32_t ser_crc32c_sb8(uint32_t crc, const void *buf, size_t len);
+ser_crc32c_fn ser_crc32c_get_hw(void);
+const char *ser_crc32c_impl(void);
+
+/* ser-cobs.c */
+#define SER_COBS_CRC	4
+/* worst case wire size of a payload, including CRC and delimiter */
+#define SER_COBS_MAX(len) \
+	((len) + SER_COBS_CRC + ((len) + SER_COBS_CRC) / 254 + 2)
+
+struct iovec;
+
+struct ser_cobs_dec {
+	uint8_t *buf;
+	size_t len, cap;
+	uint8_t code;		/* code byte of the current block */
+	uint8_t left;		/* data bytes left in the current block */
+	int drop;		/* frame overflowed, discard up to delimiter */
+	unsigned long long frames, crc_err, too_long, bad;
+};
+
+typedef void (*ser_cobs_cb)(void *arg, const uint8_t *frame, size_t len);
+
+size_t ser_cobs_encode(uint8_t *dst, const struct iovec *iov, int cnt);
+int ser_cobs_dec_init(struct ser_cobs_dec *dec, size_t max);
+void ser_cobs_dec_free(struct ser_cobs_dec *dec);
+void ser_cobs_decode(struct ser_cobs_dec *dec, const uint8_t *p, size_t len,
+		     ser_cobs_cb cb, void *arg);
+
+/* ser-lat.c */
+struct ser_lat {
+	uint64_t *v;
+	size_t n, cap;
+	uint64_t seen;
+	uint64_t min, max, sum;
+	uint64_t rnd;
+	int sorted;
+};
+
+int ser_lat_init(struct ser_lat *l, size_t cap);
+void ser_lat_free(struct ser_lat *l);
+void ser_lat_add(struct ser_lat *l, uint64_t ns);
+uint64_t ser_lat_pct(struct ser_lat *l, double pct);
+void ser_lat_print_hdr(const char *name);
+void ser_lat_print(const char *name, struct ser_lat *l);
+
+/* ser-duplex.c */
+int ser_duplex(struct ser_cfg *cfg);
+int ser_multi(struct ser_cfg *cfg);
+
+/* ser-scan.c */
+struct ser_scan {
+	unsigned long long bytes, lines, frames;
+	unsigned long long gaps, lost, late, restarts, corrupt, skipped;
+	uint64_t expect;
+	uint64_t bad_run;	/* corrupt lines since the last good frame */
+	size_t plen;
+	int synced;
+	int overlong;
+	size_t carry_len;
+	char carry[4096];
+};
+
+void ser_scan_init(struct ser_scan *sc);
+void ser_scan_feed(struct ser_scan *sc, const char *buf, size_t len);
+void ser_scan_report(struct ser_scan *sc);
+int ser_scan(struct ser_cfg *cfg);
+
+/* ser-stats.c */
+struct ser_stats;
+struct ser_stats *ser_stats_open(struct ser_cfg *cfg);
+void ser_stats_add(struct ser_stats *st, int fd, const char *name,
+		   unsigned long long *rx, unsigned long long *tx);
+void ser_stats_start(struct ser_stats *st);
+void ser_stats_stop(struct ser_stats *st);
+int ser_stats_mode(struct ser_cfg *cfg);
+
+/* ser-ping.c */
+int ser_ping(struct ser_cfg *cfg);
+int ser_echo(struct ser_cfg *cfg);
+
+/* ser-log.c */
+struct ser_log;
+struct ser_log *ser_log_open(const char *path, size_t ring_size);
+void ser_log_fallback(struct ser_log *l);
+int ser_log_splicing(struct ser_log *l);
+ssize_t ser_log_splice(struct ser_log *l, int fd);
+char *ser_log_reserve(struct ser_log *l, size_t *len);
+void ser_log_commit(struct ser_log *l, const char *p, size_t n);
+int ser_log_close(struct ser_log *l);
+
+#endif /* _SER_H_ */
@@ -0,0 +1,367 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-trace-merge - merge DMEC tool recordings into one timeline
+ *
+ * Writes the Chrome trace event format (JSON object form), which both
+ * ui.perfetto.dev and chrome://tracing open. Every recording becomes a
+ * process, its threads keep their names. All recordings share
+ * CLOCK_MONOTONIC, the timeline starts at the earliest event unless -a
+ * asks for the raw clock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "dmec-trace.h"
+
+#define MAX_STR		65536
+
+struct recording {
+	const char *path;
+	struct dmec_trace_hdr hdr;
+	char *data;
+	size_t len;
+	char **str;			/* by id */
+	unsigned long events;
+};
+
+static struct recording *recs;
+static unsigned int nrecs;
+static int absolute;
+
+static void usage(void)
+{
+	printf("\nUsage: dmec-trace-merge [OPTION]... file|dir...\n\n");
+	printf("   -o file          output file (default stdout)\n");
+	printf("   -a               absolute CLOCK_MONOTONIC timestamps\n");
+	printf("   -h               this help\n");
+	printf("A directory stands for all .dtr files in it.\n");
+	printf("Example:\n");
+	printf("\texport %s=/tmp/trace\n", DMEC_TRACE_ENV);
+	printf("\tgpio-event-mon -n gpiochip0 -o 4 & gpio-hammer -n gpiochip0 -o 5 -c 20\n");
+	printf("\tdmec-trace-merge -o timeline.json /tmp/trace\n\n");
+}
+
+static void json_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/* ns as us with three decimals, without going through a double */
+static void json_us(FILE *f, uint64_t ns)
+{
+	fprintf(f, "%" PRIu64 ".%03u", ns / 1000, (unsigned int)(ns % 1000));
+}
+
+static const char *rec_str(struct recording *r, unsigned int id)
+{
+	return r->str[id] ? r->str[id] : "?";
+}
+
+/* the fields every event has */
+static void event(FILE *f, struct recording *r, struct dmec_trace_rec *rec,
+		  uint64_t ts)
+{
+	fprintf(f, "\"pid\":%u,\"tid\":%u,\"cat\":", r->hdr.pid, rec->tid);
+	json_str(f, rec_str(r, rec->cat));
+	fprintf(f, ",\"name\":");
+	json_str(f, rec_str(r, rec->name));
+	fprintf(f, ",\"ts\":");
+	json_us(f, ts);
+}
+
+/* overlapping spans get their own tracks as begin/end pairs */
+static void async(FILE *f, struct recording *r, struct dmec_trace_rec *rec,
+		  uint64_t origin)
+{
+	fprintf(f, ",\n{\"ph\":\"b\",");
+	event(f, r, rec, rec->ts - origin);
+	fprintf(f, ",\"id2\":{\"local\":\"0x%" PRIx64 "\"}}", rec->arg);
+	fprintf(f, ",\n{\"ph\":\"e\",");
+	event(f, r, rec, rec->ts + rec->dur - origin);
+	fprintf(f, ",\"id2\":{\"local\":\"0x%" PRIx64 "\"}}", rec->arg);
+}
+
+static int load(const char *path)
+{
+	struct recording *r, *tmp;
+	struct stat st;
+	FILE *f;
+	int ret = 0;
+
+	tmp = realloc(recs, (nrecs + 1) * sizeof(*recs));
+	if (!tmp)
+		return -ENOMEM;
+	recs = tmp;
+	r = &recs[nrecs];
+	memset(r, 0, sizeof(*r));
+	r->path = path;
+
+	f = fopen(path, "r");
+	if (!f || fstat(fileno(f), &st)) {
+		ret = -errno;
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto out;
+	}
+	if (st.st_size < sizeof(r->hdr) ||
+	    fread(&r->hdr, sizeof(r->hdr), 1, f) != 1 ||
+	    memcmp(r->hdr.magic, DMEC_TRACE_MAGIC, sizeof(r->hdr.magic)) ||
+	    r->hdr.version != DMEC_TRACE_VERSION ||
+	    r->hdr.rec_size != sizeof(struct dmec_trace_rec)) {
+		fprintf(stderr, "%s: not a version %d trace recording\n", path,
+			DMEC_TRACE_VERSION);
+		ret = -EINVAL;
+		goto out;
+	}
+	r->hdr.tool[sizeof(r->hdr.tool) - 1] = 0;
+
+	r->len = st.st_size - sizeof(r->hdr);
+	r->data = malloc(r->len + 1);
+	r->str = calloc(MAX_STR, sizeof(*r->str));
+	if (!r->data || !r->str) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (fread(r->data, 1, r->len, f) != r->len) {
+		ret = ferror(f) ? -EIO : -EINVAL;
+		fprintf(stderr, "%s: short read\n", path);
+		goto out;
+	}
+	nrecs++;
+
+out:
+	if (f)
+		fclose(f);
+	if (ret) {
+		free(r->data);
+		free(r->str);
+	}
+	return ret;
+}
+
+static int load_dir(const char *dir)
+{
+	struct dirent **list;
+	int i, n, ret = 0;
+
+	n = scandir(dir, &list, NULL, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+		return -errno;
+	}
+	for (i = 0; i < n; i++) {
+		size_t len = strlen(list[i]->d_name);
+		char *path;
+
+		if (!ret && len > 4 && !strcmp(list[i]->d_name + len - 4, ".dtr")) {
+			if (asprintf(&path, "%s/%s", dir, list[i]->d_name) < 0)
+				ret = -ENOMEM;
+			else
+				ret = load(path);
+		}
+		free(list[i]);
+	}
+	free(list);
+	return ret;
+}
+
+/*
+ * Walk the records of one recording. With f NULL only the earliest
+ * event is looked for, the string table is built on the way.
+ */
+static void walk(struct recording *r, FILE *f, uint64_t origin,
+		 uint64_t *first)
+{
+	struct dmec_trace_rec rec;
+	size_t off = 0, text;
+
+	while (off + sizeof(rec) <= r->len) {
+		memcpy(&rec, r->data + off, sizeof(rec));
+		off += sizeof(rec);
+
+		switch (rec.type) {
+		case DMEC_TRACE_STR:
+			text = (rec.dur + sizeof(rec) - 1) / sizeof(rec) * sizeof(rec);
+			if (text > r->len - off)
+				goto truncated;
+			if (!f) {
+				/* not terminated, padding may be cut short */
+				free(r->str[rec.name]);
+				r->str[rec.name] = strndup(r->data + off, rec.dur);
+			}
+			off += text;
+			continue;
+		case DMEC_TRACE_THREAD:
+			if (!f)
+				continue;
+			fprintf(f, ",\n{\"ph\":\"M\",\"name\":\"thread_name\","
+				"\"pid\":%u,\"tid\":%u,\"args\":{\"name\":",
+				r->hdr.pid, rec.tid);
+			json_str(f, rec_str(r, rec.name));
+			fprintf(f, "}}");
+			continue;
+		case DMEC_TRACE_SPAN:
+		case DMEC_TRACE_INSTANT:
+		case DMEC_TRACE_COUNTER:
+		case DMEC_TRACE_ASYNC:
+			break;
+		default:
+			fprintf(stderr, "%s: unknown record %u, skipped\n", r->path,
+				rec.type);
+			continue;
+		}
+
+		if (!f) {
+			if (rec.ts < *first)
+				*first = rec.ts;
+			r->events++;
+			continue;
+		}
+
+		if (rec.type == DMEC_TRACE_ASYNC) {
+			async(f, r, &rec, origin);
+			continue;
+		}
+
+		fprintf(f, ",\n{\"ph\":\"%s\",", rec.type == DMEC_TRACE_SPAN ? "X" :
+			rec.type == DMEC_TRACE_INSTANT ? "i" : "C");
+		event(f, r, &rec, rec.ts - origin);
+		if (rec.type == DMEC_TRACE_SPAN) {
+			fprintf(f, ",\"dur\":");
+			json_us(f, rec.dur);
+		} else if (rec.type == DMEC_TRACE_INSTANT) {
+			fprintf(f, ",\"s\":\"t\"");
+		}
+		if (rec.type == DMEC_TRACE_COUNTER)
+			fprintf(f, ",\"args\":{\"value\":%" PRId64 "}}", rec.arg);
+		else
+			fprintf(f, ",\"args\":{\"arg\":%" PRId64 "}}", rec.arg);
+	}
+	if (off == r->len)
+		return;
+
+truncated:
+	/* the tool did not get to close it, e.g. killed */
+	if (!f)
+		fprintf(stderr, "%s: truncated, %zu bytes ignored\n", r->path,
+			r->len - off);
+}
+
+static int merge(FILE *f)
+{
+	uint64_t first = UINT64_MAX, origin;
+	unsigned long events = 0;
+	unsigned int i;
+
+	for (i = 0; i < nrecs; i++) {
+		walk(&recs[i], NULL, 0, &first);
+		events += recs[i].events;
+	}
+	if (!events) {
+		fprintf(stderr, "no events recorded\n");
+		return -ENODATA;
+	}
+	origin = absolute ? 0 : first;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"otherData\":{"
+		"\"clock\":\"CLOCK_MONOTONIC\",\"origin_ns\":%" PRIu64 "},\n"
+		"\"traceEvents\":[\n", origin);
+	for (i = 0; i < nrecs; i++) {
+		struct recording *r = &recs[i];
+
+		fprintf(f, "%s{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%u,"
+			"\"args\":{\"name\":", i ? ",\n" : "", r->hdr.pid);
+		json_str(f, r->hdr.tool);
+		fprintf(f, "}}");
+		walk(r, f, origin, NULL);
+	}
+	fprintf(f, "\n]}\n");
+
+	fprintf(stderr, "%u recordings, %lu events from %.6f s\n", nrecs, events,
+		first / 1e9);
+	return ferror(f) ? -EIO : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = NULL;
+	struct stat st;
+	FILE *f = stdout;
+	int i, ret = 0;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"o", required_argument, 0, 0},
+			{"a", no_argument, 0, 1},
+			{"help", no_argument, 0, 2},
+			{0, 0, 0, 0}
+		};
+
+		int c = getopt_long(argc, argv, "o:ah", long_options,
+				    &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'o':
+			output = optarg;
+			break;
+		case 1:
+		case 'a':
+			absolute = 1;
+			break;
+		case 2:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage();
+		return 1;
+	}
+
+	for (i = optind; i < argc && !ret; i++) {
+		if (!stat(argv[i], &st) && S_ISDIR(st.st_mode))
+			ret = load_dir(argv[i]);
+		else
+			ret = load(argv[i]);
+	}
+	if (ret)
+		return 1;
+
+	if (output) {
+		f = fopen(output, "w");
+		if (!f) {
+			perror(output);
+			return 1;
+		}
+	}
+	ret = merge(f);
+	if (output && fclose(f))
+		ret = -errno;
+	if (ret == -EIO)
+		fprintf(stderr, "%s: %s\n", output ? output : "stdout",
+			strerror(EIO));
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-trace - writing out the per thread buffers
+ *
+ * Everything here runs outside of the recording fast path and under one
+ * lock: registration of a thread, a full buffer, thread exit and close.
+ * String ids are handed out per pointer, the text of an id is written
+ * the first time it is used.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "dmec-trace.h"
+
+#define STR_HASH	4096	/* at most half of it used */
+
+int dmec_trace_on;
+__thread struct dmec_trace_buf *dmec_trace_tls
+	__attribute__((tls_model("initial-exec")));
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t key;
+static FILE *out;
+static struct dmec_trace_buf *bufs;
+static const char *str_key[STR_HASH];
+static uint16_t str_ids[STR_HASH];
+static unsigned int nstr;
+
+/* a string record and its text, returns the id */
+static uint16_t str_write(const char *s)
+{
+	static const char zero[sizeof(struct dmec_trace_rec)];
+	struct dmec_trace_rec r;
+	size_t len = strlen(s), pad;
+
+	memset(&r, 0, sizeof(r));
+	r.type = DMEC_TRACE_STR;
+	r.name = ++nstr;
+	r.dur = len;
+	pad = (sizeof(r) - len % sizeof(r)) % sizeof(r);
+	fwrite(&r, sizeof(r), 1, out);
+	fwrite(s, len, 1, out);
+	fwrite(zero, pad, 1, out);
+	return r.name;
+}
+
+/* id of a string literal, 0 ("?" in the merge) once the table is full */
+static uint16_t str_id(const char *s)
+{
+	unsigned int h;
+
+	if (!s)
+		s = "";
+	h = ((uintptr_t)s >> 3) * 2654435761u % STR_HASH;
+	while (str_key[h]) {
+		if (str_key[h] == s)
+			return str_ids[h];
+		h = (h + 1) % STR_HASH;
+	}
+	if (nstr >= STR_HASH / 2)
+		return 0;
+	str_key[h] = s;
+	str_ids[h] = str_write(s);
+	return str_ids[h];
+}
+
+static void thread_write(struct dmec_trace_buf *b)
+{
+	struct dmec_trace_rec r;
+
+	memset(&r, 0, sizeof(r));
+	r.type = DMEC_TRACE_THREAD;
+	r.tid = b->tid;
+	/* names change, not interned */
+	r.name = nstr < UINT16_MAX ? str_write(b->name) : 0;
+	fwrite(&r, sizeof(r), 1, out);
+}
+
+/* called with the lock held */
+static void buf_write(struct dmec_trace_buf *b)
+{
+	static struct dmec_trace_rec r[256];
+	const char *cat = NULL, *name = NULL;
+	uint16_t cat_id = 0, name_id = 0;
+	unsigned int i, n = 0;
+
+	if (!out) {
+		b->n = 0;
+		return;
+	}
+
+	memset(r, 0, sizeof(r));
+	for (i = 0; i < b->n; i++) {
+		struct dmec_trace_ev *ev = &b->ev[i];
+
+		/* mostly the same event over and over */
+		if (ev->cat != cat) {
+			cat = ev->cat;
+			cat_id = str_id(cat);
+		}
+		if (ev->name != name) {
+			name = ev->name;
+			name_id = str_id(name);
+		}
+		r[n].type = ev->type;
+		r[n].cat = cat_id;
+		r[n].name = name_id;
+		r[n].tid = b->tid;
+		r[n].ts = ev->ts;
+		r[n].dur = ev->dur;
+		r[n].arg = ev->arg;
+		if (++n == sizeof(r) / sizeof(r[0]) || i + 1 == b->n) {
+			fwrite(r, sizeof(r[0]), n, out);
+			n = 0;
+		}
+	}
+	b->n = 0;
+}
+
+/* thread exit: the rest of its events, then the buffer goes */
+static void buf_exit(void *arg)
+{
+	struct dmec_trace_buf *b = arg, **p;
+
+	pthread_mutex_lock(&lock);
+	buf_write(b);
+	for (p = &bufs; *p; p = &(*p)->next) {
+		if (*p == b) {
+			*p = b->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	dmec_trace_tls = NULL;
+	free(b->ev);
+	free(b);
+}
+
+/* the buffer of the calling thread, registered on first use */
+static struct dmec_trace_buf *buf_get(void)
+{
+	struct dmec_trace_buf *b = dmec_trace_tls;
+
+	if (b)
+		return b;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+	b->ev = malloc(DMEC_TRACE_EVENTS * sizeof(*b->ev));
+	if (!b->ev) {
+		free(b);
+		return NULL;
+	}
+	/* fault it in now, not while recording */
+	memset(b->ev, 0, DMEC_TRACE_EVENTS * sizeof(*b->ev));
+	b->tid = syscall(SYS_gettid);
+	prctl(PR_GET_NAME, b->name);
+
+	pthread_mutex_lock(&lock);
+	if (!out) {
+		pthread_mutex_unlock(&lock);
+		free(b->ev);
+		free(b);
+		return NULL;
+	}
+	b->next = bufs;
+	bufs = b;
+	thread_write(b);
+	pthread_mutex_unlock(&lock);
+
+	pthread_setspecific(key, b);
+	dmec_trace_tls = b;
+	return b;
+}
+
+/* first event of a thread or its buffer is full */
+struct dmec_trace_ev *dmec_trace_slow(void)
+{
+	struct dmec_trace_buf *b = dmec_trace_tls;
+
+	if (!dmec_trace_on)
+		return NULL;
+
+	if (!b) {
+		b = buf_get();
+		if (!b)
+			return NULL;
+	} else {
+		pthread_mutex_lock(&lock);
+		buf_write(b);
+		pthread_mutex_unlock(&lock);
+	}
+	return &b->ev[b->n++];
+}
+
+void dmec_trace_thread_name(const char *name)
+{
+	struct dmec_trace_buf *b;
+
+	if (!dmec_trace_on)
+		return;
+	b = buf_get();
+	if (!b)
+		return;
+
+	pthread_mutex_lock(&lock);
+	snprintf(b->name, sizeof(b->name), "%s", name);
+	if (out)
+		thread_write(b);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Start recording if DMEC_TRACE is set. Failing to trace is reported,
+ * the tool is expected to carry on without.
+ */
+int dmec_trace_open(const char *tool)
+{
+	const char *dir = getenv(DMEC_TRACE_ENV);
+	struct dmec_trace_hdr h;
+	char path[PATH_MAX];
+	int ret;
+
+	if (!dir || !*dir || out)
+		return 0;
+
+	if (mkdir(dir, 0777) && errno != EEXIST) {
+		ret = -errno;
+		fprintf(stderr, "trace: %s: %s\n", dir, strerror(errno));
+		return ret;
+	}
+	snprintf(path, sizeof(path), "%s/%s-%d.dtr", dir, tool, getpid());
+	out = fopen(path, "w");
+	if (!out) {
+		ret = -errno;
+		fprintf(stderr, "trace: %s: %s\n", path, strerror(errno));
+		return ret;
+	}
+	setvbuf(out, NULL, _IOFBF, 1 << 16);
+	pthread_key_create(&key, buf_exit);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DMEC_TRACE_MAGIC, sizeof(h.magic));
+	h.version = DMEC_TRACE_VERSION;
+	h.rec_size = sizeof(struct dmec_trace_rec);
+	h.pid = getpid();
+	h.start = dmec_trace_now();
+	snprintf(h.tool, sizeof(h.tool), "%s", tool);
+	fwrite(&h, sizeof(h), 1, out);
+
+	dmec_trace_on = 1;
+	atexit(dmec_trace_close);
+	fprintf(stderr, "tracing to %s\n", path);
+	return 0;
+}
+
+/*
+ * Write out all buffers and stop. Threads still recording at this point
+ * lose their events; their buffers are not freed, they may still be
+ * written to until the thread exits.
+ */
+void dmec_trace_close(void)
+{
+	struct dmec_trace_buf *b;
+
+	pthread_mutex_lock(&lock);
+	dmec_trace_on = 0;
+	if (out) {
+		for (b = bufs; b; b = b->next)
+			buf_write(b);
+		if (fclose(out))
+			perror("trace");
+		out = NULL;
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,173 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * dmec-trace - timeline recording shared by the DMEC tools
+ *
+ * Recording is off unless DMEC_TRACE names a directory, then every tool
+ * that called dmec_trace_open() writes <dir>/<tool>-<pid>.dtr, which
+ * dmec-trace-merge turns into one Perfetto/Chrome trace.
+ *
+ * Each thread records into its own buffer: an event is a clock read and
+ * a few stores, no lock and no syscall. A full buffer is written out by
+ * its thread, the rest at thread exit and at dmec_trace_close() (also
+ * run at exit). Timestamps are CLOCK_MONOTONIC ns, the clock of the GPIO
+ * event timestamps, so kernel edges can be recorded as they are.
+ *
+ * cat and name must be string literals (or otherwise live until the
+ * buffer is written): only the pointer is stored.
+ *
+ * File format, host byte order:
+ *
+ *   struct dmec_trace_hdr
+ *   struct dmec_trace_rec ...
+ *
+ * A DMEC_TRACE_STR record defines string id rec.name; rec.dur bytes of
+ * text follow it, padded to a multiple of the record size. A
+ * DMEC_TRACE_THREAD record names thread rec.tid with string rec.name.
+ */
+#ifndef _DMEC_TRACE_H_
+#define _DMEC_TRACE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define DMEC_TRACE_MAGIC	"DMTR"
+#define DMEC_TRACE_VERSION	1
+#define DMEC_TRACE_ENV		"DMEC_TRACE"
+#define DMEC_TRACE_EVENTS	16384	/* per thread buffer */
+
+enum {
+	DMEC_TRACE_SPAN = 1,		/* ts .. ts + dur */
+	DMEC_TRACE_INSTANT,
+	DMEC_TRACE_COUNTER,			/* value in arg */
+	DMEC_TRACE_ASYNC,			/* span that may overlap others, id in arg */
+	DMEC_TRACE_STR,
+	DMEC_TRACE_THREAD,
+};
+
+struct dmec_trace_hdr {
+	char magic[4];
+	uint32_t version;
+	uint32_t rec_size;
+	uint32_t pid;
+	uint64_t start;			/* CLOCK_MONOTONIC at open, ns */
+	char tool[32];
+};
+
+struct dmec_trace_rec {
+	uint16_t type;
+	uint16_t cat;			/* string ids */
+	uint16_t name;
+	uint16_t pad;
+	uint32_t tid;
+	uint32_t pad2;
+	uint64_t ts;
+	uint64_t dur;
+	int64_t arg;
+};
+
+/* in memory, strings not resolved yet */
+struct dmec_trace_ev {
+	const char *cat, *name;
+	uint64_t ts, dur;
+	int64_t arg;
+	int type;
+};
+
+struct dmec_trace_buf {
+	struct dmec_trace_ev *ev;
+	unsigned int n;
+	int tid;
+	char name[16];
+	struct dmec_trace_buf *next;
+};
+
+extern int dmec_trace_on;
+extern __thread struct dmec_trace_buf *dmec_trace_tls
+	__attribute__((tls_model("initial-exec")));
+
+int dmec_trace_open(const char *tool);
+void dmec_trace_close(void);
+void dmec_trace_thread_name(const char *name);
+struct dmec_trace_ev *dmec_trace_slow(void);
+
+static inline uint64_t dmec_trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void dmec_trace_rec(int type, const char *cat,
+				  const char *name, uint64_t ts,
+				  uint64_t dur, int64_t arg)
+{
+	struct dmec_trace_buf *b = dmec_trace_tls;
+	struct dmec_trace_ev *ev;
+
+	if (__builtin_expect(b && b->n < DMEC_TRACE_EVENTS, 1))
+		ev = &b->ev[b->n++];
+	else if (!(ev = dmec_trace_slow()))
+		return;
+	ev->type = type;
+	ev->cat = cat;
+	ev->name = name;
+	ev->ts = ts;
+	ev->dur = dur;
+	ev->arg = arg;
+}
+
+/*
+ * Start of a span, 0 when not recording. The clock is only read when
+ * someone looks.
+ */
+static inline uint64_t dmec_trace_begin(void)
+{
+	return dmec_trace_on ? dmec_trace_now() : 0;
+}
+
+static inline void dmec_trace_span(const char *cat, const char *name,
+				   uint64_t t0, uint64_t t1, int64_t arg)
+{
+	if (dmec_trace_on && t0)
+		dmec_trace_rec(DMEC_TRACE_SPAN, cat, name, t0, t1 - t0, arg);
+}
+
+/* span from dmec_trace_begin() to now */
+static inline void dmec_trace_end(const char *cat, const char *name,
+				  uint64_t t0, int64_t arg)
+{
+	if (dmec_trace_on && t0)
+		dmec_trace_rec(DMEC_TRACE_SPAN, cat, name, t0,
+			       dmec_trace_now() - t0, arg);
+}
+
+/*
+ * Something that was in flight from t0, e.g. a frame sent with a time
+ * stamp or a kernel event: these overlap, ids tell them apart.
+ */
+static inline void dmec_trace_async(const char *cat, const char *name,
+				    uint64_t t0, uint64_t t1, int64_t id)
+{
+	if (dmec_trace_on)
+		dmec_trace_rec(DMEC_TRACE_ASYNC, cat, name, t0, t1 - t0, id);
+}
+
+/* ts 0: now */
+static inline void dmec_trace_instant(const char *cat, const char *name,
+				      uint64_t ts, int64_t arg)
+{
+	if (dmec_trace_on)
+		dmec_trace_rec(DMEC_TRACE_INSTANT, cat, name,
+			       ts ? ts : dmec_trace_now(), 0, arg);
+}
+
+static inline void dmec_trace_counter(const char *cat, const char *name,
+				      int64_t value)
+{
+	if (dmec_trace_on)
+		dmec_trace_rec(DMEC_TRACE_COUNTER, cat, name, dmec_trace_now(), 0,
+			       value);
+}
+
+#endif /* _DMEC_TRACE_H_ */
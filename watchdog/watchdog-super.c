@@ -0,0 +1,615 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Watchdog Supervisor
+ *
+ * Keeps several watchdog devices alive from one epoll loop. Every device
+ * has its own timeout/pretimeout, optionally window mode, and a timerfd
+ * armed on absolute CLOCK_MONOTONIC deadlines, so the only wakeups are
+ * the pings themselves.
+ *
+ * A device is only pinged while all of its health checks pass:
+ *   process  the pid (or the pid in a pid file) is still running
+ *   file     the file was modified within the last N seconds
+ *   gpio     the line toggled within the last N seconds
+ *
+ * Checks are evaluated when a ping is due, never in between. GPIO edges
+ * queue up in the line event fd and are collected at ping time, so a fast
+ * heartbeat costs no wakeups; its age is known to one ping period.
+ *
+ * Window mode follows watchdog-test: pings are accepted between
+ * pretimeout and pretimeout + timeout, the supervisor pings in the middle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <linux/gpio.h>
+#include <linux/types.h>
+#include <linux/watchdog.h>
+
+#define SUP_MAX_DEVS	8
+#define SUP_MAX_CHECKS	8
+#define DEFAULT_TIMEOUT	30
+#define NSEC_PER_SEC	1000000000ull
+
+enum sup_check_type {
+	CHECK_PROC,
+	CHECK_FILE,
+	CHECK_GPIO,
+};
+
+struct sup_check {
+	enum sup_check_type type;
+	char *arg;
+	unsigned int maxage;	/* file, gpio: seconds */
+	pid_t pid;
+	int fd;			/* pidfd or gpio line event fd */
+	uint64_t last_edge;
+	int failing;
+};
+
+struct sup_dev {
+	char *name;
+	int fd, tfd;
+	int timeout, pretimeout, win;
+	uint64_t period;
+	uint64_t next;		/* deadline of the next ping */
+	struct sup_check chk[SUP_MAX_CHECKS];
+	int nchk;
+	int healthy;
+	unsigned long pings, skipped, late;
+	uint64_t late_max;
+};
+
+static struct sup_dev devs[SUP_MAX_DEVS];
+static int ndevs;
+static int stop;
+static int verbose;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void usage(void)
+{
+	printf("\nUsage: watchdog-super -d device[:timeout[:pretimeout[:w]]] "
+	       "[check]... [-d ...]\n\n");
+	printf("   -d device        watchdog to supervise, \"w\" selects window mode\n");
+	printf("   -p pid|pidfile   ping only while this process runs\n");
+	printf("   -f file:secs     ping only while file is younger than secs\n");
+	printf("   -g chip:line:secs  ping only while the GPIO line toggled\n");
+	printf("                    within secs\n");
+	printf("   -s               stop the watchdogs on exit\n");
+	printf("   -v               log every ping\n");
+	printf("Checks apply to the device named before them.\n");
+	printf("Example:\n");
+	printf("\twatchdog-super -d /dev/watchdog0:30:10:w -p /run/app.pid "
+	       "-d /dev/watchdog1:60 -f /run/app.alive:20\n\n");
+}
+
+static int sup_parse_dev(char *s)
+{
+	struct sup_dev *d;
+	char *tok;
+
+	if (ndevs == SUP_MAX_DEVS) {
+		fprintf(stderr, "error: too many devices\n");
+		return -1;
+	}
+
+	/* "" or ":30" */
+	tok = strtok(s, ":");
+	if (!tok || s[0] == ':') {
+		fprintf(stderr, "error: -d without a device\n");
+		usage();
+		return -1;
+	}
+
+	d = &devs[ndevs++];
+	d->fd = d->tfd = -1;
+	d->timeout = DEFAULT_TIMEOUT;
+	d->healthy = 1;
+	d->name = strdup(tok);
+	if (!d->name) {
+		perror("strdup");
+		return -1;
+	}
+	if ((tok = strtok(NULL, ":")))
+		d->timeout = atoi(tok);
+	if ((tok = strtok(NULL, ":")))
+		d->pretimeout = atoi(tok);
+	if ((tok = strtok(NULL, ":")))
+		d->win = !strcmp(tok, "w");
+
+	if (d->win && !d->pretimeout) {
+		fprintf(stderr, "error: window mode requires pretimeout.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sup_add_check(enum sup_check_type type, char *s)
+{
+	struct sup_dev *d;
+	struct sup_check *c;
+	char *age;
+
+	if (!ndevs) {
+		fprintf(stderr, "error: check without a device\n");
+		return -1;
+	}
+
+	d = &devs[ndevs - 1];
+	if (d->nchk == SUP_MAX_CHECKS) {
+		fprintf(stderr, "error: too many checks for %s\n", d->name);
+		return -1;
+	}
+
+	c = &d->chk[d->nchk++];
+	c->type = type;
+	c->fd = -1;
+	if (type != CHECK_PROC) {
+		age = strrchr(s, ':');
+		if (!age) {
+			fprintf(stderr, "error: %s: missing age\n", s);
+			return -1;
+		}
+		*age++ = 0;
+		c->maxage = atoi(age);
+	}
+	c->arg = strdup(s);
+
+	return 0;
+}
+
+static pid_t sup_read_pid(const char *arg)
+{
+	char *end;
+	FILE *fp;
+	long pid;
+
+	pid = strtol(arg, &end, 10);
+	if (!*end)
+		return pid;
+
+	fp = fopen(arg, "r");
+	if (!fp) {
+		perror(arg);
+		return -1;
+	}
+	if (fscanf(fp, "%ld", &pid) != 1)
+		pid = -1;
+	fclose(fp);
+
+	return pid;
+}
+
+static int sup_gpio_open(struct sup_check *c)
+{
+	struct gpioevent_request req;
+	char path[64], *line;
+	int fd, ret;
+
+	line = strchr(c->arg, ':');
+	if (!line) {
+		fprintf(stderr, "error: %s: expected chip:line\n", c->arg);
+		return -EINVAL;
+	}
+	*line++ = 0;
+
+	if (c->arg[0] == '/')
+		snprintf(path, sizeof(path), "%s", c->arg);
+	else
+		snprintf(path, sizeof(path), "/dev/%s", c->arg);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -errno;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = atoi(line);
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	strcpy(req.consumer_label, "watchdog-super");
+
+	ret = ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+	close(fd);
+	if (ret == -1) {
+		ret = -errno;
+		fprintf(stderr, "Failed to issue GET EVENT IOCTL (%d)\n", ret);
+		return ret;
+	}
+
+	fcntl(req.fd, F_SETFL, O_NONBLOCK);
+	c->fd = req.fd;
+	/* restore the name for the logs */
+	line[-1] = ':';
+	return 0;
+}
+
+static int sup_check_open(struct sup_dev *d, struct sup_check *c)
+{
+	switch (c->type) {
+	case CHECK_PROC:
+		c->pid = sup_read_pid(c->arg);
+		if (c->pid <= 0) {
+			fprintf(stderr, "error: %s: no pid\n", c->arg);
+			return -EINVAL;
+		}
+		/* pidfds can't be fooled by pid reuse, kill() is the fallback */
+		c->fd = syscall(SYS_pidfd_open, c->pid, 0);
+		if (c->fd < 0 && errno != ENOSYS) {
+			perror("pidfd_open");
+			return -errno;
+		}
+		return 0;
+	case CHECK_FILE:
+		break;
+	case CHECK_GPIO:
+		c->last_edge = now_ns();
+		if (c->maxage * NSEC_PER_SEC < d->period) {
+			c->maxage = (d->period + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+			printf("%s: gpio heartbeat age raised to one ping period, "
+			       "%u s\n", d->name, c->maxage);
+		}
+		return sup_gpio_open(c);
+	}
+
+	return 0;
+}
+
+/* NULL when the check passes, the reason otherwise */
+static const char *sup_check_fail(struct sup_check *c, uint64_t now)
+{
+	struct gpioevent_data ev[16];
+	struct timespec rt;
+	struct stat st;
+	struct pollfd pfd;
+	ssize_t n;
+
+	switch (c->type) {
+	case CHECK_PROC:
+		if (c->fd >= 0) {
+			pfd.fd = c->fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 0) > 0)
+				return "process exited";
+		} else if (kill(c->pid, 0) && errno == ESRCH) {
+			return "process exited";
+		}
+		return NULL;
+	case CHECK_FILE:
+		if (stat(c->arg, &st))
+			return "file missing";
+		clock_gettime(CLOCK_REALTIME, &rt);
+		if (rt.tv_sec - st.st_mtim.tv_sec > c->maxage)
+			return "file stale";
+		return NULL;
+	case CHECK_GPIO:
+		while ((n = read(c->fd, ev, sizeof(ev))) > 0)
+			c->last_edge = now;
+		if (now - c->last_edge > c->maxage * NSEC_PER_SEC)
+			return "gpio heartbeat stopped";
+		return NULL;
+	}
+
+	return NULL;
+}
+
+static int sup_dev_open(struct sup_dev *d)
+{
+	int flags, ret, i;
+
+	d->fd = open(d->name, O_WRONLY);
+	if (d->fd < 0) {
+		perror(d->name);
+		return -errno;
+	}
+
+	if (d->win) {
+		flags = WDIOS_DISABLECARD;
+		ioctl(d->fd, WDIOC_SETOPTIONS, &flags);
+	}
+
+	if (d->pretimeout) {
+		ret = ioctl(d->fd, WDIOC_SETPRETIMEOUT, &d->pretimeout);
+		if (ret)
+			printf("%s: error: setting pretimeout failed %d\n", d->name,
+			       ret);
+		ioctl(d->fd, WDIOC_GETPRETIMEOUT, &d->pretimeout);
+	}
+
+	ret = ioctl(d->fd, WDIOC_SETTIMEOUT, &d->timeout);
+	if (ret)
+		printf("%s: error: setting timeout failed %d\n", d->name, ret);
+	ioctl(d->fd, WDIOC_GETTIMEOUT, &d->timeout);
+
+	if (d->win)
+		d->period = (d->pretimeout + d->timeout / 2.0) * NSEC_PER_SEC;
+	else
+		d->period = (d->pretimeout ? d->pretimeout : d->timeout) *
+			    NSEC_PER_SEC / 2;
+	if (!d->period) {
+		fprintf(stderr, "%s: error: timeout 0\n", d->name);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < d->nchk; i++) {
+		ret = sup_check_open(d, &d->chk[i]);
+		if (ret)
+			return ret;
+	}
+
+	d->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (d->tfd < 0) {
+		perror("timerfd_create");
+		return -errno;
+	}
+
+	return 0;
+}
+
+/* only once every device and check is set up */
+static int sup_dev_arm(struct sup_dev *d)
+{
+	struct itimerspec its;
+	uint64_t start;
+	int flags;
+
+	if (d->win) {
+		flags = WDIOS_ENABLECARD;
+		ioctl(d->fd, WDIOC_SETOPTIONS, &flags);
+	} else {
+		ioctl(d->fd, WDIOC_KEEPALIVE, &flags);
+	}
+	start = now_ns();
+
+	d->next = start + d->period;
+	its.it_value.tv_sec = d->next / NSEC_PER_SEC;
+	its.it_value.tv_nsec = d->next % NSEC_PER_SEC;
+	its.it_interval.tv_sec = d->period / NSEC_PER_SEC;
+	its.it_interval.tv_nsec = d->period % NSEC_PER_SEC;
+	if (timerfd_settime(d->tfd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		perror("timerfd_settime");
+		return -errno;
+	}
+
+	printf("%s: pretimeout: %d timeout: %d%s, ping every %.3f s, "
+	       "%d checks\n", d->name, d->pretimeout, d->timeout,
+	       d->win ? " window" : "", (double)d->period / NSEC_PER_SEC,
+	       d->nchk);
+	return 0;
+}
+
+static void sup_dev_tick(struct sup_dev *d)
+{
+	uint64_t exp = 0, now, late;
+	const char *why = NULL;
+	int i, dummy;
+
+	if (read(d->tfd, &exp, sizeof(exp)) != sizeof(exp))
+		return;
+
+	now = now_ns();
+	/* the timer runs on a fixed grid, deadlines missed in a stall count */
+	d->next += exp * d->period;
+	late = now - (d->next - d->period);
+	if (exp > 1)
+		d->late++;
+	if (late > d->late_max)
+		d->late_max = late;
+
+	for (i = 0; i < d->nchk; i++) {
+		struct sup_check *c = &d->chk[i];
+		const char *r = sup_check_fail(c, now);
+
+		if (r && !c->failing)
+			printf("%s: %s: %s\n", d->name, c->arg, r);
+		else if (!r && c->failing)
+			printf("%s: %s: ok again\n", d->name, c->arg);
+		c->failing = !!r;
+		if (r && !why)
+			why = r;
+	}
+
+	if (why) {
+		if (d->healthy)
+			printf("%s: unhealthy, keepalives suspended\n", d->name);
+		d->healthy = 0;
+		d->skipped++;
+		return;
+	}
+	if (!d->healthy)
+		printf("%s: healthy, keepalives resumed\n", d->name);
+	d->healthy = 1;
+
+	if (ioctl(d->fd, WDIOC_KEEPALIVE, &dummy))
+		printf("%s: error: keepalive failed %d\n", d->name, errno);
+	d->pings++;
+	if (verbose)
+		printf("%s: ping %lu, %.1f us late\n", d->name, d->pings,
+		       late / 1e3);
+}
+
+static void sup_dev_close(struct sup_dev *d)
+{
+	int i;
+
+	if (d->fd >= 0 && stop) {
+		fprintf(stderr, "WARN: stopping %s...\n", d->name);
+		if (d->win) {
+			int flags = WDIOS_DISABLECARD;
+
+			ioctl(d->fd, WDIOC_SETOPTIONS, &flags);
+		} else if (write(d->fd, "V", 1) != 1) {
+			printf("%s: write failed\n", d->name);
+		}
+	}
+
+	if (d->pings || d->skipped)
+		printf("%s: %lu pings, %lu skipped, %lu stalls, max %.1f us "
+		       "late\n", d->name, d->pings, d->skipped, d->late,
+		       d->late_max / 1e3);
+
+	for (i = 0; i < d->nchk; i++) {
+		if (d->chk[i].fd >= 0)
+			close(d->chk[i].fd);
+		free(d->chk[i].arg);
+	}
+	if (d->tfd >= 0)
+		close(d->tfd);
+	if (d->fd >= 0)
+		close(d->fd);
+	free(d->name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct epoll_event ev, events[SUP_MAX_DEVS + 1];
+	int epfd = -1, sfd = -1, ret = 0, running = 1, i, c;
+	sigset_t mask;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{"d", required_argument, 0, 0},
+			{"p", required_argument, 0, 1},
+			{"f", required_argument, 0, 2},
+			{"g", required_argument, 0, 3},
+			{"s", no_argument, 0, 4},
+			{"v", no_argument, 0, 5},
+			{"help", no_argument, 0, 6},
+			{0, 0, 0, 0}
+		};
+
+		c = getopt_long(argc, argv, "d:p:f:g:svh",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+		case 'd':
+			ret = sup_parse_dev(optarg);
+			break;
+		case 1:
+		case 'p':
+			ret = sup_add_check(CHECK_PROC, optarg);
+			break;
+		case 2:
+		case 'f':
+			ret = sup_add_check(CHECK_FILE, optarg);
+			break;
+		case 3:
+		case 'g':
+			ret = sup_add_check(CHECK_GPIO, optarg);
+			break;
+		case 4:
+		case 's':
+			stop = 1;
+			break;
+		case 5:
+		case 'v':
+			verbose = 1;
+			break;
+		case 6:
+		case 'h':
+		case '?':
+		default:
+			usage();
+			ret = -1;
+		}
+		if (ret)
+			goto end;
+	}
+
+	if (!ndevs) {
+		usage();
+		ret = -1;
+		goto end;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (sfd < 0 || epfd < 0) {
+		perror("epoll/signalfd");
+		ret = -1;
+		goto end;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev);
+
+	/*
+	 * Opening a watchdog may already start it. Until the loop runs
+	 * nobody pings, so a failed setup stops what was opened, -s or not.
+	 */
+	for (i = 0; i < ndevs; i++) {
+		ret = sup_dev_open(&devs[i]);
+		if (ret) {
+			stop = 1;
+			goto end;
+		}
+		ev.data.ptr = &devs[i];
+		epoll_ctl(epfd, EPOLL_CTL_ADD, devs[i].tfd, &ev);
+	}
+	for (i = 0; i < ndevs; i++) {
+		ret = sup_dev_arm(&devs[i]);
+		if (ret) {
+			stop = 1;
+			goto end;
+		}
+	}
+
+	while (running) {
+		int n = epoll_wait(epfd, events, SUP_MAX_DEVS + 1, -1);
+
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!events[i].data.ptr)
+				running = 0;
+			else
+				sup_dev_tick(events[i].data.ptr);
+		}
+	}
+
+end:
+	for (i = 0; i < ndevs; i++)
+		sup_dev_close(&devs[i]);
+	if (epfd >= 0)
+		close(epfd);
+	if (sfd >= 0)
+		close(sfd);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Timeout accuracy characterization for watchdog-test
+ *
+ * For every timeout (and pretimeout) of a sweep: program it, ping, and
+ * sample WDIOC_GETTIMELEFT on an absolute grid until one second before
+ * expiry, then ping again so the board never resets. The countdown only
+ * has one second resolution, so the fit uses the moments it steps: a
+ * step from u to u - 1 is taken as the true time left crossing u, placed
+ * half way between the two samples around it. A least squares line
+ * through those points gives the countdown rate and the time left right
+ * after the ping, i.e. the timeout the hardware really applies.
+ *
+ * The pretimeout follows the DMEC model used throughout watchdog-test:
+ * it is the length of a first stage that starts with the ping, the
+ * second stage of timeout s follows, expiry is at pretimeout + timeout.
+ * It is off during the sweep, so GETTIMELEFT counts the timeout alone.
+ * It is measured in a second run: ping, then look for the first stage to
+ * end, as a new WDIOC_GETSTATUS bit or the "pretimeout event" of the noop
+ * governor in /dev/kmsg. The time since the ping is the pretimeout
+ * really applied. Nothing is waited for within the last second before
+ * expiry.
+ *
+ * Drivers without get_timeleft (softdog) are reported as such, the sweep
+ * still runs and keeps the watchdog fed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/watchdog.h>
+
+#include "watchdog-test.h"
+
+#define CHAR_MARGIN	1	/* stop sampling this many s before expiry */
+#define CHAR_MAXPTS	4096
+#define CHAR_KMSG	"/dev/kmsg"
+
+struct char_fit {
+	double a, b;		/* time left = a + b * t */
+	double resid;		/* rms residual in s */
+	int n;
+};
+
+static void char_fit(const double *t, const double *v, int n,
+		     struct char_fit *f)
+{
+	double st = 0, sv = 0, stt = 0, stv = 0, d, r = 0;
+	int i;
+
+	f->n = n;
+	f->a = f->b = f->resid = 0;
+	if (n < 2)
+		return;
+
+	for (i = 0; i < n; i++) {
+		st += t[i];
+		sv += v[i];
+		stt += t[i] * t[i];
+		stv += t[i] * v[i];
+	}
+	d = n * stt - st * st;
+	if (d == 0)
+		return;
+	f->b = (n * stv - st * sv) / d;
+	f->a = (sv - f->b * st) / n;
+
+	for (i = 0; i < n; i++) {
+		double e = v[i] - (f->a + f->b * t[i]);
+
+		r += e * e;
+	}
+	f->resid = sqrt(r / n);
+}
+
+static void char_sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / NSEC_PER_SEC,
+		.tv_nsec = t % NSEC_PER_SEC,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR && !done)
+		;
+}
+
+/* kernel log from now on, -1 when it cannot be read */
+static int char_kmsg_open(void)
+{
+	int kfd = open(CHAR_KMSG, O_RDONLY | O_NONBLOCK);
+
+	if (kfd >= 0)
+		lseek(kfd, 0, SEEK_END);
+	return kfd;
+}
+
+/* the noop pretimeout governor logs "watchdogN: pretimeout event" */
+static int char_kmsg_pretimeout(int kfd)
+{
+	char rec[1024];
+	ssize_t n;
+
+	if (kfd < 0)
+		return 0;
+	for (;;) {
+		n = read(kfd, rec, sizeof(rec) - 1);
+		if (n < 0 && errno == EPIPE)
+			continue;	/* records overwritten, go on with the next */
+		if (n <= 0)
+			return 0;
+		rec[n] = 0;
+		if (strstr(rec, "pretimeout event"))
+			return 1;
+	}
+}
+
+/*
+ * Ping and wait for the first stage to end: a WDIOC_GETSTATUS bit that
+ * was clear after the ping, or the message of the noop governor,
+ * whichever shows first. Returns the s after the ping, half way between
+ * the samples around it, or -1 when nothing showed before the margin.
+ */
+static double char_pretimeout(int fd, int pset, int set,
+			      unsigned int sample_us)
+{
+	uint64_t t0, next, end, now, prev_t;
+	int base = 0, status, dummy, kfd, has_status;
+	double fired = -1;
+
+	kfd = char_kmsg_open();
+	now = wdt_now();
+	ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	t0 = (now + wdt_now()) / 2;
+	has_status = !ioctl(fd, WDIOC_GETSTATUS, &base);
+	prev_t = wdt_now();
+
+	/* expiry is pset + set after the ping */
+	end = t0 + (uint64_t)(pset + set - CHAR_MARGIN) * NSEC_PER_SEC;
+	for (next = t0 + sample_us * 1000ull; next < end && !done;
+	     next += sample_us * 1000ull) {
+		char_sleep_until(next);
+		now = wdt_now();
+		if ((has_status && !ioctl(fd, WDIOC_GETSTATUS, &status) &&
+		     (status & ~base)) || char_kmsg_pretimeout(kfd)) {
+			fired = ((prev_t + now) / 2 - t0) / 1e9;
+			break;
+		}
+		prev_t = now;
+	}
+
+	ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	if (kfd >= 0)
+		close(kfd);
+	return fired;
+}
+
+/* one sweep point */
+static void char_point(int fd, int timeout, int pretimeout,
+		       unsigned int sample_us, double *t, double *v)
+{
+	uint64_t t0, next, end, now, prev_t = 0;
+	int set = timeout, pset = 0, left, prev = -1, first = -1;
+	int dummy, n = 0, err = 0;
+	double fired = -2;
+	struct char_fit f;
+
+	if (ioctl(fd, WDIOC_SETTIMEOUT, &set))
+		printf("error: setting timeout failed %d\n", errno);
+	ioctl(fd, WDIOC_GETTIMEOUT, &set);
+	/*
+	 * The countdown is swept without the pretimeout, it would end the
+	 * first stage in the middle of it. Where it cannot be turned off,
+	 * the sweep stays within the first stage, as the standard loop does.
+	 */
+	ioctl(fd, WDIOC_SETPRETIMEOUT, &pset);
+	if (ioctl(fd, WDIOC_GETPRETIMEOUT, &pset))
+		pset = 0;
+
+	now = wdt_now();
+	ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	t0 = (now + wdt_now()) / 2;
+
+	f.n = 0;
+	if (ioctl(fd, WDIOC_GETTIMELEFT, &first)) {
+		err = errno;
+		goto pre;
+	}
+	prev = first;
+	prev_t = wdt_now();
+
+	left = pset ? pset : set;
+	end = t0 + (left > CHAR_MARGIN ? left - CHAR_MARGIN : 0) *
+		NSEC_PER_SEC;
+	for (next = t0 + sample_us * 1000ull; next < end && !done;
+	     next += sample_us * 1000ull) {
+		char_sleep_until(next);
+		now = wdt_now();
+		if (ioctl(fd, WDIOC_GETTIMELEFT, &left))
+			break;
+		if (left < prev && n < CHAR_MAXPTS) {
+			t[n] = ((prev_t + now) / 2 - t0) / 1e9;
+			v[n++] = left + 1;
+		}
+		prev = left;
+		prev_t = now;
+	}
+
+	/* feed the dog before it bites */
+	ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	char_fit(t, v, n, &f);
+
+pre:
+	if (pretimeout) {
+		pset = pretimeout;
+		if (ioctl(fd, WDIOC_SETPRETIMEOUT, &pset))
+			printf("error: setting pretimeout failed %d\n", errno);
+		ioctl(fd, WDIOC_GETPRETIMEOUT, &pset);
+		/* ends pset after the ping, expiry set later: within the margin? */
+		if (pset > 0 && set > CHAR_MARGIN && !done)
+			fired = char_pretimeout(fd, pset, set, sample_us);
+	}
+	/* fired -2: not looked for, -1: not seen */
+
+	printf("%7d %4d %4d ", timeout, set, pset);
+	if (err)
+		printf("%7s %10s %10s %10s %9s %6s", "-", "-", "-", "-", "-",
+		       "-");
+	else if (f.n < 2)
+		printf("%7d %10s %10s %10s %9s %6d", first, "-", "-", "-", "-",
+		       f.n);
+	else
+		printf("%7d %10.3f %10.1f %10.0f %9.2f %6d", first, f.a,
+		       (f.a - set) * 1e3, (-f.b - 1) * 1e6, f.resid * 1e3, f.n);
+	if (fired >= 0)
+		printf(" %8.3f %9.1f\n", fired, (fired - pset) * 1e3);
+	else
+		printf(" %8s %9s\n", "-", "-");
+
+	if (err)
+		printf("# %d: GETTIMELEFT not supported (%d)\n", timeout, err);
+	else if (f.n < 2)
+		printf("# %d: too few steps\n", timeout);
+	if (pretimeout && fired == -2 && !pset)
+		printf("# %d/%d: pretimeout not accepted\n", timeout, pretimeout);
+	else if (pretimeout && fired == -2 && !done)
+		printf("# %d/%d: second stage too short, not measured\n",
+		       timeout, pretimeout);
+	else if (pretimeout && fired < 0)
+		printf("# %d/%d: pretimeout not seen\n", timeout, pretimeout);
+}
+
+/*
+ * list: comma separated timeout[/pretimeout] values, e.g. "5,10/3,30"
+ */
+int watchdog_characterize(int fd, const char *list, unsigned int sample_us)
+{
+	double *t, *v;
+	const char *s = list;
+	char *end;
+	int dummy;
+
+	t = malloc(CHAR_MAXPTS * sizeof(*t));
+	v = malloc(CHAR_MAXPTS * sizeof(*v));
+	if (!t || !v) {
+		free(t);
+		free(v);
+		return -ENOMEM;
+	}
+
+	printf("\ncharacterize: sampling GETTIMELEFT every %u us\n", sample_us);
+	printf("%7s %4s %4s %7s %10s %10s %10s %9s %6s %8s %9s\n", "nominal",
+	       "set", "pre", "first", "meas[s]", "off[ms]", "rate[ppm]",
+	       "rms[ms]", "steps", "pre[s]", "poff[ms]");
+
+	while (*s && !done) {
+		int timeout, pretimeout = 0;
+
+		timeout = strtol(s, &end, 0);
+		if (*end == '/')
+			pretimeout = strtol(end + 1, &end, 0);
+		if (end == s || timeout <= 0) {
+			fprintf(stderr, "bad sweep list: %s\n", list);
+			break;
+		}
+		if (*end == ',')
+			end++;
+		s = end;
+
+		char_point(fd, timeout, pretimeout, sample_us, t, v);
+		ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	}
+
+	free(t);
+	free(v);
+	return 0;
+}
@@ -0,0 +1,350 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Keepalive robustness under load for watchdog-test
+ *
+ * Starts CPU hogs, memory churners and fsync writers as child processes,
+ * then runs the keepalive loop once per scheduling policy, each time in a
+ * fresh child so no setting leaks into the next run:
+ *
+ *   normal  SCHED_OTHER, nice 0
+ *   nice    SCHED_OTHER, nice -20
+ *   fifo    SCHED_FIFO, middle priority
+ *   mlock   SCHED_FIFO plus mlockall(), no page faults in the loop
+ *
+ * A ping is timed when its ioctl returns, so the latency covers the
+ * wakeup and the driver call. The margin is what was left of the first
+ * watchdog stage when the ping landed.
+ *
+ * The load is described as comma separated suboptions, e.g.
+ * "cpu=4,mem=512,io=2,secs=60,period=100,pol=normal:fifo".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <linux/watchdog.h>
+
+#include "watchdog-test.h"
+
+#define LOAD_MAX_CHILDREN	64
+#define LOAD_IO_CHUNK		(64 * 1024)
+
+enum { POL_NORMAL, POL_NICE, POL_FIFO, POL_MLOCK, POL_COUNT };
+
+static const char *const pol_name[POL_COUNT] = {
+	"normal", "nice", "fifo", "mlock",
+};
+
+struct load_cfg {
+	int cpu, io;
+	size_t mem_mb;
+	unsigned int secs, period_ms;
+	int pol[POL_COUNT];
+	const char *dir;
+};
+
+static pid_t load_pids[LOAD_MAX_CHILDREN];
+static int load_n;
+
+static void load_cpu(void)
+{
+	volatile unsigned long x = 0;
+
+	for (;;)
+		x++;
+}
+
+/* fault the pages in, throw them away, repeat */
+static void load_mem(size_t mb)
+{
+	size_t len = mb << 20, i;
+	long pg = sysconf(_SC_PAGESIZE);
+	char *p;
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		_exit(1);
+
+	for (;;) {
+		for (i = 0; i < len; i += pg)
+			p[i] = i;
+		madvise(p, len, MADV_DONTNEED);
+	}
+}
+
+static void load_io(const char *dir)
+{
+	char path[4096], buf[LOAD_IO_CHUNK];
+	int fd, i;
+
+	snprintf(path, sizeof(path), "%s/wdt-load-XXXXXX", dir);
+	fd = mkstemp(path);
+	if (fd < 0)
+		_exit(1);
+	unlink(path);
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+
+	for (i = 0; ; i++) {
+		if (pwrite(fd, buf, sizeof(buf), (i % 1024) * sizeof(buf)) < 0)
+			_exit(1);
+		fsync(fd);
+	}
+}
+
+static int load_spawn(void (*fn)(void *), void *arg)
+{
+	pid_t pid;
+
+	if (load_n == LOAD_MAX_CHILDREN)
+		return -E2BIG;
+
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+	if (!pid) {
+		signal(SIGINT, SIG_DFL);
+		fn(arg);
+		_exit(0);
+	}
+
+	load_pids[load_n++] = pid;
+	return 0;
+}
+
+static void spawn_cpu(void *arg)
+{
+	load_cpu();
+}
+
+static void spawn_mem(void *arg)
+{
+	load_mem(*(size_t *)arg);
+}
+
+static void spawn_io(void *arg)
+{
+	load_io(arg);
+}
+
+static void load_stop(void)
+{
+	int i;
+
+	for (i = 0; i < load_n; i++)
+		kill(load_pids[i], SIGKILL);
+	for (i = 0; i < load_n; i++)
+		waitpid(load_pids[i], NULL, 0);
+	load_n = 0;
+}
+
+static int load_policy(int pol)
+{
+	struct sched_param sp = { 0 };
+
+	switch (pol) {
+	case POL_NICE:
+		if (setpriority(PRIO_PROCESS, 0, -20))
+			return -errno;
+		return 0;
+	case POL_MLOCK:
+		if (mlockall(MCL_CURRENT | MCL_FUTURE))
+			return -errno;
+		/* fall through */
+	case POL_FIFO:
+		sp.sched_priority = (sched_get_priority_min(SCHED_FIFO) +
+				     sched_get_priority_max(SCHED_FIFO)) / 2;
+		if (sched_setscheduler(0, SCHED_FIFO, &sp))
+			return -errno;
+		return 0;
+	}
+
+	return 0;
+}
+
+/* the keepalive loop of one policy, run in its own process */
+static void load_pinger(int fd, int pol, struct load_cfg *cfg,
+			uint64_t close, struct wdt_sched *s)
+{
+	uint64_t end, t;
+	int dummy, ret;
+
+	ret = load_policy(pol);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", pol_name[pol], strerror(-ret));
+		_exit(2);
+	}
+
+	ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	t = wdt_now();
+	wdt_sched_init(s, cfg->period_ms * 1000000ull, 0, close, t);
+	end = t + cfg->secs * NSEC_PER_SEC;
+
+	while (wdt_sched_wait(s) && s->next < end) {
+		ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+		wdt_sched_ping(s, wdt_now());
+	}
+
+	_exit(0);
+}
+
+static int load_parse(char *opts, struct load_cfg *cfg)
+{
+	enum { O_CPU, O_MEM, O_IO, O_SECS, O_PERIOD, O_POL, O_DIR };
+	char *const tokens[] = {
+		[O_CPU] = "cpu", [O_MEM] = "mem", [O_IO] = "io",
+		[O_SECS] = "secs", [O_PERIOD] = "period", [O_POL] = "pol",
+		[O_DIR] = "dir", NULL,
+	};
+	char *val, *p;
+	int i, any = 0;
+
+	while (*opts) {
+		switch (getsubopt(&opts, tokens, &val)) {
+		case O_CPU:
+			cfg->cpu = val ? atoi(val) : sysconf(_SC_NPROCESSORS_ONLN);
+			break;
+		case O_MEM:
+			cfg->mem_mb = val ? atoi(val) : 256;
+			break;
+		case O_IO:
+			cfg->io = val ? atoi(val) : 1;
+			break;
+		case O_SECS:
+			cfg->secs = val ? atoi(val) : 0;
+			break;
+		case O_PERIOD:
+			cfg->period_ms = val ? atoi(val) : 0;
+			break;
+		case O_DIR:
+			cfg->dir = val;
+			break;
+		case O_POL:
+			memset(cfg->pol, 0, sizeof(cfg->pol));
+			while (val && (p = strsep(&val, ":"))) {
+				for (i = 0; i < POL_COUNT; i++)
+					if (!strcmp(p, pol_name[i]))
+						break;
+				if (i == POL_COUNT) {
+					fprintf(stderr, "unknown policy: %s\n", p);
+					return -EINVAL;
+				}
+				cfg->pol[i] = any = 1;
+			}
+			if (!any)
+				return -EINVAL;
+			break;
+		default:
+			fprintf(stderr, "unknown load option: %s\n", val);
+			return -EINVAL;
+		}
+	}
+
+	return cfg->secs && cfg->period_ms ? 0 : -EINVAL;
+}
+
+int watchdog_load_bench(int fd, int timeout, int pretimeout, char *opts)
+{
+	struct load_cfg cfg = {
+		.secs = 30,
+		.period_ms = 100,
+		.pol = { 1, 1, 1, 1 },
+		.dir = ".",
+	};
+	struct wdt_sched *res;
+	uint64_t close;
+	int i, ret = 0;
+
+	if (load_parse(opts, &cfg))
+		return -EINVAL;
+
+	if (ioctl(fd, WDIOC_SETTIMEOUT, &timeout))
+		printf("error: setting timeout failed %d\n", errno);
+	ioctl(fd, WDIOC_GETTIMEOUT, &timeout);
+	if (pretimeout) {
+		ioctl(fd, WDIOC_SETPRETIMEOUT, &pretimeout);
+		ioctl(fd, WDIOC_GETPRETIMEOUT, &pretimeout);
+	}
+	close = (pretimeout ? pretimeout : timeout) * NSEC_PER_SEC;
+	if (cfg.period_ms * 1000000ull >= close) {
+		fprintf(stderr, "error: ping period not below the timeout\n");
+		return -EINVAL;
+	}
+
+	/* results come back from the pinger processes */
+	res = mmap(NULL, POL_COUNT * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		return -ENOMEM;
+	memset(res, 0, POL_COUNT * sizeof(*res));
+
+	printf("\nload: %d cpu hogs, %zu MB memory churn, %d fsync writers "
+	       "in %s\n", cfg.cpu, cfg.mem_mb, cfg.io, cfg.dir);
+	printf("ping every %u ms for %u s per policy, first stage %.1f s\n",
+	       cfg.period_ms, cfg.secs, (double)close / NSEC_PER_SEC);
+
+	for (i = 0; i < cfg.cpu && !ret; i++)
+		ret = load_spawn(spawn_cpu, NULL);
+	if (cfg.mem_mb && !ret)
+		ret = load_spawn(spawn_mem, &cfg.mem_mb);
+	for (i = 0; i < cfg.io && !ret; i++)
+		ret = load_spawn(spawn_io, (void *)cfg.dir);
+	if (ret) {
+		fprintf(stderr, "error: starting load: %s\n", strerror(-ret));
+		goto out;
+	}
+
+	for (i = 0; i < POL_COUNT && !done; i++) {
+		int status, dummy;
+		pid_t pid;
+
+		if (!cfg.pol[i])
+			continue;
+
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (!pid)
+			load_pinger(fd, i, &cfg, close, &res[i]);
+
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+		/* keep the dog fed between the runs */
+		ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			res[i].pings = 0;
+	}
+
+	printf("\n%-8s %8s %10s %10s %12s %8s\n", "policy", "pings",
+	       "mean[us]", "max[us]", "margin[ms]", "stalls");
+	for (i = 0; i < POL_COUNT; i++) {
+		struct wdt_sched *s = &res[i];
+
+		if (!cfg.pol[i])
+			continue;
+		if (!s->pings) {
+			printf("%-8s %8s\n", pol_name[i], "failed");
+			continue;
+		}
+		printf("%-8s %8lu %10.1f %10.1f %12.3f %8lu\n", pol_name[i],
+		       s->pings, s->err_sum / 1e3 / s->pings, s->err_max / 1e3,
+		       s->late_min / 1e6, s->reanchored);
+	}
+
+out:
+	load_stop();
+	munmap(res, POL_COUNT * sizeof(*res));
+	return ret;
+}
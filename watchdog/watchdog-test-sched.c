@@ -0,0 +1,159 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Keepalive scheduling for watchdog-test
+ *
+ * Pings are due on a fixed grid of absolute CLOCK_MONOTONIC deadlines,
+ * so whatever the loop does between two pings (printing, status ioctls)
+ * never shifts the next one. After a stall of more than half a period
+ * the grid is moved to the late ping: catching up on the old grid would
+ * shorten the next interval, which in window mode is a reset.
+ *
+ * Every ping is recorded twice: its error against the ideal time, and
+ * where the interval since the previous ping fell inside the allowed
+ * window.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "watchdog-test.h"
+
+void wdt_sched_init(struct wdt_sched *s, uint64_t period, uint64_t open,
+		    uint64_t close, uint64_t start)
+{
+	memset(s, 0, sizeof(*s));
+	s->period = period;
+	s->open = open;
+	s->close = close;
+	s->last = start;
+	s->next = start + period;
+	s->early_min = INT64_MAX;
+	s->late_min = INT64_MAX;
+}
+
+/* sleep until the next deadline, returns the wakeup time or 0 on exit */
+uint64_t wdt_sched_wait(struct wdt_sched *s)
+{
+	struct timespec ts = {
+		.tv_sec = s->next / NSEC_PER_SEC,
+		.tv_nsec = s->next % NSEC_PER_SEC,
+	};
+	int ret;
+
+	while (!done) {
+		ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		if (!ret)
+			return wdt_now();
+		if (ret != EINTR) {
+			fprintf(stderr, "error: clock_nanosleep %d\n", ret);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* account a ping done at t, returns how late it was */
+uint64_t wdt_sched_ping(struct wdt_sched *s, uint64_t t)
+{
+	uint64_t err = t > s->next ? t - s->next : 0;
+	int64_t ival = t - s->last;
+	uint64_t us = err / 1000;
+	int b = 0;
+
+	while (us && b < WDT_ERR_BUCKETS - 1) {
+		b++;
+		us >>= 1;
+	}
+	s->err_hist[b]++;
+	s->err_sum += err;
+	if (err > s->err_max)
+		s->err_max = err;
+
+	if (ival < (int64_t)s->open)
+		b = 0;
+	else if (ival > (int64_t)s->close)
+		b = WDT_POS_BUCKETS - 1;
+	else
+		b = 1 + (ival - s->open) * 10 / (s->close - s->open + 1);
+	s->pos_hist[b]++;
+	if (ival - (int64_t)s->open < s->early_min)
+		s->early_min = ival - s->open;
+	if ((int64_t)s->close - ival < s->late_min)
+		s->late_min = s->close - ival;
+
+	s->pings++;
+	s->last = t;
+	s->next += s->period;
+	if (err > s->period / 2) {
+		s->next = t + s->period;
+		s->reanchored++;
+	}
+
+	return err;
+}
+
+static void wdt_hist_bar(unsigned long n, unsigned long total)
+{
+	int i, w = total ? (n * 40 + total - 1) / total : 0;
+
+	for (i = 0; i < w; i++)
+		putchar('#');
+	putchar('\n');
+}
+
+void wdt_sched_report(struct wdt_sched *s)
+{
+	int i, first = 0, last = 0;
+
+	if (!s->pings)
+		return;
+
+	printf("\n%lu pings, interval %.3f ms, window %.3f..%.3f ms",
+	       s->pings, (double)s->period / NSEC_PER_MSEC,
+	       (double)s->open / NSEC_PER_MSEC,
+	       (double)s->close / NSEC_PER_MSEC);
+	if (s->reanchored)
+		printf(", %lu stalls", s->reanchored);
+	printf("\nping error: mean %.1f us, max %.1f us\n",
+	       s->err_sum / 1e3 / s->pings, s->err_max / 1e3);
+	printf("margin: %.3f ms to window open, %.3f ms to expiry\n",
+	       s->early_min / 1e6, s->late_min / 1e6);
+
+	for (i = 0; i < WDT_ERR_BUCKETS; i++) {
+		if (s->err_hist[i]) {
+			if (!last)
+				first = i;
+			last = i + 1;
+		}
+	}
+	printf("\n%-16s %10s\n", "error [us]", "pings");
+	for (i = first; i < last; i++) {
+		char range[48];
+
+		if (!i)
+			snprintf(range, sizeof(range), "< 1");
+		else if (i == WDT_ERR_BUCKETS - 1)
+			snprintf(range, sizeof(range), ">= %lu", 1ul << (i - 1));
+		else
+			snprintf(range, sizeof(range), "%lu..%lu", 1ul << (i - 1),
+				 1ul << i);
+		printf("%-16s %10lu ", range, s->err_hist[i]);
+		wdt_hist_bar(s->err_hist[i], s->pings);
+	}
+
+	printf("\n%-16s %10s\n", "window pos [%]", "pings");
+	for (i = 0; i < WDT_POS_BUCKETS; i++) {
+		char range[48];
+
+		if (!i)
+			snprintf(range, sizeof(range), "too early");
+		else if (i == WDT_POS_BUCKETS - 1)
+			snprintf(range, sizeof(range), "expired");
+		else
+			snprintf(range, sizeof(range), "%d..%d", (i - 1) * 10,
+				 i * 10);
+		printf("%-16s %10lu ", range, s->pos_hist[i]);
+		wdt_hist_bar(s->pos_hist[i], s->pings);
+	}
+}
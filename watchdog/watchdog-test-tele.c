@@ -0,0 +1,190 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Keepalive telemetry for watchdog-test
+ *
+ * Every ping leaves one fixed size record in an in-memory ring: when it
+ * happened, how late it was, how long the keepalive ioctl took, the time
+ * left right after it and the status. Nothing is printed per ping; every
+ * interval seconds one summary line aggregates the pings since the last
+ * one, and on exit the ring is dumped in binary (struct wdt_tele_hdr,
+ * then the records oldest first, host byte order).
+ *
+ * Summaries are emitted from the ping path, so telemetry adds no wakeups.
+ * With telemetry off there is no ring and the loops skip the status
+ * ioctls altogether.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "watchdog-test.h"
+
+struct wdt_tele {
+	struct wdt_tele_rec *ring;
+	unsigned int size, head;
+	uint64_t count;
+	uint64_t start, start_rt;
+	uint64_t interval, next;
+	char *dump;
+	/* aggregate since the last summary */
+	unsigned long n;
+	int left_min, left_max;
+	long long left_sum;
+	unsigned long left_n;
+	uint64_t err_max, ioctl_max;
+	uint32_t status;
+};
+
+static void wdt_tele_reset(struct wdt_tele *tl)
+{
+	tl->n = 0;
+	tl->left_min = INT32_MAX;
+	tl->left_max = INT32_MIN;
+	tl->left_sum = 0;
+	tl->left_n = 0;
+	tl->err_max = 0;
+	tl->ioctl_max = 0;
+	tl->status = 0;
+}
+
+/*
+ * NULL without -T and -D (or out of memory): the keepalive loops then
+ * skip the status ioctls, wdt_tele_ping() and wdt_tele_close() do
+ * nothing.
+ */
+struct wdt_tele *wdt_tele_open(unsigned int interval_s, const char *dump,
+			       unsigned int size)
+{
+	struct wdt_tele *tl;
+	struct timespec rt;
+
+	if (!interval_s && !dump)
+		return NULL;
+
+	tl = calloc(1, sizeof(*tl));
+	if (!tl)
+		return NULL;
+	tl->ring = calloc(size, sizeof(*tl->ring));
+	if (!tl->ring) {
+		free(tl);
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &rt);
+	tl->start_rt = rt.tv_sec * NSEC_PER_SEC + rt.tv_nsec;
+	tl->start = wdt_now();
+	tl->size = size;
+	tl->interval = interval_s * NSEC_PER_SEC;
+	tl->next = tl->start + tl->interval;
+	tl->dump = dump ? strdup(dump) : NULL;
+	wdt_tele_reset(tl);
+
+	return tl;
+}
+
+static void wdt_tele_summary(struct wdt_tele *tl, uint64_t now)
+{
+	printf("[%10.3f] %lu pings", (now - tl->start) / 1e9, tl->n);
+	if (tl->left_n)
+		printf(", time left %d/%.1f/%d s", tl->left_min,
+		       (double)tl->left_sum / tl->left_n, tl->left_max);
+	printf(", late max %.1f us, keepalive max %.1f us, status %#x\n",
+	       tl->err_max / 1e3, tl->ioctl_max / 1e3, tl->status);
+	fflush(stdout);
+}
+
+/*
+ * t: ping time, err: lateness against the schedule, end: end of the
+ * keepalive ioctl, left: WDIOC_GETTIMELEFT or -1
+ */
+void wdt_tele_ping(struct wdt_tele *tl, uint64_t t, uint64_t err,
+		   uint64_t end, int left, unsigned int status)
+{
+	struct wdt_tele_rec *r;
+
+	if (!tl)
+		return;
+
+	r = &tl->ring[tl->head];
+	r->t = t - tl->start;
+	r->err = err > UINT32_MAX ? UINT32_MAX : err;
+	r->ioctl = end - t > UINT32_MAX ? UINT32_MAX : end - t;
+	r->left = left;
+	r->status = status;
+	tl->head = (tl->head + 1) % tl->size;
+	tl->count++;
+
+	tl->n++;
+	if (left >= 0) {
+		if (left < tl->left_min)
+			tl->left_min = left;
+		if (left > tl->left_max)
+			tl->left_max = left;
+		tl->left_sum += left;
+		tl->left_n++;
+	}
+	if (r->err > tl->err_max)
+		tl->err_max = r->err;
+	if (r->ioctl > tl->ioctl_max)
+		tl->ioctl_max = r->ioctl;
+	tl->status |= status;
+
+	if (tl->interval && end >= tl->next) {
+		wdt_tele_summary(tl, end);
+		wdt_tele_reset(tl);
+		while (tl->next <= end)
+			tl->next += tl->interval;
+	}
+}
+
+static int wdt_tele_dump(struct wdt_tele *tl)
+{
+	struct wdt_tele_hdr h = {
+		.magic = WDT_TELE_MAGIC,
+		.version = WDT_TELE_VERSION,
+		.rec_size = sizeof(struct wdt_tele_rec),
+		.start_rt = tl->start_rt,
+		.start = tl->start,
+		.total = tl->count,
+	};
+	size_t older = 0;
+	FILE *fp;
+	int ret = 0;
+
+	/* once wrapped, the oldest record sits at head */
+	h.count = tl->count < tl->size ? tl->count : tl->size;
+	if (tl->count > tl->size)
+		older = tl->size - tl->head;
+
+	fp = fopen(tl->dump, "wb");
+	if (!fp) {
+		perror(tl->dump);
+		return -errno;
+	}
+
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	    fwrite(tl->ring + tl->head, sizeof(*tl->ring), older, fp) != older ||
+	    fwrite(tl->ring, sizeof(*tl->ring), h.count - older, fp) !=
+	    h.count - older)
+		ret = -EIO;
+
+	if (fclose(fp))
+		ret = -errno;
+	return ret;
+}
+
+void wdt_tele_close(struct wdt_tele *tl)
+{
+	if (!tl)
+		return;
+
+	if (tl->interval && tl->n)
+		wdt_tele_summary(tl, wdt_now());
+	if (tl->dump && wdt_tele_dump(tl))
+		fprintf(stderr, "error: telemetry dump to %s failed\n", tl->dump);
+
+	free(tl->dump);
+	free(tl->ring);
+	free(tl);
+}
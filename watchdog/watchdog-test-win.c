@@ -0,0 +1,264 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Window mode boundary search for watchdog-test
+ *
+ * Finds the earliest and the latest ping offset the firmware accepts,
+ * measured from the start of a cycle, by bisection. Every probe is one
+ * cycle: enable the card, ping once at the probe offset, read
+ * WDIOC_GETSTATUS, then send a recovery ping in the middle of the
+ * nominal window and disable the card again.
+ *
+ * A probe fails when the status shows bits that were clear at the start
+ * of the cycle. Probes the firmware answers with a reset are caught on
+ * the next boot: the search state, with the boot id, is written to a
+ * file before every probe. A pending probe counts as a failure when the
+ * boot id changed and the boot status has WDIOF_CARDRESET, after which
+ * the search carries on. Any other pending probe is repeated.
+ *
+ * The result is the last bracket of each edge, widened by the worst
+ * timing error of the probe pings.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/watchdog.h>
+
+#include "watchdog-test.h"
+
+#define WIN_SETTLE_US	20000	/* status update after a probe ping */
+#define WIN_BOOT_ID		"/proc/sys/kernel/random/boot_id"
+
+enum { WIN_OPEN, WIN_CLOSE, WIN_EDGES };
+
+static const char *const win_edge_name[WIN_EDGES] = { "open", "close" };
+
+struct win_search {
+	/* safe and unsafe end of the bracket of each edge, in us */
+	long long safe[WIN_EDGES], unsafe[WIN_EDGES];
+	unsigned long probes;
+	int pending;		/* edge of the probe in flight, -1: none */
+	long long pending_us;
+	long long jitter_us;	/* worst probe ping timing error */
+	int stuck;
+	char boot_id[40];	/* of the boot that saved the state, "" unknown */
+};
+
+static void win_boot_id(char *id, size_t len)
+{
+	FILE *fp = fopen(WIN_BOOT_ID, "r");
+
+	id[0] = 0;
+	if (!fp)
+		return;
+	if (!fgets(id, len, fp))
+		id[0] = 0;
+	id[strcspn(id, "\n")] = 0;
+	fclose(fp);
+}
+
+static int win_load(const char *path, struct win_search *w)
+{
+	FILE *fp = fopen(path, "r");
+	int n;
+
+	if (!fp)
+		return -errno;
+
+	/* files without the boot id still resume, pending probes repeat */
+	w->boot_id[0] = 0;
+	n = fscanf(fp, "open %lld %lld\nclose %lld %lld\nprobes %lu\n"
+		   "pending %d %lld\njitter %lld\nboot %39s\n",
+		   &w->safe[WIN_OPEN], &w->unsafe[WIN_OPEN],
+		   &w->safe[WIN_CLOSE], &w->unsafe[WIN_CLOSE], &w->probes,
+		   &w->pending, &w->pending_us, &w->jitter_us, w->boot_id);
+	fclose(fp);
+
+	return n >= 8 ? 0 : -EINVAL;
+}
+
+/* the state must be on disk before a probe that may reset the board */
+static int win_save(const char *path, struct win_search *w)
+{
+	char tmp[4096];
+	FILE *fp;
+	int ret = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		perror(tmp);
+		return -errno;
+	}
+
+	fprintf(fp, "open %lld %lld\nclose %lld %lld\nprobes %lu\n"
+		"pending %d %lld\njitter %lld\nboot %s\n", w->safe[WIN_OPEN],
+		w->unsafe[WIN_OPEN], w->safe[WIN_CLOSE], w->unsafe[WIN_CLOSE],
+		w->probes, w->pending, w->pending_us, w->jitter_us,
+		w->boot_id);
+	if (fflush(fp) || fsync(fileno(fp)))
+		ret = -errno;
+	fclose(fp);
+
+	if (!ret && rename(tmp, path))
+		ret = -errno;
+	if (ret)
+		fprintf(stderr, "error: saving %s: %s\n", path, strerror(-ret));
+
+	return ret;
+}
+
+static void win_sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / NSEC_PER_SEC,
+		.tv_nsec = t % NSEC_PER_SEC,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR && !done)
+		;
+}
+
+/* one cycle with a ping at offset_us, returns 1 when it was rejected */
+static int win_probe(int fd, struct win_search *w, long long offset_us,
+		     long long mid_us)
+{
+	int flags, base = 0, status = 0, dummy;
+	uint64_t t0, t, err;
+
+	flags = WDIOS_ENABLECARD;
+	ioctl(fd, WDIOC_SETOPTIONS, &flags);
+	t0 = wdt_now();
+	ioctl(fd, WDIOC_GETSTATUS, &base);
+	if (base && !w->stuck) {
+		/* bits that stay set can't flag the next violation */
+		printf("warning: status %#x set at cycle start\n", base);
+		w->stuck = 1;
+	}
+
+	win_sleep_until(t0 + offset_us * 1000ull);
+	t = wdt_now();
+	ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	/* the ping counts somewhere between t and the end of the ioctl */
+	err = wdt_now() - (t0 + offset_us * 1000ull);
+	if ((long long)(err / 1000) > w->jitter_us)
+		w->jitter_us = err / 1000;
+
+	win_sleep_until(t + WIN_SETTLE_US * 1000ull);
+	if (ioctl(fd, WDIOC_GETSTATUS, &status))
+		status = base;
+
+	/* recovery: a ping well inside the window, then end the cycle */
+	win_sleep_until(t + mid_us * 1000ull);
+	ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	flags = WDIOS_DISABLECARD;
+	ioctl(fd, WDIOC_SETOPTIONS, &flags);
+
+	w->probes++;
+	return (status & ~base) != 0;
+}
+
+static void win_account(struct win_search *w, int edge, long long offset_us,
+			int rejected)
+{
+	if (rejected)
+		w->unsafe[edge] = offset_us;
+	else
+		w->safe[edge] = offset_us;
+
+	printf("probe %3lu: %-5s %10.3f ms %s\n", w->probes,
+	       win_edge_name[edge], offset_us / 1e3,
+	       rejected ? "rejected" : "accepted");
+}
+
+int watchdog_window_search(int fd, int timeout, int pretimeout,
+			   const char *state, unsigned int res_ms)
+{
+	struct win_search w;
+	char boot_id[sizeof(w.boot_id)];
+	long long mid_us, res_us = res_ms * 1000ll;
+	int flags, boot = 0, edge, ret;
+
+	flags = WDIOS_DISABLECARD;
+	ioctl(fd, WDIOC_SETOPTIONS, &flags);
+
+	if (ioctl(fd, WDIOC_SETPRETIMEOUT, &pretimeout))
+		printf("error: setting pretimeout failed %d\n", errno);
+	ioctl(fd, WDIOC_GETPRETIMEOUT, &pretimeout);
+	if (ioctl(fd, WDIOC_SETTIMEOUT, &timeout))
+		printf("error: setting timeout failed %d\n", errno);
+	ioctl(fd, WDIOC_GETTIMEOUT, &timeout);
+
+	mid_us = (pretimeout + timeout / 2.0) * 1e6;
+
+	ret = win_load(state, &w);
+	if (ret) {
+		/* nominal window pretimeout..pretimeout + timeout */
+		memset(&w, 0, sizeof(w));
+		w.safe[WIN_OPEN] = mid_us;
+		w.unsafe[WIN_OPEN] = 0;
+		w.safe[WIN_CLOSE] = mid_us;
+		w.unsafe[WIN_CLOSE] = (pretimeout + timeout * 1.5) * 1e6;
+		w.pending = -1;
+		printf("window search: new, state in %s\n", state);
+	} else {
+		printf("window search: resuming %s after %lu probes\n", state,
+		       w.probes);
+	}
+
+	win_boot_id(boot_id, sizeof(boot_id));
+	if (w.pending >= 0 && w.boot_id[0] && boot_id[0] &&
+	    strcmp(w.boot_id, boot_id) &&
+	    !ioctl(fd, WDIOC_GETBOOTSTATUS, &boot) &&
+	    (boot & WDIOF_CARDRESET)) {
+		/* the last probe never came back: it reset the board */
+		w.probes++;
+		win_account(&w, w.pending, w.pending_us, 1);
+	} else if (w.pending >= 0) {
+		/* the run was cut short (or the reset can't be told), repeat */
+		printf("window search: probe at %.3f ms not finished, repeated\n",
+		       w.pending_us / 1e3);
+	}
+	w.pending = -1;
+	memcpy(w.boot_id, boot_id, sizeof(w.boot_id));
+
+	printf("pretimeout: %d timeout: %d, resolution %u ms\n", pretimeout,
+	       timeout, res_ms);
+
+	for (edge = 0; edge < WIN_EDGES && !done; edge++) {
+		while (llabs(w.safe[edge] - w.unsafe[edge]) > res_us && !done) {
+			long long x = (w.safe[edge] + w.unsafe[edge]) / 2;
+
+			w.pending = edge;
+			w.pending_us = x;
+			if (win_save(state, &w))
+				return -EIO;
+
+			win_account(&w, edge, x, win_probe(fd, &w, x, mid_us));
+			w.pending = -1;
+		}
+	}
+	if (win_save(state, &w))
+		return -EIO;
+	if (done)
+		return 0;
+
+	printf("\nwindow after %lu probes (ping timing error up to %lld us):\n",
+	       w.probes, w.jitter_us);
+	for (edge = 0; edge < WIN_EDGES; edge++) {
+		long long lo = w.safe[edge] < w.unsafe[edge] ?
+			       w.safe[edge] : w.unsafe[edge];
+		long long hi = w.safe[edge] + w.unsafe[edge] - lo;
+
+		printf("  %-5s %10.3f ms, bracket %.3f .. %.3f ms\n",
+		       win_edge_name[edge], (lo + hi) / 2e3,
+		       (lo - w.jitter_us) / 1e3, (hi + w.jitter_us) / 1e3);
+	}
+	printf("  nominal %d .. %d s\n", pretimeout, pretimeout + timeout);
+
+	return 0;
+}
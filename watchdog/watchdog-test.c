@@ -14,12 +14,22 @@
 #include <linux/types.h>
 #include <linux/watchdog.h>
 
+#include "watchdog-test.h"
+#include "dmec-trace.h"
+
 #define DEFAULT_TIMEOUT		5
+#define DEFAULT_SAMPLE_US	5000
+#define DEFAULT_RES_MS		10
+#define DEFAULT_TELE_S		10
+
+volatile sig_atomic_t done;
 
 static int fd;
 static int stop;
 static int force;
 static int win_mode;
+static int verbose;
+static struct wdt_tele *tele;
 
 static struct watchdog_info wdt_info;
 
@@ -39,8 +49,30 @@ static void usage(void)
 	printf("   -s stop          stop watchdog on exit\n");
 	printf("   -p pretimeout          watchdog pretimeout\n");
 	printf("   -w window mode   enable watchdog window mode\n");
+	printf("   -c list          characterize timeouts, list of\n");
+	printf("                    timeout[/pretimeout],... (stops the watchdog\n");
+	printf("                    when done)\n");
+	printf("   -r us            characterize: GETTIMELEFT sample interval\n");
+	printf("   -W file          window mode: search the window edges by\n");
+	printf("                    bisection, state kept in file across resets\n");
+	printf("   -R ms            window search resolution (default %d)\n",
+	       DEFAULT_RES_MS);
+	printf("   -L load          keepalive latency under load per scheduling\n");
+	printf("                    policy, load as cpu=N,mem=MB,io=N,secs=S,\n");
+	printf("                    period=MS,pol=normal:nice:fifo:mlock,dir=D\n");
+	printf("   -T secs          telemetry summary interval, 0: off (default %d)\n",
+	       DEFAULT_TELE_S);
+	printf("   -D file          dump the last %d keepalive records to file\n",
+	       WDT_TELE_RING);
+	printf("   -v               print time left and status after every ping\n");
+	printf("With %s=dir set, keepalives are recorded for dmec-trace-merge.\n",
+	       DMEC_TRACE_ENV);
 	printf("Example:\n");
-	printf("\twatchdog_test -d /dev/watchdog1\n\n");
+	printf("\twatchdog_test -d /dev/watchdog1\n");
+	printf("\twatchdog_test -d /dev/watchdog1 -c 5,10/3,30 -r 1000\n");
+	printf("\twatchdog_test -d /dev/watchdog1 -w -p 2 -t 4 -W /var/lib/wdwin\n");
+	printf("\twatchdog_test -d /dev/watchdog1 -t 2 -L cpu=8,mem=512,io=2\n");
+	printf("\twatchdog_test -d /dev/watchdog1 -T 60 -D /tmp/wd.bin\n\n");
 }
 
 /*
@@ -50,9 +82,11 @@ static void usage(void)
  */
 static void keep_alive(void)
 {
+	uint64_t t0 = dmec_trace_begin();
 	int dummy, ret;
 
 	ret = ioctl(fd, WDIOC_KEEPALIVE, &dummy);
+	dmec_trace_end("wdt", "keepalive", t0, ret);
 	if (ret)
 		printf("error: %d\n", ret);
 }
@@ -64,23 +98,22 @@ static void keep_alive(void)
 
 static void term(int sig)
 {
-	if (stop) {
-		fprintf(stderr, "WARN: stopping watchdog ticks...\n");
-		if (win_mode) {
-			int flags = WDIOS_DISABLECARD;
-
-			ioctl(fd, WDIOC_SETOPTIONS, &flags);
-		} else {
-			int n = write(fd, "V", sizeof("V"));
+	done = 1;
+}
 
-			if (n <= 0)
-				printf("write failed %d\n", n);
-		}
-		}
+static void watchdog_stop(int fd)
+{
+	fprintf(stderr, "WARN: stopping watchdog ticks...\n");
+	if (win_mode) {
+		int flags = WDIOS_DISABLECARD;
 
-	close(fd);
+		ioctl(fd, WDIOC_SETOPTIONS, &flags);
+	} else {
+		int n = write(fd, "V", sizeof("V"));
 
-	exit(0);
+		if (n <= 0)
+			printf("write failed %d\n", n);
+	}
 }
 
 static void watchdog_loop_standard(int fd,
@@ -89,6 +122,8 @@ static void watchdog_loop_standard(int fd,
 {
 	unsigned long i = 0;
 	long ping_time;
+	struct wdt_sched s;
+	uint64_t t;
 
 	int ret = ioctl(fd, WDIOC_SETPRETIMEOUT, &pretimeout);
 	if (ret)
@@ -118,28 +153,50 @@ static void watchdog_loop_standard(int fd,
 			ping_time *= 1000 * 1000;
 
 	printf("keep alive interval: %ld [us]\n", ping_time);
-	while (1) {
-		int delta = 0, status;
+
+	/* the first stage expires pretimeout (or timeout) after a ping */
+	keep_alive();
+	wdt_sched_init(&s, ping_time * 1000ull, 0,
+				   (pretimeout ? pretimeout : timeout) * NSEC_PER_SEC, wdt_now());
+
+	while ((t = wdt_sched_wait(&s))) {
+		int delta = -1, status = 0;
+		uint64_t err, end;
 
 		keep_alive();
+		end = wdt_now();
+		err = wdt_sched_ping(&s, t);
+		dmec_trace_counter("wdt", "late_ns", err);
 
-		if (ioctl(fd, WDIOC_GETTIMELEFT, &delta) == 0 && delta > 0)
-			printf("delta = %#x\n", delta);
+		/* the status ioctls are only paid for when someone looks */
+		if (!tele && !verbose)
+			continue;
 
+		if (ioctl(fd, WDIOC_GETTIMELEFT, &delta))
+			delta = -1;
 		if (ioctl(fd, WDIOC_GETSTATUS, &status))
 			printf("error: get status failed %d\n", status);
-		printf("[%20lu] status: %#x\n", i++, status);
-		usleep(ping_time);
+		wdt_tele_ping(tele, t, err, end, delta, status);
+
+		if (verbose) {
+			if (delta > 0)
+				printf("delta = %#x\n", delta);
+			printf("[%20lu] status: %#x\n", i++, status);
+		}
 	}
 
+	wdt_tele_close(tele);
+	wdt_sched_report(&s);
 }
 
 static void watchdog_loop_window(int fd,
 								 int timeout,
 								 int pretimeout)
 {
-	unsigned int i, flags;
+	unsigned int i = 0, flags;
 	long ping_time;
+	struct wdt_sched s;
+	uint64_t t;
 
 	flags = WDIOS_DISABLECARD;
 	ioctl(fd, WDIOC_SETOPTIONS, &flags);
@@ -171,24 +228,44 @@ static void watchdog_loop_window(int fd,
 	flags = WDIOS_ENABLECARD;
 	ioctl(fd, WDIOC_SETOPTIONS, &flags);
 
-	while (1) {
-		int status;
+	/* a ping is accepted between pretimeout and pretimeout + timeout */
+	wdt_sched_init(&s, ping_time * 1000ull, pretimeout * NSEC_PER_SEC,
+				   (pretimeout + timeout) * NSEC_PER_SEC, wdt_now());
+
+	while ((t = wdt_sched_wait(&s))) {
+		int status = 0;
+		uint64_t err, end;
 
-		if (ioctl(fd, WDIOC_GETSTATUS, &status))
-			printf("error: get status failed %d\n", status);
-		printf("[%20d] status: %#x\n", i++, status);
-		usleep(ping_time);
 		keep_alive();
-		if (i > 2 && force)
+		end = wdt_now();
+		err = wdt_sched_ping(&s, t);
+		dmec_trace_counter("wdt", "late_ns", err);
+		if (i++ > 2 && force)
 				keep_alive();
+
+		if (!tele && !verbose)
+			continue;
+
+		if (ioctl(fd, WDIOC_GETSTATUS, &status))
+			printf("error: get status failed %d\n", status);
+		wdt_tele_ping(tele, t, err, end, -1, status);
+
+		if (verbose)
+			printf("[%20d] status: %#x\n", i - 1, status);
 	}
+
+	wdt_tele_close(tele);
+	wdt_sched_report(&s);
 }
 
 int main(int argc, char *argv[])
 {
 	int flags;
 	unsigned int timeout = DEFAULT_TIMEOUT, pretimeout = 0;
-	char *watchdog_dev = NULL;
+	unsigned int sample_us = DEFAULT_SAMPLE_US, res_ms = DEFAULT_RES_MS;
+	char *watchdog_dev = NULL, *char_list = NULL, *win_state = NULL;
+	char *load = NULL, *tele_dump = NULL;
+	unsigned int tele_s = DEFAULT_TELE_S;
 
 	while (1) {
 		int option_index = 0;
@@ -200,10 +277,18 @@ int main(int argc, char *argv[])
 			{"w", no_argument, 0, 4},
 			{"f", no_argument, 0, 5},
 			{"help", no_argument, 0, 6},
+			{"c", required_argument, 0, 7},
+			{"r", required_argument, 0, 8},
+			{"W", required_argument, 0, 9},
+			{"R", required_argument, 0, 10},
+			{"L", required_argument, 0, 11},
+			{"T", required_argument, 0, 12},
+			{"D", required_argument, 0, 13},
+			{"v", no_argument, 0, 14},
 			{0, 0, 0, 0}
 		};
 
-		char c = getopt_long(argc, argv, "d:ht:sp:wf",
+		char c = getopt_long(argc, argv, "d:ht:sp:wfc:r:W:R:L:T:D:v",
 				     long_options, &option_index);
 		if (c == -1)
 			break;
@@ -233,6 +318,38 @@ int main(int argc, char *argv[])
 		case 'f':
 			force = 1;
 			break;
+		case 7:
+		case 'c':
+			char_list = strdup(optarg);
+			break;
+		case 8:
+		case 'r':
+			sample_us = atoi(optarg);
+			break;
+		case 9:
+		case 'W':
+			win_state = strdup(optarg);
+			break;
+		case 10:
+		case 'R':
+			res_ms = atoi(optarg);
+			break;
+		case 11:
+		case 'L':
+			load = strdup(optarg);
+			break;
+		case 12:
+		case 'T':
+			tele_s = atoi(optarg);
+			break;
+		case 13:
+		case 'D':
+			tele_dump = strdup(optarg);
+			break;
+		case 14:
+		case 'v':
+			verbose = 1;
+			break;
 		case 6:
 		case 'h':
 		case '?':
@@ -246,6 +363,24 @@ int main(int argc, char *argv[])
 		goto end;
 	}
 
+	if ((char_list || load) && win_mode) {
+		printf("error: characterization and load runs need standard mode.\n");
+		usage();
+		goto end;
+	}
+
+	if (char_list && !sample_us) {
+		printf("error: characterization needs -r > 0.\n");
+		usage();
+		goto end;
+	}
+
+	if (win_state && (!win_mode || !res_ms)) {
+		printf("error: window search needs window mode and -R > 0.\n");
+		usage();
+		goto end;
+	}
+
 	if (win_mode && !pretimeout) {
 		printf("error: window mode requeires pretimeout.\n");
 		usage();
@@ -266,6 +401,8 @@ int main(int argc, char *argv[])
 	fflush(stderr);
 
 	signal(SIGINT, term);
+	signal(SIGTERM, term);
+	dmec_trace_open("watchdog-test");
 
 	int ret = ioctl(fd, WDIOC_GETSUPPORT, &wdt_info);
 	if (!ret)
@@ -275,13 +412,30 @@ int main(int argc, char *argv[])
 	if (!ret)
 			printf("boot status: %#x\n", flags);
 
-	if (!win_mode)
-		watchdog_loop_standard(fd, timeout, pretimeout);
-	else
-		watchdog_loop_window(fd, timeout, pretimeout);
+	if (char_list)
+		watchdog_characterize(fd, char_list, sample_us);
+	else if (win_state)
+		watchdog_window_search(fd, timeout, pretimeout, win_state, res_ms);
+	else if (load)
+		watchdog_load_bench(fd, timeout, pretimeout, load);
+	else {
+		tele = wdt_tele_open(tele_s, tele_dump, WDT_TELE_RING);
+		if (!win_mode)
+			watchdog_loop_standard(fd, timeout, pretimeout);
+		else
+			watchdog_loop_window(fd, timeout, pretimeout);
+	}
+
+	/* nothing keeps the dog fed after a characterization or load run */
+	if (stop || char_list || load)
+		watchdog_stop(fd);
 
 end:
 	close(fd);
 	free(watchdog_dev);
+	free(char_list);
+	free(win_state);
+	free(load);
+	free(tele_dump);
 	return 0;
 }
@@ -0,0 +1,93 @@
+/* vim: set ts=4:sts=4:sw=4:noet: */
+/*
+ * Watchdog Driver Test Program, shared definitions
+ */
+#ifndef _WATCHDOG_TEST_H_
+#define _WATCHDOG_TEST_H_
+
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+
+#define NSEC_PER_SEC	1000000000ull
+#define NSEC_PER_MSEC	1000000ull
+
+/* ping error buckets: < 1 us, then powers of two up to ~4 s */
+#define WDT_ERR_BUCKETS	24
+/* window position buckets: too early, 10 % steps, expired */
+#define WDT_POS_BUCKETS	12
+
+extern volatile sig_atomic_t done;
+
+static inline uint64_t wdt_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Keepalive pacing on absolute CLOCK_MONOTONIC deadlines. A ping is
+ * allowed between open and close ns after the previous one.
+ */
+struct wdt_sched {
+	uint64_t period;
+	uint64_t open, close;
+	uint64_t next;		/* ideal time of the next ping */
+	uint64_t last;		/* actual time of the previous ping */
+	unsigned long pings, reanchored;
+	uint64_t err_max, err_sum;
+	int64_t early_min, late_min;	/* smallest margin to either edge */
+	unsigned long err_hist[WDT_ERR_BUCKETS];
+	unsigned long pos_hist[WDT_POS_BUCKETS];
+};
+
+/* watchdog-test-sched.c */
+void wdt_sched_init(struct wdt_sched *s, uint64_t period, uint64_t open,
+		    uint64_t close, uint64_t start);
+uint64_t wdt_sched_wait(struct wdt_sched *s);
+uint64_t wdt_sched_ping(struct wdt_sched *s, uint64_t t);
+void wdt_sched_report(struct wdt_sched *s);
+
+/* watchdog-test-tele.c */
+#define WDT_TELE_MAGIC		"WDTT"
+#define WDT_TELE_VERSION	1
+#define WDT_TELE_RING		4096
+
+struct wdt_tele_hdr {
+	char magic[4];
+	uint32_t version;
+	uint32_t rec_size;
+	uint32_t count;		/* records in the dump */
+	uint64_t total;		/* pings recorded, including overwritten ones */
+	uint64_t start_rt;	/* CLOCK_REALTIME at start, ns */
+	uint64_t start;		/* CLOCK_MONOTONIC at start, ns */
+};
+
+struct wdt_tele_rec {
+	uint64_t t;		/* ns since start */
+	uint32_t err;		/* ns late against the schedule */
+	uint32_t ioctl;		/* ns spent in the keepalive ioctl */
+	int32_t left;		/* WDIOC_GETTIMELEFT, -1 if unsupported */
+	uint32_t status;	/* WDIOC_GETSTATUS */
+};
+
+struct wdt_tele;
+struct wdt_tele *wdt_tele_open(unsigned int interval_s, const char *dump,
+			       unsigned int size);
+void wdt_tele_ping(struct wdt_tele *tl, uint64_t t, uint64_t err,
+		   uint64_t end, int left, unsigned int status);
+void wdt_tele_close(struct wdt_tele *tl);
+
+/* watchdog-test-char.c */
+int watchdog_characterize(int fd, const char *list, unsigned int sample_us);
+
+/* watchdog-test-win.c */
+int watchdog_window_search(int fd, int timeout, int pretimeout,
+			   const char *state, unsigned int res_ms);
+
+/* watchdog-test-load.c */
+int watchdog_load_bench(int fd, int timeout, int pretimeout, char *opts);
+
+#endif /* _WATCHDOG_TEST_H_ */